@@ -0,0 +1,248 @@
+// Host-side sink for camera benchmark runs (BENCHMARK_MODE in the camera
+// sketch). It takes every camera transport the backend does and only
+// measures: nothing is stored, recognized or broadcast, so every run
+// measures the camera and the link rather than the backend's load.
+//
+//   node scripts/camera-bench-sink.js [--port 9003] [--udp-port 9004]
+//                                     [--fps 20] [--out bench-results.jsonl]
+//
+// For each device it records arrival times, frame sizes and sequence gaps.
+// Jitter is |inter-arrival - 1000 / fps| over consecutive frames. When the
+// camera POSTs its report to /api/v1/bench/report, the report and the
+// sink's view of the same window (the camera's durationMs, ending
+// endedMsAgo before the report) go out as one JSON line to --out, so runs
+// across FRAMESIZE_*, jpeg_quality, fb_count and TRANSPORT_MODE can be
+// compared line by line.
+const http = require('http');
+const fs = require('fs');
+const { FrameStreamParser } = require('../src/frameStream');
+const { UdpFrameReceiver } = require('../src/frameDatagram');
+
+const SUMMARY_INTERVAL_MS = 5000;
+const MAX_REPORT_BYTES = 16 * 1024;
+const MAX_ARRIVALS = 200000;  // Per device; well over an hour at 20 FPS
+
+function parseArgs(argv) {
+  const options = { port: 9003, udpPort: 9004, fps: 20, out: 'bench-results.jsonl' };
+  for (let i = 0; i < argv.length; i += 2) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--port': options.port = parseInt(value, 10); break;
+      case '--udp-port': options.udpPort = parseInt(value, 10); break;
+      case '--fps': options.fps = parseFloat(value); break;
+      case '--out': options.out = value; break;
+      default:
+        console.error(`Unknown option ${argv[i]}`);
+        process.exit(1);
+    }
+  }
+  return options;
+}
+
+// Nearest-rank percentile of a sorted array
+function percentile(sorted, pct) {
+  if (sorted.length === 0) return null;
+  return sorted[Math.max(1, Math.ceil(sorted.length * pct / 100)) - 1];
+}
+
+class DeviceStats {
+  constructor(deviceId, expectedIntervalMs) {
+    this.deviceId = deviceId;
+    this.expectedIntervalMs = expectedIntervalMs;
+    this.arrivals = [];
+  }
+
+  record(transport, length, seq, now) {
+    if (this.arrivals.length >= MAX_ARRIVALS) this.arrivals.shift();
+    this.arrivals.push({ at: now, length, seq: seq === undefined ? null : seq, transport });
+  }
+
+  get frames() {
+    return this.arrivals.length;
+  }
+
+  // Figures for the frames that arrived in [from, to], or all of them
+  summary(from = -Infinity, to = Infinity) {
+    const arrivals = this.arrivals.filter(arrival => arrival.at >= from && arrival.at <= to);
+    const jitter = [];
+    const transports = {};
+    let bytes = 0;
+    let lostFrames = 0;
+    let reordered = 0;
+    let lastSeq = null;
+
+    arrivals.forEach((arrival, i) => {
+      if (i > 0) jitter.push(Math.abs(arrival.at - arrivals[i - 1].at - this.expectedIntervalMs));
+      bytes += arrival.length;
+      transports[arrival.transport] = (transports[arrival.transport] || 0) + 1;
+      if (arrival.seq === null) return;
+      const delta = lastSeq === null ? 1 : (arrival.seq - lastSeq) | 0;
+      if (delta > 1) lostFrames += delta - 1;
+      if (delta <= 0) reordered++;
+      else lastSeq = arrival.seq;
+    });
+
+    const spanMs = arrivals.length ? arrivals[arrivals.length - 1].at - arrivals[0].at : 0;
+    jitter.sort((a, b) => a - b);
+    return {
+      frames: arrivals.length,
+      spanMs,
+      fps: spanMs > 0 ? Number(((arrivals.length - 1) * 1000 / spanMs).toFixed(2)) : null,
+      bytesPerSec: spanMs > 0 ? Math.round(bytes * 1000 / spanMs) : null,
+      avgFrameBytes: arrivals.length ? Math.round(bytes / arrivals.length) : null,
+      jitterMs: {
+        p50: percentile(jitter, 50),
+        p99: percentile(jitter, 99),
+        max: jitter.length ? jitter[jitter.length - 1] : null
+      },
+      lostFrames,
+      reordered,
+      transports
+    };
+  }
+}
+
+function headerInt(value) {
+  const parsed = parseInt(value, 10);
+  return Number.isFinite(parsed) ? parsed : null;
+}
+
+function main() {
+  const options = parseArgs(process.argv.slice(2));
+  const expectedIntervalMs = 1000 / options.fps;
+  const devices = new Map();
+
+  function deviceStats(deviceId) {
+    let stats = devices.get(deviceId);
+    if (!stats) {
+      stats = new DeviceStats(deviceId, expectedIntervalMs);
+      devices.set(deviceId, stats);
+      console.log(`📷 [BenchSink] First frame from ${deviceId}`);
+    }
+    return stats;
+  }
+
+  function reply(res, status, body) {
+    res.writeHead(status, { 'Content-Type': 'application/json', 'Content-Length': Buffer.byteLength(body) });
+    res.end(body);
+  }
+
+  function handleFast(req, res, deviceId) {
+    let length = 0;
+    req.on('data', chunk => { length += chunk.length; });
+    req.on('end', () => {
+      deviceStats(deviceId).record('fast', length, headerInt(req.headers['frame-seq']), Date.now());
+      // Same 16-byte answer as the backend, so keep-alive behaves the same
+      reply(res, 200, '{"success":true}');
+    });
+  }
+
+  function handlePush(req, res, deviceId) {
+    const parser = new FrameStreamParser();
+    console.log(`🔌 [BenchSink] Push stream opened by ${deviceId}`);
+    req.on('data', chunk => {
+      let frames;
+      try {
+        frames = parser.push(chunk);
+      } catch (err) {
+        console.log(`❌ [BenchSink] Corrupt stream from ${deviceId}: ${err.message}`);
+        reply(res, 400, JSON.stringify({ success: false, error: err.message }));
+        req.destroy();
+        return;
+      }
+      const now = Date.now();
+      for (const frame of frames) {
+        deviceStats(deviceId).record('push', frame.data.length, frame.seq, now);
+      }
+    });
+    req.on('end', () => {
+      if (!res.headersSent) reply(res, 200, JSON.stringify({ success: true, frames: parser.framesParsed }));
+    });
+  }
+
+  function handleReport(req, res) {
+    const chunks = [];
+    let size = 0;
+    req.on('data', chunk => {
+      size += chunk.length;
+      if (size <= MAX_REPORT_BYTES) chunks.push(chunk);
+    });
+    req.on('end', () => {
+      let report;
+      try {
+        report = JSON.parse(Buffer.concat(chunks).toString('utf8'));
+      } catch (err) {
+        reply(res, 400, '{"success":false}');
+        return;
+      }
+
+      // The camera says when its window closed, so warmup frames and the
+      // idle gap before the report stay out of the sink's figures
+      const stats = devices.get(report.deviceId);
+      const to = Date.now() - (report.endedMsAgo || 0);
+      const from = report.durationMs ? to - report.durationMs : -Infinity;
+      const sink = stats ? stats.summary(from, to) : null;
+      const line = { recordedAt: new Date().toISOString(), camera: report, sink };
+      fs.appendFileSync(options.out, JSON.stringify(line) + '\n');
+      console.log(`🏁 [BenchSink] Run from ${report.deviceId}: camera ${report.fps} FPS, ` +
+        `send p50/p99 ${report.sendMs && report.sendMs.p50}/${report.sendMs && report.sendMs.p99} ms; ` +
+        (sink ? `sink ${sink.fps} FPS, jitter p50/p99 ${sink.jitterMs.p50}/${sink.jitterMs.p99} ms, ` +
+          `${sink.lostFrames} lost` : 'no frames seen') + ` -> ${options.out}`);
+      // The next run from this camera starts clean
+      devices.delete(report.deviceId);
+      reply(res, 200, '{"success":true}');
+    });
+  }
+
+  const server = http.createServer((req, res) => {
+    const deviceId = req.headers['device-id'] || 'unknown_device';
+    const path = req.url.split('?')[0];
+    if (req.method === 'POST' && path === '/api/v1/stream/fast') return handleFast(req, res, deviceId);
+    if (req.method === 'POST' && path === '/api/v1/stream/push') return handlePush(req, res, deviceId);
+    if (req.method === 'POST' && path === '/api/v1/bench/report') return handleReport(req, res);
+
+    // Heartbeats, buzzer polls and the like: accept and ignore
+    req.resume();
+    req.on('end', () => reply(res, 200, '{"success":true}'));
+  });
+  // Cameras hold keep-alive connections between frames
+  server.keepAliveTimeout = 65000;
+
+  const udpFrames = new UdpFrameReceiver({ port: options.udpPort });
+  udpFrames.on('frame', frame => {
+    deviceStats(frame.deviceId).record('udp', frame.data.length, frame.seq, Date.now());
+  });
+
+  const summaryTimer = setInterval(() => {
+    for (const stats of devices.values()) {
+      if (stats.frames === 0) continue;
+      const summary = stats.summary();
+      console.log(`📊 [BenchSink] ${stats.deviceId}: ${summary.frames} frames, ${summary.fps} FPS, ` +
+        `${summary.bytesPerSec} B/s, jitter p50/p99 ${summary.jitterMs.p50}/${summary.jitterMs.p99} ms, ` +
+        `${summary.lostFrames} lost`);
+    }
+    const udp = udpFrames.getStats();
+    if (udp.datagrams > 0) {
+      console.log(`📊 [BenchSink] UDP: ${udp.datagrams} datagrams, ${udp.incomplete} incomplete, ${udp.late} late`);
+    }
+  }, SUMMARY_INTERVAL_MS);
+
+  udpFrames.listen().then(() => {
+    server.listen(options.port, () => {
+      console.log(`🚀 [BenchSink] Listening on HTTP ${options.port} and UDP ${options.udpPort}, ` +
+        `expecting ${options.fps} FPS, results to ${options.out}`);
+    });
+  }).catch(err => {
+    console.error(`❌ [BenchSink] UDP port ${options.udpPort}: ${err.message}`);
+    process.exit(1);
+  });
+
+  process.on('SIGINT', () => {
+    clearInterval(summaryTimer);
+    udpFrames.close();
+    server.close();
+    process.exit(0);
+  });
+}
+
+main();
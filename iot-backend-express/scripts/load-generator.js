@@ -0,0 +1,401 @@
+// Load generator and soak test for the device-facing endpoints.
+//
+// Simulated devices replay the firmware's request shapes and rates:
+//   sensor node (main.ino, SENSOR_BATCH_MODE 0, BUZZER_LONG_POLL_MS 0)
+//     GET  /api/v1/buzzer/status/:deviceId  every 150 ms
+//     POST /api/v1/ingest/sensor-data       every 1 s, the same JSON fields
+//     POST /api/v1/devices/register once, /api/v1/devices/heartbeat every 60 s
+//   camera (sketch_jun19a.ino, TRANSPORT_DIRECT_POST)
+//     POST /api/v1/stream/fast              20 FPS, image/jpeg with the Frame-* headers
+// Each device runs one loop like the firmware's, with separate keep-alive
+// connections for polls and posts. When a request runs over its slot, the
+// next one starts as soon as it returns, as on the device, and the missed
+// slot is counted.
+//
+//   node scripts/load-generator.js [--url http://localhost:9003]
+//     [--sensors 10,50,100] [--cameras 1,2,4] [--step-ms 60000] [--warmup-ms 5000]
+//     [--fps 20] [--frame-bytes 25000 | --jpeg frame.jpg] [--buzzer-wait 0]
+//     [--api-key key] [--out load-results.jsonl]
+//
+// --sensors and --cameras are fleet sizes, one per step; a single value
+// applies to every step. Devices are added between steps and never removed,
+// so a run is also a soak test when --step-ms is long. For each step the
+// generator prints and appends to --out: per-endpoint throughput, error
+// count and p50/p95/p99/max latency; missed slots; the backend's event-loop
+// lag from /api/v1/system/performance; and this process's own event-loop lag,
+// which must stay low for the numbers to describe the backend.
+const http = require('http');
+const fs = require('fs');
+const { monitorEventLoopDelay } = require('perf_hooks');
+
+const BUZZER_POLL_INTERVAL_MS = 150;
+const SENSOR_SEND_INTERVAL_MS = 1000;
+const HEARTBEAT_INTERVAL_MS = 60000;
+const HTTP_TIMEOUT_MS = 5000;          // HTTP_TIMEOUT_MS in both sketches
+const FAILED_REQUEST_BACKOFF_MS = 1000;
+const EVENT_LOOP_RESOLUTION_MS = 10;
+const FRAME_FLAG_MOTION = 0x01;        // Cameras without motion gating flag every frame
+
+function parseArgs(argv) {
+  const options = {
+    url: 'http://localhost:9003',
+    sensors: [10, 50, 100],
+    cameras: [1],
+    stepMs: 60000,
+    warmupMs: 5000,
+    fps: 20,
+    frameBytes: 25000,
+    jpeg: null,
+    buzzerWait: 0,
+    apiKey: '',
+    out: 'load-results.jsonl'
+  };
+  const list = value => value.split(',').map(n => parseInt(n, 10)).filter(n => n >= 0);
+  for (let i = 0; i < argv.length; i += 2) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--url': options.url = value; break;
+      case '--sensors': options.sensors = list(value); break;
+      case '--cameras': options.cameras = list(value); break;
+      case '--step-ms': options.stepMs = parseInt(value, 10); break;
+      case '--warmup-ms': options.warmupMs = parseInt(value, 10); break;
+      case '--fps': options.fps = parseFloat(value); break;
+      case '--frame-bytes': options.frameBytes = parseInt(value, 10); break;
+      case '--jpeg': options.jpeg = value; break;
+      case '--buzzer-wait': options.buzzerWait = parseInt(value, 10); break;
+      case '--api-key': options.apiKey = value; break;
+      case '--out': options.out = value; break;
+      default:
+        console.error(`Unknown option ${argv[i]}`);
+        process.exit(1);
+    }
+  }
+  return options;
+}
+
+// Start and end markers around random bytes: enough for /stream/fast, which
+// only checks the content type and size. Use --jpeg for recognition to see
+// real images.
+function syntheticFrame(length) {
+  const frame = Buffer.alloc(length);
+  for (let i = 0; i < length; i += 4) frame.writeUInt32LE((Math.random() * 0x100000000) >>> 0, Math.min(i, length - 4));
+  frame[0] = 0xff; frame[1] = 0xd8;
+  frame[length - 2] = 0xff; frame[length - 1] = 0xd9;
+  return frame;
+}
+
+// Nearest-rank percentile of a sorted array
+function percentile(sorted, pct) {
+  if (sorted.length === 0) return null;
+  return sorted[Math.max(1, Math.ceil(sorted.length * pct / 100)) - 1];
+}
+
+const sleep = ms => new Promise(resolve => setTimeout(resolve, ms));
+
+// Request counts and latencies per endpoint for the current step
+class StepStats {
+  constructor() {
+    this.endpoints = new Map();
+    this.missedSlots = 0;
+    this.startedAt = Date.now();
+  }
+
+  endpoint(name) {
+    let stats = this.endpoints.get(name);
+    if (!stats) {
+      stats = { latencies: [], errors: 0, bytes: 0, statuses: {} };
+      this.endpoints.set(name, stats);
+    }
+    return stats;
+  }
+
+  record(name, ms, status, bytes) {
+    const stats = this.endpoint(name);
+    if (status >= 200 && status < 300) {
+      stats.latencies.push(ms);
+      stats.bytes += bytes;
+    } else {
+      stats.errors++;
+    }
+    const key = status || 'network';
+    stats.statuses[key] = (stats.statuses[key] || 0) + 1;
+  }
+
+  summary() {
+    const seconds = (Date.now() - this.startedAt) / 1000;
+    const endpoints = {};
+    for (const [name, stats] of this.endpoints) {
+      const sorted = stats.latencies.sort((a, b) => a - b).map(ms => Math.round(ms * 10) / 10);
+      endpoints[name] = {
+        ok: sorted.length,
+        errors: stats.errors,
+        perSec: Number((sorted.length / seconds).toFixed(1)),
+        bytesPerSec: Math.round(stats.bytes / seconds),
+        latencyMs: {
+          p50: percentile(sorted, 50),
+          p95: percentile(sorted, 95),
+          p99: percentile(sorted, 99),
+          max: sorted.length ? sorted[sorted.length - 1] : null
+        },
+        statuses: stats.statuses
+      };
+    }
+    return { seconds: Number(seconds.toFixed(1)), missedSlots: this.missedSlots, endpoints };
+  }
+}
+
+class LoadGenerator {
+  constructor(options) {
+    this.options = options;
+    const url = new URL(options.url);
+    this.host = url.hostname;
+    this.port = parseInt(url.port, 10) || 80;
+    this.frame = options.jpeg ? fs.readFileSync(options.jpeg) : syntheticFrame(options.frameBytes);
+    this.stats = new StepStats();
+    this.recording = false;
+    this.running = true;
+    this.devices = [];
+    this.runId = Date.now().toString(36);
+  }
+
+  // One request on the given keep-alive agent; resolves { status, ms }.
+  // status is 0 when the request failed or timed out.
+  request(agent, method, path, headers, body, timeoutMs = HTTP_TIMEOUT_MS) {
+    return new Promise(resolve => {
+      const started = process.hrtime.bigint();
+      const done = status => resolve({ status, ms: Number(process.hrtime.bigint() - started) / 1e6 });
+      const req = http.request({ host: this.host, port: this.port, method, path, agent, headers, timeout: timeoutMs }, res => {
+        res.resume();
+        res.on('end', () => done(res.statusCode));
+        res.on('error', () => done(0));
+      });
+      req.on('timeout', () => req.destroy(new Error('timeout')));
+      req.on('error', () => done(0));
+      req.end(body);
+    });
+  }
+
+  // Same header set as iot::HttpClient
+  deviceHeaders(deviceId, contentType, body) {
+    const headers = { 'Device-Id': deviceId, 'Connection': 'keep-alive' };
+    if (this.options.apiKey) headers['X-API-Key'] = this.options.apiKey;
+    if (contentType) {
+      headers['Content-Type'] = contentType;
+      headers['Content-Length'] = body.length;
+    }
+    return headers;
+  }
+
+  async timed(name, agent, method, path, headers, body, timeoutMs) {
+    const result = await this.request(agent, method, path, headers, body, timeoutMs);
+    if (this.recording) this.stats.record(name, result.ms, result.status, body ? body.length : 0);
+    return result;
+  }
+
+  // main.ino's loop(): buzzer poll and sensor post on their own timers,
+  // one request at a time
+  async runSensorNode(index) {
+    const deviceId = `LOAD-SENSOR-${this.runId}-${String(index).padStart(4, '0')}`;
+    const buzzerAgent = new http.Agent({ keepAlive: true, maxSockets: 1 });
+    const networkAgent = new http.Agent({ keepAlive: true, maxSockets: 1 });
+    this.devices.push(buzzerAgent, networkAgent);
+
+    const register = Buffer.from(JSON.stringify({
+      id: deviceId,
+      name: `Load Sensor ${index}`,
+      type: 'ESP32',
+      ipAddress: '10.0.0.1',
+      capabilities: ['temperature', 'humidity', 'distance', 'lightLevel']
+    }));
+    while (this.running) {
+      const { status } = await this.timed('register', networkAgent, 'POST', '/api/v1/devices/register',
+        this.deviceHeaders(deviceId, 'application/json', register), register);
+      if (status >= 200 && status < 300) break;
+      await sleep(FAILED_REQUEST_BACKOFF_MS);
+    }
+
+    const waitMs = this.options.buzzerWait;
+    const statusPath = `/api/v1/buzzer/status/${deviceId}` + (waitMs > 0 ? `?wait=${waitMs}` : '');
+    const bootAt = Date.now();
+    // Spread the fleet over one interval instead of firing in lockstep
+    let nextPoll = Date.now() + Math.random() * BUZZER_POLL_INTERVAL_MS;
+    let nextSend = Date.now() + Math.random() * SENSOR_SEND_INTERVAL_MS;
+    let nextHeartbeat = Date.now() + HEARTBEAT_INTERVAL_MS;
+
+    while (this.running) {
+      const now = Date.now();
+      const due = Math.min(nextPoll, nextSend, nextHeartbeat);
+      if (due > now) {
+        await sleep(due - now);
+        continue;
+      }
+
+      if (Date.now() >= nextPoll) {
+        const { status } = await this.timed('buzzerStatus', buzzerAgent, 'GET', statusPath,
+          this.deviceHeaders(deviceId), null, waitMs + HTTP_TIMEOUT_MS);
+        nextPoll = this.nextSlot(nextPoll, waitMs > 0 ? 0 : BUZZER_POLL_INTERVAL_MS,
+          status === 0 ? FAILED_REQUEST_BACKOFF_MS : 0);
+      }
+
+      if (Date.now() >= nextSend) {
+        const body = Buffer.from(JSON.stringify({
+          deviceId,
+          timestamp: Date.now() - bootAt,
+          temperature: Number((20 + Math.random() * 10).toFixed(1)),
+          humidity: Number((40 + Math.random() * 30).toFixed(1)),
+          distance: Number((Math.random() * 200).toFixed(1)),
+          lightLevel: Math.floor(Math.random() * 4096),
+          customData: { lightMean: 2048, lightMin: 1024, lightMax: 3072, distanceMin: 10.5, distanceMax: 150.2 }
+        }));
+        await this.timed('sensorData', networkAgent, 'POST', '/api/v1/ingest/sensor-data',
+          this.deviceHeaders(deviceId, 'application/json', body), body);
+        nextSend = this.nextSlot(nextSend, SENSOR_SEND_INTERVAL_MS, 0);
+      }
+
+      if (Date.now() >= nextHeartbeat) {
+        const body = Buffer.from(JSON.stringify({
+          deviceId, uptime: Date.now() - bootAt, freeHeap: 180000, wifiRssi: -60, status: 'online'
+        }));
+        await this.timed('heartbeat', networkAgent, 'POST', '/api/v1/devices/heartbeat',
+          this.deviceHeaders(deviceId, 'application/json', body), body);
+        nextHeartbeat = this.nextSlot(nextHeartbeat, HEARTBEAT_INTERVAL_MS, 0);
+      }
+    }
+  }
+
+  // The camera's upload side: one frame POST per frame interval
+  async runCamera(index) {
+    const deviceId = `LOAD-CAM-${this.runId}-${String(index).padStart(3, '0')}`;
+    const agent = new http.Agent({ keepAlive: true, maxSockets: 1 });
+    this.devices.push(agent);
+    const intervalMs = 1000 / this.options.fps;
+    let seq = 0;
+    let next = Date.now() + Math.random() * intervalMs;
+
+    while (this.running) {
+      const wait = next - Date.now();
+      if (wait > 0) await sleep(wait);
+
+      const headers = this.deviceHeaders(deviceId, 'image/jpeg', this.frame);
+      headers['Frame-Flags'] = String(FRAME_FLAG_MOTION);
+      headers['Frame-Age-Ms'] = '0';
+      headers['Frame-Seq'] = String(++seq);
+      headers['Frame-Captured-At'] = String(Date.now());
+      if (seq % 20 === 1) {
+        // METADATA_INTERVAL_FRAMES
+        headers['Device-Name'] = 'ESP32-CAM OV2640';
+        headers['Device-Type'] = 'ESP32-CAM';
+      }
+      const { status } = await this.timed('streamFast', agent, 'POST', '/api/v1/stream/fast', headers, this.frame);
+      next = this.nextSlot(next, intervalMs, status === 0 ? FAILED_REQUEST_BACKOFF_MS : 0);
+    }
+  }
+
+  // Next due time after a request that was due at `due`. A request that ran
+  // past its slot is followed immediately, like the firmware's millis() checks.
+  nextSlot(due, intervalMs, backoffMs) {
+    const now = Date.now();
+    let next = due + intervalMs;
+    if (next < now) {
+      if (this.recording && intervalMs > 0) this.stats.missedSlots += Math.floor((now - next) / intervalMs) + 1;
+      next = now;
+    }
+    return Math.max(next, now + backoffMs);
+  }
+
+  // Backend performance snapshot; ?reset=1 starts its next event-loop window
+  async serverPerformance() {
+    const agent = new http.Agent({ keepAlive: false });
+    return new Promise(resolve => {
+      const req = http.get({ host: this.host, port: this.port, path: '/api/v1/system/performance?reset=1', agent }, res => {
+        const chunks = [];
+        res.on('data', chunk => chunks.push(chunk));
+        res.on('end', () => {
+          try {
+            resolve(JSON.parse(Buffer.concat(chunks).toString('utf8')).performance);
+          } catch (err) {
+            resolve(null);
+          }
+        });
+      });
+      req.on('error', () => resolve(null));
+    });
+  }
+
+  async run() {
+    const { sensors, cameras, stepMs, warmupMs } = this.options;
+    const steps = Math.max(sensors.length, cameras.length);
+    const localLag = monitorEventLoopDelay({ resolution: EVENT_LOOP_RESOLUTION_MS });
+    localLag.enable();
+    const lagMs = ns => Math.max(0, Math.round((ns / 1e6 - EVENT_LOOP_RESOLUTION_MS) * 100) / 100);
+    const loops = [];
+    let sensorCount = 0;
+    let cameraCount = 0;
+
+    console.log(`🚀 [Load] ${this.options.url}: ${steps} steps of ${stepMs} ms, ` +
+      `frames of ${this.frame.length} bytes, results to ${this.options.out}`);
+
+    for (let step = 0; step < steps && this.running; step++) {
+      const targetSensors = sensors[Math.min(step, sensors.length - 1)];
+      const targetCameras = cameras[Math.min(step, cameras.length - 1)];
+      while (sensorCount < targetSensors) loops.push(this.runSensorNode(sensorCount++));
+      while (cameraCount < targetCameras) loops.push(this.runCamera(cameraCount++));
+
+      console.log(`📈 [Load] Step ${step + 1}/${steps}: ${sensorCount} sensor nodes, ${cameraCount} cameras`);
+      this.recording = false;
+      await sleep(warmupMs);
+
+      await this.serverPerformance(); // Opens the backend's event-loop window for this step
+      localLag.reset();
+      this.stats = new StepStats();
+      this.recording = true;
+      await sleep(stepMs);
+      this.recording = false;
+
+      const performance = await this.serverPerformance();
+      const result = {
+        recordedAt: new Date().toISOString(),
+        step: step + 1,
+        sensors: sensorCount,
+        cameras: cameraCount,
+        ...this.stats.summary(),
+        serverEventLoop: performance ? performance.eventLoop : null,
+        serverMemory: performance ? performance.memory : null,
+        generatorEventLoop: {
+          p50Ms: lagMs(localLag.percentile(50)),
+          p99Ms: lagMs(localLag.percentile(99)),
+          maxMs: lagMs(localLag.max)
+        }
+      };
+      fs.appendFileSync(this.options.out, JSON.stringify(result) + '\n');
+      this.print(result);
+    }
+
+    this.running = false;
+    await Promise.race([Promise.all(loops), sleep(HTTP_TIMEOUT_MS)]);
+    for (const agent of this.devices) agent.destroy();
+  }
+
+  print(result) {
+    console.log(`📊 [Load] ${result.sensors} sensor nodes + ${result.cameras} cameras over ${result.seconds} s, ` +
+      `${result.missedSlots} missed slots`);
+    for (const [name, endpoint] of Object.entries(result.endpoints)) {
+      const l = endpoint.latencyMs;
+      console.log(`   ${name.padEnd(12)} ${String(endpoint.perSec).padStart(8)} req/s  ` +
+        `p50 ${l.p50 === null ? '-' : l.p50.toFixed(1)} p95 ${l.p95 === null ? '-' : l.p95.toFixed(1)} ` +
+        `p99 ${l.p99 === null ? '-' : l.p99.toFixed(1)} max ${l.max === null ? '-' : l.max.toFixed(1)} ms  ` +
+        `${endpoint.errors} errors`);
+    }
+    const server = result.serverEventLoop;
+    console.log(`   event loop   backend p50/p99/max ${server ? `${server.p50Ms}/${server.p99Ms}/${server.maxMs}` : '-'} ms, ` +
+      `generator ${result.generatorEventLoop.p50Ms}/${result.generatorEventLoop.p99Ms}/${result.generatorEventLoop.maxMs} ms`);
+  }
+}
+
+const generator = new LoadGenerator(parseArgs(process.argv.slice(2)));
+// Finished steps are already in --out; the one in progress is not recorded
+process.on('SIGINT', () => {
+  console.log('🛑 [Load] Stopped');
+  process.exit(0);
+});
+generator.run().then(() => process.exit(0));
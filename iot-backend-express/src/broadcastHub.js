@@ -0,0 +1,113 @@
+// WebSocket fan-out to dashboards.
+//
+// Each message is serialized once into a Buffer and handed to every socket
+// uncompressed, so ws only adds its few-byte frame header per client
+// instead of re-encoding (and with permessage-deflate, re-compressing) the
+// same JSON once per dashboard. Clients pick the cameras they view with
+//   { "type": "subscribe", "deviceIds": ["ESP32-CAM-001"] }   (null = all)
+// or ?devices=a,b on the connect URL; until then they get every camera.
+// Device-scoped messages sent as droppable (new_frame) are skipped for a
+// client whose send buffer is over highWaterBytes, since the next frame
+// supersedes them anyway. A client that falls maxBufferedBytes behind is
+// dropped instead of being buffered without bound.
+const WebSocket = require('ws');
+
+const DEFAULT_HIGH_WATER_BYTES = 256 * 1024;
+const DEFAULT_MAX_BUFFERED_BYTES = 8 * 1024 * 1024;
+
+class BroadcastHub {
+  constructor(wss, options = {}) {
+    this.wss = wss;
+    this.highWaterBytes = options.highWaterBytes || DEFAULT_HIGH_WATER_BYTES;
+    this.maxBufferedBytes = options.maxBufferedBytes || DEFAULT_MAX_BUFFERED_BYTES;
+    this.subscriptions = new WeakMap(); // ws -> Set of device ids; absent = every camera
+    this.stats = { messages: 0, sent: 0, dropped: 0, terminated: 0 };
+  }
+
+  // Applies ?devices= from the upgrade request
+  track(ws, request) {
+    const devices = new URL(request.url, 'http://localhost').searchParams.get('devices');
+    if (devices) this.subscribe(ws, devices.split(','));
+  }
+
+  // Returns the subscribed ids, or null for every camera
+  subscribe(ws, deviceIds) {
+    if (!Array.isArray(deviceIds)) {
+      this.subscriptions.delete(ws);
+      return null;
+    }
+    const subscribed = new Set(deviceIds.filter(id => typeof id === 'string' && id));
+    this.subscriptions.set(ws, subscribed);
+    return Array.from(subscribed);
+  }
+
+  // Returns true when `data` was a subscription request
+  handleMessage(ws, data) {
+    if (data.type !== 'subscribe') return false;
+    const deviceIds = this.subscribe(ws, data.deviceIds);
+    ws.send(JSON.stringify({ type: 'subscribed', deviceIds, timestamp: Date.now() }));
+    return true;
+  }
+
+  // To the clients viewing this camera. Returns the number of sockets sent to.
+  publish(deviceId, message, options = {}) {
+    return this.fanOut(message, options.droppable === true, ws => {
+      const subscribed = this.subscriptions.get(ws);
+      return !subscribed || subscribed.has(deviceId);
+    });
+  }
+
+  // To every client
+  broadcast(message) {
+    return this.fanOut(message, false, null);
+  }
+
+  fanOut(message, droppable, wants) {
+    const payload = Buffer.from(typeof message === 'string' ? message : JSON.stringify(message));
+    let sent = 0;
+    this.stats.messages++;
+
+    for (const ws of this.wss.clients) {
+      if (ws.readyState !== WebSocket.OPEN || (wants && !wants(ws))) continue;
+
+      const buffered = ws.bufferedAmount;
+      if (buffered > this.maxBufferedBytes) {
+        this.stats.terminated++;
+        console.warn(`📡 WebSocket client ${buffered} bytes behind, disconnecting`);
+        ws.terminate();
+        continue;
+      }
+      if (droppable && buffered > this.highWaterBytes) {
+        this.stats.dropped++;
+        continue;
+      }
+
+      try {
+        ws.send(payload, { binary: false, compress: false });
+        sent++;
+      } catch (error) {
+        console.error('WebSocket broadcast error:', error.message);
+      }
+    }
+
+    this.stats.sent += sent;
+    return sent;
+  }
+
+  getStats() {
+    let subscribed = 0;
+    for (const ws of this.wss.clients) {
+      if (this.subscriptions.has(ws)) subscribed++;
+    }
+    return {
+      clients: this.wss.clients.size,
+      subscribed,
+      highWaterBytes: this.highWaterBytes,
+      ...this.stats
+    };
+  }
+}
+
+module.exports = {
+  BroadcastHub
+};
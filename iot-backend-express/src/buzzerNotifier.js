@@ -0,0 +1,74 @@
+// Long-poll hub for ESP32 buzzer status (/api/v1/buzzer/status/:deviceId?wait=ms).
+//
+// A device parks one request here instead of polling every 150 ms. When a
+// buzzer request is created for that device, every parked request for it is
+// answered at once; otherwise each one times out and the device re-polls.
+const DEFAULT_MAX_WAIT_MS = 30000;
+
+class BuzzerNotifier {
+  constructor(options = {}) {
+    this.maxWaitMs = options.maxWaitMs || DEFAULT_MAX_WAIT_MS;
+    this.waiters = new Map(); // deviceId -> Set of waiters
+    this.notifiedCount = 0;
+    this.timedOutCount = 0;
+  }
+
+  // Resolves with the buzzer request pushed for deviceId, or null on timeout
+  // or cancel(). Register before checking the database for pending requests
+  // so one created in between is not missed.
+  wait(deviceId, timeoutMs) {
+    const waitMs = Math.min(Math.max(timeoutMs, 0), this.maxWaitMs);
+    let waiter;
+    const promise = new Promise(resolve => {
+      waiter = { resolve, timer: null };
+      waiter.timer = setTimeout(() => {
+        this.timedOutCount++;
+        this.settle(deviceId, waiter, null);
+      }, waitMs);
+    });
+
+    if (!this.waiters.has(deviceId)) {
+      this.waiters.set(deviceId, new Set());
+    }
+    this.waiters.get(deviceId).add(waiter);
+
+    promise.cancel = () => this.settle(deviceId, waiter, null);
+    return promise;
+  }
+
+  // Wakes every parked poll for deviceId. Returns how many were waiting.
+  notify(deviceId, request) {
+    const set = this.waiters.get(deviceId);
+    if (!set) return 0;
+
+    const waiting = Array.from(set);
+    waiting.forEach(waiter => this.settle(deviceId, waiter, request));
+    this.notifiedCount += waiting.length;
+    return waiting.length;
+  }
+
+  settle(deviceId, waiter, request) {
+    const set = this.waiters.get(deviceId);
+    if (!set || !set.delete(waiter)) return;
+    if (set.size === 0) this.waiters.delete(deviceId);
+
+    clearTimeout(waiter.timer);
+    waiter.resolve(request);
+  }
+
+  getStats() {
+    let waiting = 0;
+    this.waiters.forEach(set => { waiting += set.size; });
+    return {
+      devices: this.waiters.size,
+      waiting,
+      notified: this.notifiedCount,
+      timedOut: this.timedOutCount
+    };
+  }
+}
+
+module.exports = {
+  BuzzerNotifier,
+  DEFAULT_MAX_WAIT_MS
+};
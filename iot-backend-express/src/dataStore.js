@@ -436,6 +436,48 @@ class DataStore {
     return await this.dbOptimizer.optimizedCreate(this.SensorData, payload);
   }
 
+  // Stores a batch of samples from one device as a single multi-row insert
+  // inside one transaction, so a batch lands completely or not at all.
+  async saveSensorDataBatch(deviceId, samples, deviceInfo = {}) {
+    if (!deviceId) throw new Error('Device ID required');
+    if (!this.USEDB) return { deviceId, count: samples.length };
+    if (samples.length === 0) return { deviceId, count: 0 };
+
+    await this.dbReady;
+
+    const rows = samples.map(sample => ({
+      deviceId,
+      timestamp: sample.timestamp || Date.now(),
+      temperature: sample.temperature,
+      humidity: sample.humidity,
+      distance: sample.distance,
+      lightLevel: sample.lightLevel,
+      pressure: sample.pressure,
+      altitude: sample.altitude,
+      co2Level: sample.co2Level,
+      customData: sample.customData
+    }));
+
+    // Queue device update
+    this.deviceUpdateQueue.set(deviceId, {
+      id: deviceId,
+      name: deviceInfo.name || deviceId,
+      type: 'sensor',
+      status: 'online',
+      lastSeen: Date.now(),
+      ...(deviceInfo.freeHeap ? { freeHeap: deviceInfo.freeHeap } : {})
+    });
+
+    await this.sequelize.transaction(async (transaction) => {
+      await this.dbOptimizer.optimizedBulkCreate(this.SensorData, rows, {
+        transaction,
+        batchSize: 500
+      });
+    });
+
+    return { deviceId, count: rows.length };
+  }
+
   async getSensorData(deviceId, limit = 100) {
     if (!this.USEDB) return [];
     await this.dbReady;
@@ -523,6 +565,20 @@ class DataStore {
     }
   }
 
+  // Most recent request the device has not acknowledged yet, or null
+  async getPendingBuzzerRequest(deviceId) {
+    if (!this.USEDB) return null;
+    await this.dbReady;
+
+    return this.dbOptimizer.optimizedFindOne(this.BuzzerRequest, {
+      where: {
+        deviceId,
+        status: 'pending'
+      },
+      order: [['requestedAt', 'DESC']]
+    });
+  }
+
   async completeBuzzerRequest(requestId) {
     const startTime = Date.now();
     
@@ -0,0 +1,168 @@
+// Config patches for devices (iot_core/RemoteConfig.h on the firmware side).
+//
+// Patches are kept per device until acknowledged. Nothing is sent to a
+// device directly: its pending version rides on responses it already gets
+// ("configPending" in buzzer-status and heartbeat JSON, the Config-Pending
+// header on /stream/fast), and the device fetches
+//   GET /api/v1/devices/:id/config   KEY=VALUE lines, CONFIG_VERSION last
+// and acks what it applied. Versions are unix seconds, bumped past the
+// previous one when two patches land within a second, so a device's
+// CONFIG_VERSION only ever goes up. A newer patch for a device that has not
+// picked up the last one is merged into it.
+//
+// Only the keys in SCHEMAS can be pushed, within the ranges the firmware
+// clamps to; the keys match the firmware's IOT_CONFIG_REMOTE_* fields.
+
+// Sensor nodes keep 256 bytes of a response and cameras their patch buffer,
+// so the whole patch has to fit
+const MAX_PATCH_BYTES = 240;
+
+const SCHEMAS = {
+  sensor: {
+    SENSOR_INTERVAL_MS: { type: 'uint', min: 1000, max: 3600000 },
+    SEND_INTERVAL_MS: { type: 'uint', min: 100, max: 3600000 },
+    BUZZER_POLL_MS: { type: 'uint', min: 50, max: 60000 },
+    BATCH_FLUSH_MS: { type: 'uint', min: 1000, max: 3600000 },
+    DEADBAND_TEMP: { type: 'float', min: 0, max: 50 },
+    DEADBAND_HUM: { type: 'float', min: 0, max: 100 },
+    DEADBAND_DIST: { type: 'float', min: 0, max: 400 },
+    DEADBAND_LIGHT: { type: 'int', min: 0, max: 4095 },
+    MAX_SILENCE_MS: { type: 'uint', min: 0, max: 86400000 }
+  },
+  camera: {
+    TARGET_FPS: { type: 'int', min: 1, max: 30 },
+    JPEG_QUALITY: { type: 'int', min: 0, max: 63 } // 0: back to the sketch's default
+  }
+};
+
+function deviceKind(deviceType) {
+  return /CAM/i.test(deviceType || '') ? 'camera' : 'sensor';
+}
+
+// Returns { settings } with values normalized to what the firmware parses,
+// or { error }
+function validate(kind, config) {
+  const schema = SCHEMAS[kind];
+  if (!config || typeof config !== 'object' || Array.isArray(config)) {
+    return { error: 'config must be an object of KEY: value' };
+  }
+  const keys = Object.keys(config);
+  if (keys.length === 0) {
+    return { error: 'config is empty' };
+  }
+
+  const settings = {};
+  for (const key of keys) {
+    const field = schema[key];
+    if (!field) {
+      return { error: `${key} is not a remote setting for ${kind} devices (${Object.keys(schema).join(', ')})` };
+    }
+    const value = Number(config[key]);
+    if (!Number.isFinite(value) || (field.type !== 'float' && !Number.isInteger(value))) {
+      return { error: `${key} must be ${field.type === 'float' ? 'a number' : 'an integer'}` };
+    }
+    if (value < field.min || value > field.max) {
+      return { error: `${key} must be between ${field.min} and ${field.max}` };
+    }
+    settings[key] = value;
+  }
+  return { settings };
+}
+
+class DeviceConfigStore {
+  constructor() {
+    this.devices = new Map(); // deviceId -> { kind, pending, applied }
+    this.lastVersion = 0;
+    this.stats = { pushed: 0, fetched: 0, acked: 0, rejectedKeys: 0 };
+  }
+
+  // Queues settings for a device. Returns { version, settings } or { error }.
+  push(deviceId, deviceType, config) {
+    const kind = deviceKind(deviceType);
+    const { settings, error } = validate(kind, config);
+    if (error) return { error };
+
+    let entry = this.devices.get(deviceId);
+    if (!entry) {
+      entry = { kind, pending: null, applied: null };
+      this.devices.set(deviceId, entry);
+    }
+    const merged = { ...(entry.pending ? entry.pending.settings : {}), ...settings };
+    const version = this.nextVersion(entry);
+    const text = patchText(merged, version);
+    if (Buffer.byteLength(text) > MAX_PATCH_BYTES) {
+      return { error: `Patch is ${Buffer.byteLength(text)} bytes; devices take at most ${MAX_PATCH_BYTES}` };
+    }
+
+    entry.kind = kind;
+    entry.pending = { version, settings: merged, text, pushedAt: Date.now(), fetchedAt: null };
+    this.stats.pushed++;
+    return { version, settings: merged };
+  }
+
+  // A device's version must go up with every patch, even two in one second
+  nextVersion(entry) {
+    let version = Math.floor(Date.now() / 1000);
+    const previous = Math.max(this.lastVersion,
+      entry.pending ? entry.pending.version : 0, entry.applied ? entry.applied.version : 0);
+    if (version <= previous) version = previous + 1;
+    this.lastVersion = version;
+    return version;
+  }
+
+  // Version to advertise to the device, or 0
+  pendingVersion(deviceId) {
+    const entry = this.devices.get(deviceId);
+    return entry && entry.pending ? entry.pending.version : 0;
+  }
+
+  // Patch body for the device, or null when nothing is pending
+  fetch(deviceId) {
+    const entry = this.devices.get(deviceId);
+    if (!entry || !entry.pending) return null;
+    entry.pending.fetchedAt = Date.now();
+    this.stats.fetched++;
+    return entry.pending.text;
+  }
+
+  // The device applied (and saved) `version`. Acks for older versions leave
+  // a newer pending patch in place.
+  ack(deviceId, version, applied, rejected) {
+    const entry = this.devices.get(deviceId);
+    if (!entry) return false;
+    const rejectedKeys = rejected ? String(rejected).split(',').filter(Boolean) : [];
+    entry.applied = { version, applied, rejected: rejectedKeys, ackedAt: Date.now() };
+    this.stats.acked++;
+    this.stats.rejectedKeys += rejectedKeys.length;
+    if (entry.pending && version >= entry.pending.version) {
+      entry.applied.settings = entry.pending.settings;
+      entry.pending = null;
+    }
+    return true;
+  }
+
+  status(deviceId) {
+    const entry = this.devices.get(deviceId);
+    return entry ? { kind: entry.kind, pending: entry.pending, applied: entry.applied } : null;
+  }
+
+  getStats() {
+    let pending = 0;
+    this.devices.forEach(entry => { if (entry.pending) pending++; });
+    return { devices: this.devices.size, pending, ...this.stats };
+  }
+}
+
+// One newline-terminated line per setting with CONFIG_VERSION last, so the
+// device can tell a complete patch from a truncated one
+function patchText(settings, version) {
+  const lines = Object.keys(settings).map(key => `${key}=${settings[key]}\n`);
+  return lines.join('') + `CONFIG_VERSION=${version}\n`;
+}
+
+module.exports = {
+  DeviceConfigStore,
+  SCHEMAS,
+  MAX_PATCH_BYTES,
+  deviceKind
+};
@@ -0,0 +1,128 @@
+// Binary deltas between two firmware images, in the format OtaUpdater.h
+// applies on the device while it streams:
+//
+//   "IOTD"  u32 base size  u32 image size          (little-endian)
+//   'C' u32 offset u32 length                      copy from the running image
+//   'I' u32 length, then length literal bytes      insert
+//
+// Matches are found rsync-style: the base is indexed by a rolling hash of
+// every BLOCK-aligned block, the new image is scanned byte by byte, and each
+// hit is extended in both directions. An edit shifts everything after it,
+// but the shifted code still matches at its new offset, so a small change
+// costs little more than the bytes it touched plus the references into the
+// moved code. Literals are sent as they are; the device has no decompressor.
+const MAGIC = Buffer.from('IOTD');
+const BLOCK = 32;
+const HASH_BASE = 0x01000193;
+const COPY_OP_BYTES = 9;
+const INSERT_OP_BYTES = 5;
+
+// HASH_BASE^(BLOCK-1) mod 2^32, to roll the oldest byte out
+const HASH_OUT = (() => {
+  let pow = 1;
+  for (let i = 0; i < BLOCK - 1; i++) pow = Math.imul(pow, HASH_BASE);
+  return pow;
+})();
+
+function hashAt(buf, start) {
+  let h = 0;
+  for (let i = start; i < start + BLOCK; i++) h = (Math.imul(h, HASH_BASE) + buf[i]) | 0;
+  return h;
+}
+
+function roll(h, out, next) {
+  return (Math.imul((h - Math.imul(out, HASH_OUT)) | 0, HASH_BASE) + next) | 0;
+}
+
+function createDelta(base, target) {
+  const index = new Map();
+  for (let p = 0; p + BLOCK <= base.length; p += BLOCK) {
+    const h = hashAt(base, p);
+    if (!index.has(h)) index.set(h, p);
+  }
+
+  const parts = [];
+  let literalStart = 0;
+  const flushLiteral = end => {
+    if (end <= literalStart) return;
+    const op = Buffer.alloc(INSERT_OP_BYTES);
+    op[0] = 0x49; // 'I'
+    op.writeUInt32LE(end - literalStart, 1);
+    parts.push(op, target.subarray(literalStart, end));
+  };
+
+  let i = 0;
+  let h = target.length >= BLOCK ? hashAt(target, 0) : 0;
+  while (i + BLOCK <= target.length) {
+    const candidate = index.get(h);
+    if (candidate !== undefined && base.compare(target, i, i + BLOCK, candidate, candidate + BLOCK) === 0) {
+      let start = i;
+      let src = candidate;
+      while (start > literalStart && src > 0 && target[start - 1] === base[src - 1]) {
+        start--;
+        src--;
+      }
+      let end = i + BLOCK;
+      let srcEnd = candidate + BLOCK;
+      while (end < target.length && srcEnd < base.length && target[end] === base[srcEnd]) {
+        end++;
+        srcEnd++;
+      }
+
+      flushLiteral(start);
+      const op = Buffer.alloc(COPY_OP_BYTES);
+      op[0] = 0x43; // 'C'
+      op.writeUInt32LE(src, 1);
+      op.writeUInt32LE(end - start, 5);
+      parts.push(op);
+
+      i = end;
+      literalStart = end;
+      if (i + BLOCK <= target.length) h = hashAt(target, i);
+      continue;
+    }
+    if (i + BLOCK < target.length) h = roll(h, target[i], target[i + BLOCK]);
+    i++;
+  }
+  flushLiteral(target.length);
+
+  const header = Buffer.alloc(12);
+  MAGIC.copy(header, 0);
+  header.writeUInt32LE(base.length, 4);
+  header.writeUInt32LE(target.length, 8);
+  return Buffer.concat([header, ...parts]);
+}
+
+// What the device does, for checking a delta before it is offered
+function applyDelta(base, delta) {
+  if (delta.length < 12 || !delta.subarray(0, 4).equals(MAGIC) || delta.readUInt32LE(4) !== base.length) {
+    throw new Error('Not a delta for this base');
+  }
+  const out = Buffer.alloc(delta.readUInt32LE(8));
+  let written = 0;
+  let p = 12;
+  while (p < delta.length) {
+    const op = delta[p];
+    if (op === 0x43 && p + COPY_OP_BYTES <= delta.length) {
+      const offset = delta.readUInt32LE(p + 1);
+      const length = delta.readUInt32LE(p + 5);
+      if (offset + length > base.length) throw new Error('Copy past the base image');
+      written += base.copy(out, written, offset, offset + length);
+      p += COPY_OP_BYTES;
+    } else if (op === 0x49 && p + INSERT_OP_BYTES <= delta.length) {
+      const length = delta.readUInt32LE(p + 1);
+      if (p + INSERT_OP_BYTES + length > delta.length) throw new Error('Insert past the end of the delta');
+      written += delta.copy(out, written, p + INSERT_OP_BYTES, p + INSERT_OP_BYTES + length);
+      p += INSERT_OP_BYTES + length;
+    } else {
+      throw new Error(`Corrupt delta at byte ${p}`);
+    }
+  }
+  if (written !== out.length) throw new Error('Delta does not fill the image');
+  return out;
+}
+
+module.exports = {
+  createDelta,
+  applyDelta
+};
@@ -0,0 +1,196 @@
+// Firmware images for over-the-air updates (iot_core/OtaUpdater.h on the
+// device side), kept per channel ("camera", "sensor", ...) under
+// data/firmware/<channel>/:
+//   <md5>.bin            published images, the current one and keepReleases - 1 before it
+//   <base>-<md5>.delta   deltas from those earlier images to the current one
+//   manifest.json        which is which
+//
+// A device asks with the MD5 of the image it runs. If that is an earlier
+// release and the delta to the current one is below maxDeltaRatio of the
+// full size, it gets the delta; otherwise the full image. Deltas are built
+// and checked against the image when it is published, so a check costs a
+// manifest lookup. A device that rolled an image back reports it as
+// rejected and is not offered that image again.
+const fs = require('fs');
+const fsp = fs.promises;
+const path = require('path');
+const crypto = require('crypto');
+const { createDelta, applyDelta } = require('./firmwareDelta');
+
+const DEFAULT_KEEP_RELEASES = 4;
+const DEFAULT_MAX_DELTA_RATIO = 0.75;
+const ESP_IMAGE_MAGIC = 0xe9;
+const CHANNEL_PATTERN = /^[a-z0-9_-]{1,32}$/i;
+const MD5_PATTERN = /^[0-9a-f]{32}$/;
+
+function md5(buffer) {
+  return crypto.createHash('md5').update(buffer).digest('hex');
+}
+
+class FirmwareStore {
+  constructor(directory, options = {}) {
+    this.directory = directory;
+    this.keepReleases = options.keepReleases || DEFAULT_KEEP_RELEASES;
+    this.maxDeltaRatio = options.maxDeltaRatio || DEFAULT_MAX_DELTA_RATIO;
+    this.channels = new Map(); // channel -> manifest
+    this.devices = new Map();  // deviceId -> last check
+    this.stats = { checks: 0, current: 0, full: 0, delta: 0, bytesSent: 0, bytesSaved: 0 };
+
+    fs.mkdirSync(directory, { recursive: true });
+    for (const channel of fs.readdirSync(directory)) {
+      const manifestPath = path.join(directory, channel, 'manifest.json');
+      try {
+        this.channels.set(channel, JSON.parse(fs.readFileSync(manifestPath, 'utf8')));
+      } catch (err) {
+        // Not a channel, or never published
+      }
+    }
+    if (this.channels.size > 0) {
+      console.log(`📦 [Firmware] Loaded ${this.channels.size} channels: ` +
+        Array.from(this.channels, ([name, manifest]) => `${name} ${manifest.current.version}`).join(', '));
+    }
+  }
+
+  static validChannel(channel) {
+    return CHANNEL_PATTERN.test(channel || '');
+  }
+
+  // Makes image the current release of channel. Returns the manifest entry
+  // and the deltas built for it; throws on an image the ESP32 cannot boot.
+  async publish(channel, image, version) {
+    if (!FirmwareStore.validChannel(channel)) throw new Error('Invalid channel name');
+    if (image.length < 1024 || image[0] !== ESP_IMAGE_MAGIC) throw new Error('Not an ESP32 app image (.bin)');
+
+    const dir = path.join(this.directory, channel);
+    await fsp.mkdir(dir, { recursive: true });
+    const previous = this.channels.get(channel);
+    const release = {
+      md5: md5(image),
+      size: image.length,
+      version: version || new Date().toISOString(),
+      publishedAt: new Date().toISOString()
+    };
+    if (previous && previous.current.md5 === release.md5) {
+      return { release: previous.current, deltas: previous.deltas };
+    }
+    await writeAtomic(path.join(dir, `${release.md5}.bin`), image);
+
+    // Deltas from each release devices may still run
+    const bases = previous ? [previous.current, ...previous.releases].slice(0, this.keepReleases - 1) : [];
+    const deltas = {};
+    for (const base of bases) {
+      let baseImage;
+      try {
+        baseImage = await fsp.readFile(path.join(dir, `${base.md5}.bin`));
+      } catch (err) {
+        continue;
+      }
+      const started = Date.now();
+      const delta = createDelta(baseImage, image);
+      if (!applyDelta(baseImage, delta).equals(image)) {
+        console.error(`❌ [Firmware] Delta ${base.md5} -> ${release.md5} does not rebuild the image, skipped`);
+        continue;
+      }
+      const ratio = delta.length / image.length;
+      console.log(`📦 [Firmware] ${channel} delta from ${base.version}: ${delta.length} bytes ` +
+        `(${(ratio * 100).toFixed(1)}% of ${image.length}) in ${Date.now() - started} ms`);
+      if (ratio > this.maxDeltaRatio) continue;
+      await writeAtomic(path.join(dir, `${base.md5}-${release.md5}.delta`), delta);
+      deltas[base.md5] = delta.length;
+    }
+
+    const manifest = { current: release, releases: bases, deltas };
+    await writeAtomic(path.join(dir, 'manifest.json'), JSON.stringify(manifest, null, 2));
+    this.channels.set(channel, manifest);
+    await this.prune(dir, manifest);
+    console.log(`🚀 [Firmware] ${channel} ${release.version} published: ${release.md5}, ` +
+      `${image.length} bytes, ${Object.keys(deltas).length} deltas`);
+    return { release, deltas };
+  }
+
+  // Drops images and deltas the manifest no longer names
+  async prune(dir, manifest) {
+    const keep = new Set(['manifest.json', `${manifest.current.md5}.bin`]);
+    manifest.releases.forEach(release => keep.add(`${release.md5}.bin`));
+    Object.keys(manifest.deltas).forEach(base => keep.add(`${base}-${manifest.current.md5}.delta`));
+    for (const file of await fsp.readdir(dir)) {
+      if (!keep.has(file)) await fsp.rm(path.join(dir, file), { force: true });
+    }
+  }
+
+  // What to send a device running `running`: null when it is current (or
+  // rejected the current image), else the file and the headers for it
+  offer(channel, deviceId, running, rejected) {
+    this.stats.checks++;
+    const manifest = this.channels.get(channel);
+    const runningMd5 = MD5_PATTERN.test(running || '') ? running : null;
+    this.devices.set(deviceId, {
+      channel,
+      md5: runningMd5,
+      rejected: MD5_PATTERN.test(rejected || '') ? rejected : null,
+      checkedAt: new Date().toISOString()
+    });
+    if (!manifest || manifest.current.md5 === runningMd5 || manifest.current.md5 === rejected) {
+      this.stats.current++;
+      return null;
+    }
+
+    const { current } = manifest;
+    const headers = {
+      'Content-Type': 'application/octet-stream',
+      'Firmware-MD5': current.md5,
+      'Firmware-Size': String(current.size),
+      'Firmware-Version': current.version
+    };
+    const dir = path.join(this.directory, channel);
+    if (runningMd5 && manifest.deltas[runningMd5]) {
+      const length = manifest.deltas[runningMd5];
+      this.stats.delta++;
+      this.stats.bytesSent += length;
+      this.stats.bytesSaved += current.size - length;
+      return {
+        file: path.join(dir, `${runningMd5}-${current.md5}.delta`),
+        length,
+        format: 'delta',
+        headers: { ...headers, 'Firmware-Format': 'delta', 'Firmware-Base-MD5': runningMd5 }
+      };
+    }
+    this.stats.full++;
+    this.stats.bytesSent += current.size;
+    return {
+      file: path.join(dir, `${current.md5}.bin`),
+      length: current.size,
+      format: 'full',
+      headers: { ...headers, 'Firmware-Format': 'full' }
+    };
+  }
+
+  getStats() {
+    const channels = {};
+    this.channels.forEach((manifest, name) => {
+      const devices = Array.from(this.devices.values()).filter(device => device.channel === name);
+      channels[name] = {
+        current: manifest.current,
+        deltaBases: Object.keys(manifest.deltas).length,
+        devices: devices.length,
+        onCurrent: devices.filter(device => device.md5 === manifest.current.md5).length,
+        rejected: devices.filter(device => device.rejected === manifest.current.md5).length
+      };
+    });
+    return { channels, ...this.stats };
+  }
+
+  deviceStatus() {
+    return Object.fromEntries(this.devices);
+  }
+}
+
+async function writeAtomic(file, data) {
+  const tmp = `${file}.tmp`;
+  await fsp.writeFile(tmp, data);
+  await fsp.rename(tmp, file);
+}
+
+module.exports = {
+  FirmwareStore
+};
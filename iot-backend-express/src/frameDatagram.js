@@ -0,0 +1,245 @@
+// Lossy UDP frame transport for cameras (TRANSPORT_UDP in the camera sketch).
+//
+// Each JPEG is split into datagrams, one fragment each:
+//   byte 0-1   magic  'J' 'D'
+//   byte 2     version (1)
+//   byte 3     flags   (FRAME_FLAG_* bits, as in the push stream)
+//   byte 4-7   frame sequence number, uint32 big-endian; doubles as the frame id
+//   byte 8-9   fragment index, uint16 big-endian
+//   byte 10-11 fragment count, uint16 big-endian
+//   byte 12-15 JPEG length, uint32 big-endian
+//   byte 16-19 capture age in ms when sent, uint32 big-endian
+//   byte 20-27 capture time in epoch ms, uint64 big-endian (0 = camera clock not synced)
+//   byte 28    device id length n
+//   byte 29..  device id (n bytes), then the fragment's JPEG bytes
+// Nothing is retransmitted. Frames are delivered in sequence order through a
+// short jitter buffer: an incomplete frame holds newer ones back until no
+// fragment of it has arrived for jitterMs, then it is dropped. A frame that
+// completes after a newer one was delivered is dropped as late. A lost
+// datagram costs one frame instead of stalling the stream behind a TCP
+// retransmit.
+const dgram = require('dgram');
+const { EventEmitter } = require('events');
+
+const DATAGRAM_MAGIC_0 = 0x4a; // 'J'
+const DATAGRAM_MAGIC_1 = 0x44; // 'D'
+const DATAGRAM_VERSION = 1;
+const DATAGRAM_HEADER_SIZE = 29;
+const DEFAULT_PORT = 9004;
+const DEFAULT_JITTER_MS = 40;            // Just under one frame interval at 20 FPS
+const DEFAULT_MAX_FRAME_SIZE = 2 * 1024 * 1024;
+const MAX_PENDING_FRAMES = 8;            // Per device; the oldest is dropped beyond this
+const RESTART_WINDOW = 64;               // Frames; a sequence further back than this is a camera restart
+const RECV_BUFFER_BYTES = 2 * 1024 * 1024;
+
+// Signed distance a -> b between two uint32 sequence numbers
+function seqDelta(a, b) {
+  return (b - a) | 0;
+}
+
+// Returns the parsed datagram, or null when it is not a valid fragment.
+function parseDatagram(buf, maxFrameSize = DEFAULT_MAX_FRAME_SIZE) {
+  if (buf.length <= DATAGRAM_HEADER_SIZE ||
+      buf[0] !== DATAGRAM_MAGIC_0 || buf[1] !== DATAGRAM_MAGIC_1 || buf[2] !== DATAGRAM_VERSION) {
+    return null;
+  }
+  const index = buf.readUInt16BE(8);
+  const count = buf.readUInt16BE(10);
+  const length = buf.readUInt32BE(12);
+  const idLength = buf[28];
+  const payloadStart = DATAGRAM_HEADER_SIZE + idLength;
+  if (count === 0 || index >= count || length === 0 || length > maxFrameSize ||
+      idLength === 0 || payloadStart >= buf.length) {
+    return null;
+  }
+  return {
+    flags: buf[3],
+    seq: buf.readUInt32BE(4),
+    index,
+    count,
+    length,
+    ageMs: buf.readUInt32BE(16),
+    capturedAt: buf.readUInt32BE(20) * 0x100000000 + buf.readUInt32BE(24) || null,
+    deviceId: buf.toString('latin1', DATAGRAM_HEADER_SIZE, payloadStart),
+    payload: buf.subarray(payloadStart)
+  };
+}
+
+// Per-device jitter buffers. push() and flush() return the frames released
+// by them, in sequence order, like FrameStreamParser.push().
+class FrameReassembler {
+  constructor(options = {}) {
+    this.jitterMs = Number.isFinite(options.jitterMs) ? options.jitterMs : DEFAULT_JITTER_MS;
+    this.maxFrameSize = options.maxFrameSize || DEFAULT_MAX_FRAME_SIZE;
+    this.devices = new Map();
+    this.stats = {
+      datagrams: 0,
+      invalid: 0,
+      duplicates: 0,
+      late: 0,
+      delivered: 0,
+      incomplete: 0
+    };
+  }
+
+  push(buf, address, now = Date.now()) {
+    this.stats.datagrams++;
+    const fragment = parseDatagram(buf, this.maxFrameSize);
+    if (!fragment) {
+      this.stats.invalid++;
+      return [];
+    }
+
+    let device = this.devices.get(fragment.deviceId);
+    if (!device) {
+      device = { frames: new Map(), lastDelivered: null };
+      this.devices.set(fragment.deviceId, device);
+    }
+
+    if (device.lastDelivered !== null) {
+      const delta = seqDelta(device.lastDelivered, fragment.seq);
+      if (delta < -RESTART_WINDOW) {
+        device.frames.clear();
+        device.lastDelivered = null;
+      } else if (delta <= 0) {
+        this.stats.late++;
+        return [];
+      }
+    }
+
+    let frame = device.frames.get(fragment.seq);
+    if (frame && (frame.count !== fragment.count || frame.length !== fragment.length)) {
+      this.stats.invalid++;
+      return [];
+    }
+    if (!frame) {
+      frame = {
+        deviceId: fragment.deviceId,
+        address,
+        flags: fragment.flags,
+        seq: fragment.seq,
+        ageMs: fragment.ageMs,
+        capturedAt: fragment.capturedAt,
+        length: fragment.length,
+        count: fragment.count,
+        parts: new Array(fragment.count),
+        received: 0,
+        bytes: 0,
+        firstAt: now,
+        lastAt: now
+      };
+      device.frames.set(fragment.seq, frame);
+    }
+
+    if (frame.parts[fragment.index]) {
+      this.stats.duplicates++;
+      return [];
+    }
+    frame.parts[fragment.index] = fragment.payload;
+    frame.received++;
+    frame.bytes += fragment.payload.length;
+    frame.lastAt = now;
+
+    return this.release(device, now);
+  }
+
+  // Releases whatever the passage of time has unblocked on every device
+  flush(now = Date.now()) {
+    const frames = [];
+    for (const device of this.devices.values()) {
+      if (device.frames.size > 0) frames.push(...this.release(device, now));
+    }
+    return frames;
+  }
+
+  release(device, now) {
+    const frames = [];
+    const pending = Array.from(device.frames.values()).sort((a, b) => seqDelta(b.seq, a.seq));
+    let overflow = pending.length - MAX_PENDING_FRAMES;
+
+    for (const frame of pending) {
+      const complete = frame.received === frame.count;
+      if (!complete && overflow <= 0 && now - frame.lastAt <= this.jitterMs) break;
+
+      device.frames.delete(frame.seq);
+      device.lastDelivered = frame.seq;
+      overflow--;
+      if (!complete || frame.bytes !== frame.length) {
+        this.stats.incomplete++;
+        continue;
+      }
+
+      this.stats.delivered++;
+      frames.push({
+        deviceId: frame.deviceId,
+        address: frame.address,
+        flags: frame.flags,
+        seq: frame.seq,
+        ageMs: frame.ageMs,
+        capturedAt: frame.capturedAt,
+        assemblyMs: now - frame.firstAt,
+        data: frame.count === 1 ? frame.parts[0] : Buffer.concat(frame.parts, frame.length)
+      });
+    }
+    return frames;
+  }
+}
+
+// UDP socket plus reassembler; emits 'frame' for every completed frame
+class UdpFrameReceiver extends EventEmitter {
+  constructor(options = {}) {
+    super();
+    this.port = options.port || DEFAULT_PORT;
+    this.reassembler = new FrameReassembler(options);
+    this.socket = null;
+    this.sweepTimer = null;
+  }
+
+  listen() {
+    return new Promise((resolve, reject) => {
+      this.socket = dgram.createSocket({ type: 'udp4', recvBufferSize: RECV_BUFFER_BYTES });
+      this.socket.on('message', (msg, rinfo) => {
+        this.emitFrames(this.reassembler.push(msg, rinfo.address));
+      });
+      this.socket.once('error', reject);
+      this.socket.bind(this.port, () => {
+        this.socket.removeListener('error', reject);
+        this.socket.on('error', error => console.error('[UdpFrames] ❌ Socket error:', error.message));
+        // Incomplete frames expire even when their camera goes quiet
+        this.sweepTimer = setInterval(() => this.emitFrames(this.reassembler.flush()),
+          Math.max(5, Math.floor(this.reassembler.jitterMs / 2)));
+        this.sweepTimer.unref();
+        console.log(`📡 UDP frame receiver listening on port ${this.port} (jitter buffer ${this.reassembler.jitterMs} ms)`);
+        resolve();
+      });
+    });
+  }
+
+  emitFrames(frames) {
+    for (const frame of frames) this.emit('frame', frame);
+  }
+
+  close(callback) {
+    clearInterval(this.sweepTimer);
+    if (this.socket) this.socket.close(callback);
+    else if (callback) callback();
+  }
+
+  getStats() {
+    return {
+      port: this.port,
+      jitterMs: this.reassembler.jitterMs,
+      devices: this.reassembler.devices.size,
+      ...this.reassembler.stats
+    };
+  }
+}
+
+module.exports = {
+  FrameReassembler,
+  UdpFrameReceiver,
+  parseDatagram,
+  DATAGRAM_HEADER_SIZE,
+  DATAGRAM_VERSION,
+  DEFAULT_PORT
+};
@@ -0,0 +1,178 @@
+// Per-camera frame accounting for end-to-end latency (/api/v1/stream/latency).
+//
+// Cameras stamp every uploaded frame with a sequence number (Frame-Seq) and,
+// once SNTP has synced, its capture time in epoch ms (Frame-Captured-At).
+// Stages, in ms:
+//   device       capture -> upload start (camera queueing, from Frame-Age-Ms)
+//   network      upload start -> request complete here (needs a synced camera clock)
+//   save         request complete -> JPEG written to disk
+//   broadcast    request complete -> new_frame sent to dashboards
+//   recognition  request complete -> recognition result sent to dashboards
+//   endToEnd     capture -> new_frame sent (glass to dashboard, needs a synced clock)
+// Sequence gaps count as losses; a late frame filling a gap counts as
+// reordered and is taken back off the loss count. Frames replayed after a
+// WiFi outage only count towards the sequence stats, not the latencies.
+const STAGES = ['device', 'network', 'save', 'broadcast', 'recognition', 'endToEnd'];
+const DEFAULT_WINDOW_SIZE = 512;       // Samples kept per stage for percentiles
+const MAX_CLOCK_SKEW_MS = 60 * 1000;   // Capture stamps further off than this are ignored
+const REORDER_WINDOW = 1024;           // A drop further back than this is a camera restart
+
+class StageStats {
+  constructor(windowSize) {
+    this.samples = new Float64Array(windowSize);
+    this.count = 0;
+    this.next = 0;
+    this.max = 0;
+  }
+
+  add(ms) {
+    this.samples[this.next] = ms;
+    this.next = (this.next + 1) % this.samples.length;
+    this.count++;
+    if (ms > this.max) this.max = ms;
+  }
+
+  summary() {
+    const n = Math.min(this.count, this.samples.length);
+    if (n === 0) return { count: 0 };
+    const sorted = Array.from(this.samples.subarray(0, n)).sort((a, b) => a - b);
+    const pick = q => sorted[Math.min(n - 1, Math.floor(q * n))];
+    return {
+      count: this.count,
+      mean: Math.round(sorted.reduce((sum, v) => sum + v, 0) / n),
+      p50: pick(0.5),
+      p95: pick(0.95),
+      p99: pick(0.99),
+      max: this.max
+    };
+  }
+}
+
+class DeviceFrameStats {
+  constructor(windowSize) {
+    this.lastSeq = null;
+    this.received = 0;
+    this.lost = 0;
+    this.reordered = 0;
+    this.duplicates = 0;
+    this.restarts = 0;
+    this.missing = new Set(); // Gaps within REORDER_WINDOW that a late frame may still fill
+    this.stages = {};
+    STAGES.forEach(stage => { this.stages[stage] = new StageStats(windowSize); });
+  }
+
+  recordSeq(seq) {
+    this.received++;
+    if (this.lastSeq === null) {
+      this.lastSeq = seq;
+      return;
+    }
+
+    // uint32 distance so the counter may wrap
+    const ahead = (seq - this.lastSeq) >>> 0;
+    const behind = (this.lastSeq - seq) >>> 0;
+    if (ahead === 0) {
+      this.duplicates++;
+    } else if (ahead < 0x80000000) {
+      this.lost += ahead - 1;
+      for (let gap = Math.max(1, ahead - REORDER_WINDOW); gap < ahead; gap++) {
+        this.missing.add((this.lastSeq + gap) >>> 0);
+      }
+      this.lastSeq = seq;
+      this.pruneMissing();
+    } else if (behind <= REORDER_WINDOW) {
+      if (this.missing.delete(seq)) {
+        this.reordered++;
+        this.lost--;
+      } else {
+        this.duplicates++;
+      }
+    } else {
+      this.restarts++;
+      this.missing.clear();
+      this.lastSeq = seq;
+    }
+  }
+
+  pruneMissing() {
+    for (const seq of this.missing) {
+      if (((this.lastSeq - seq) >>> 0) <= REORDER_WINDOW) break; // Insertion order is oldest first
+      this.missing.delete(seq);
+    }
+  }
+}
+
+class FrameLatencyTracker {
+  constructor(options = {}) {
+    this.windowSize = options.windowSize || DEFAULT_WINDOW_SIZE;
+    this.devices = new Map(); // deviceId -> DeviceFrameStats
+  }
+
+  device(deviceId) {
+    let stats = this.devices.get(deviceId);
+    if (!stats) {
+      stats = new DeviceFrameStats(this.windowSize);
+      this.devices.set(deviceId, stats);
+    }
+    return stats;
+  }
+
+  // Called when a frame has fully arrived. Returns the timing handle the
+  // later stages are recorded against; capturedAt is null when the camera
+  // clock is not usable.
+  frameReceived(deviceId, { seq, capturedAt, ageMs, receivedAt, replayed }) {
+    const stats = this.device(deviceId);
+    if (Number.isInteger(seq)) stats.recordSeq(seq);
+
+    // The upload started ageMs after capture; that must be close to now
+    let capture = null;
+    if (capturedAt && Math.abs(receivedAt - (capturedAt + ageMs)) < MAX_CLOCK_SKEW_MS) {
+      capture = capturedAt;
+    }
+    if (!replayed) {
+      stats.stages.device.add(ageMs);
+      if (capture) stats.stages.network.add(Math.max(0, receivedAt - (capture + ageMs)));
+    }
+    return {
+      deviceId,
+      seq: Number.isInteger(seq) ? seq : null,
+      capturedAt: capture,
+      receivedAt,
+      replayed: !!replayed
+    };
+  }
+
+  // Records a server stage as the time since the frame arrived.
+  stageDone(timing, stage) {
+    if (timing.replayed) return;
+    const now = Date.now();
+    const stats = this.device(timing.deviceId);
+    stats.stages[stage].add(now - timing.receivedAt);
+    if (stage === 'broadcast' && timing.capturedAt) {
+      stats.stages.endToEnd.add(now - timing.capturedAt);
+    }
+  }
+
+  getStats() {
+    const devices = {};
+    for (const [deviceId, stats] of this.devices) {
+      const expected = stats.received + stats.lost;
+      devices[deviceId] = {
+        received: stats.received,
+        lost: stats.lost,
+        lossPct: expected > 0 ? Math.round(stats.lost / expected * 10000) / 100 : 0,
+        reordered: stats.reordered,
+        duplicates: stats.duplicates,
+        restarts: stats.restarts,
+        lastSeq: stats.lastSeq,
+        stages: Object.fromEntries(STAGES.map(stage => [stage, stats.stages[stage].summary()]))
+      };
+    }
+    return devices;
+  }
+}
+
+module.exports = {
+  FrameLatencyTracker,
+  STAGES
+};
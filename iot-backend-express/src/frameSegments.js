@@ -0,0 +1,352 @@
+// Append-only segment files for camera frames, instead of one file per
+// frame in data/.
+//
+// Each frame gets its byte range reserved in the current segment as soon as
+// its length is known, so an upload can be written straight from the
+// request as it arrives. A frame that does not fit rolls over to a new
+// segment of segmentBytes. Every segment has a JSON-lines offset index
+// (<name>.idx) that gets a line once the frame's bytes are on disk, so the
+// index never points at unwritten data; indexes are reloaded on startup.
+// Frames keep their <deviceId>_<timestamp>.jpg names and stay reachable
+// under /data/; timestamps only go up per device, so a name is never reused
+// for a different frame. Whole segments are deleted once their newest frame is older
+// than maxAgeMs, or oldest first while the store is over maxBytes.
+const fs = require('fs');
+const fsp = fs.promises;
+const path = require('path');
+
+const DEFAULT_SEGMENT_BYTES = 64 * 1024 * 1024;
+const DEFAULT_MAX_BYTES = 2 * 1024 * 1024 * 1024;
+const DEFAULT_MAX_AGE_MS = 10 * 60 * 1000; // Same retention the per-frame files had
+const PRUNE_INTERVAL_MS = 60 * 1000;
+
+class FrameSegmentStore {
+  constructor(directory, options = {}) {
+    this.directory = directory;
+    this.segmentBytes = options.segmentBytes || DEFAULT_SEGMENT_BYTES;
+    this.maxBytes = options.maxBytes || DEFAULT_MAX_BYTES;
+    this.maxAgeMs = options.maxAgeMs || DEFAULT_MAX_AGE_MS;
+    this.segments = [];      // Oldest first; the last one may be current
+    this.frames = new Map(); // filename -> entry, including frames still being written
+    this.current = null;
+    this.lastTimestamps = new Map(); // deviceId -> newest timestamp handed out
+    this.stats = { written: 0, aborted: 0, failed: 0, prunedSegments: 0 };
+
+    fs.mkdirSync(directory, { recursive: true });
+    this.load();
+    this.pruneTimer = setInterval(() => this.prune(), PRUNE_INTERVAL_MS);
+    this.pruneTimer.unref();
+  }
+
+  // Rebuilds the index from the .idx files left by earlier runs. Those
+  // segments are sealed; new frames always start a new segment.
+  load() {
+    const names = fs.readdirSync(this.directory)
+      .filter(file => file.endsWith('.idx'))
+      .map(file => file.slice(0, -4))
+      .sort();
+
+    for (const name of names) {
+      const segment = this.createSegment(name);
+      let size;
+      try {
+        size = fs.statSync(segment.path).size;
+      } catch (err) {
+        fs.rmSync(segment.indexPath, { force: true });
+        continue;
+      }
+
+      for (const line of fs.readFileSync(segment.indexPath, 'utf8').split('\n')) {
+        if (!line) continue;
+        let record;
+        try {
+          record = JSON.parse(line);
+        } catch (err) {
+          continue; // Torn last line from a crash
+        }
+        if (!(record.offset >= 0 && record.length > 0 && record.offset + record.length <= size)) continue;
+        const entry = this.createEntry(segment, record.filename, record.deviceId, record.timestamp, record.offset, record.length);
+        entry.committed = true;
+        entry.ready = Promise.resolve(entry);
+        segment.entries.push(entry);
+        segment.used = Math.max(segment.used, record.offset + record.length);
+        segment.newest = Math.max(segment.newest, record.timestamp);
+        this.frames.set(entry.filename, entry);
+        if (!(this.lastTimestamps.get(entry.deviceId) >= entry.timestamp)) {
+          this.lastTimestamps.set(entry.deviceId, entry.timestamp);
+        }
+      }
+      // A segment that was current when the last run stopped is still at
+      // its pre-sized length; only what the index covers is kept
+      if (size > segment.used) {
+        try {
+          fs.truncateSync(segment.path, segment.used);
+        } catch (err) {
+          console.error(`[Frames] ❌ Trimming ${segment.name}: ${err.message}`);
+        }
+      }
+      segment.sealed = true;
+      this.segments.push(segment);
+    }
+
+    if (this.segments.length > 0) {
+      console.log(`💾 [Frames] Loaded ${this.frames.size} frames from ${this.segments.length} segments`);
+    }
+  }
+
+  createSegment(name) {
+    return {
+      name,
+      path: path.join(this.directory, `${name}.seg`),
+      indexPath: path.join(this.directory, `${name}.idx`),
+      entries: [],
+      used: 0,
+      newest: 0,
+      inFlight: 0,
+      sealed: false,
+      handle: null,      // Promise<FileHandle>, only while the segment takes writes
+      indexHandle: null
+    };
+  }
+
+  createEntry(segment, filename, deviceId, timestamp, offset, length) {
+    return { filename, deviceId, timestamp, offset, length, segment, received: 0, committed: false, ready: null };
+  }
+
+  // Starts a segment file at its full size so frames are written into
+  // space the filesystem has already sized for them
+  openSegment() {
+    let name = `frames_${Date.now()}`;
+    const last = this.segments[this.segments.length - 1];
+    if (last && last.name >= name) name = `${last.name}_1`;
+
+    const segment = this.createSegment(name);
+    segment.newest = Date.now();
+    segment.handle = fsp.open(segment.path, 'w+').then(async handle => {
+      await handle.truncate(this.segmentBytes);
+      return handle;
+    });
+    segment.indexHandle = fsp.open(segment.indexPath, 'a');
+    // Failures surface on the first write; keep them from being unhandled here
+    segment.handle.catch(() => {});
+    segment.indexHandle.catch(() => {});
+    this.segments.push(segment);
+    this.current = segment;
+    console.log(`💾 [Frames] Opened segment ${name}`);
+    return segment;
+  }
+
+  seal(segment) {
+    segment.sealed = true;
+    if (this.current === segment) this.current = null;
+    if (segment.inFlight === 0) this.closeSegment(segment);
+  }
+
+  // Gives back the unused tail of the pre-sized file. Resolves once the
+  // file is trimmed and both handles are closed.
+  closeSegment(segment) {
+    if (!segment.handle) return Promise.resolve();
+    const used = segment.used;
+    const closed = Promise.all([
+      segment.handle.then(async handle => {
+        await handle.truncate(used);
+        await handle.close();
+      }).catch(err => console.error(`[Frames] ❌ Closing ${segment.name}: ${err.message}`)),
+      segment.indexHandle.then(handle => handle.close()).catch(() => {})
+    ]);
+    segment.handle = null;
+    segment.indexHandle = null;
+    return closed;
+  }
+
+  // Seals and trims every open segment, for shutdown. Frames still being
+  // written are lost; their index lines were never written.
+  close() {
+    clearInterval(this.pruneTimer);
+    const open = this.segments.filter(segment => segment.handle);
+    for (const segment of open) segment.sealed = true;
+    this.current = null;
+    return Promise.all(open.map(segment => this.closeSegment(segment)));
+  }
+
+  release(segment) {
+    segment.inFlight--;
+    if (segment.sealed && segment.inFlight === 0) this.closeSegment(segment);
+  }
+
+  // Claims `length` bytes for a frame. The entry is visible to get() right
+  // away; readers wait on entry.ready, which settles on commit() or abort().
+  // entry.timestamp and entry.filename may be later than `timestamp`.
+  reserve(deviceId, timestamp, length) {
+    if (!(length > 0 && length <= this.segmentBytes)) {
+      throw new Error(`Frame length ${length} does not fit a ${this.segmentBytes} byte segment`);
+    }
+    if (!this.current || this.current.used + length > this.segmentBytes) {
+      if (this.current) this.seal(this.current);
+      this.openSegment();
+    }
+
+    // Replayed frames carry an older capture time, so two frames of one
+    // device can ask for the same millisecond; bump past the newest instead
+    const last = this.lastTimestamps.get(deviceId);
+    if (last !== undefined && timestamp <= last) timestamp = last + 1;
+    this.lastTimestamps.set(deviceId, timestamp);
+
+    const segment = this.current;
+    const entry = this.createEntry(segment, `${deviceId}_${timestamp}.jpg`, deviceId, timestamp, segment.used, length);
+    entry.writes = segment.handle;
+    entry.ready = new Promise((resolve, reject) => {
+      entry.resolve = resolve;
+      entry.reject = reject;
+    });
+    entry.ready.catch(() => {});
+    segment.used += length;
+    segment.inFlight++;
+    this.frames.set(entry.filename, entry);
+    return entry;
+  }
+
+  // Queues the next piece of the frame at its place in the segment. Writes
+  // of one frame run in order; different frames write concurrently.
+  write(entry, chunk) {
+    if (entry.received + chunk.length > entry.length) {
+      throw new Error(`Frame ${entry.filename} is longer than the ${entry.length} bytes reserved`);
+    }
+    const position = entry.offset + entry.received;
+    entry.received += chunk.length;
+    entry.writes = entry.writes.then(handle =>
+      handle.write(chunk, 0, chunk.length, position).then(() => handle));
+  }
+
+  // Indexes the frame once all its bytes are written. Resolves with the entry.
+  commit(entry) {
+    if (entry.received !== entry.length) {
+      this.abort(entry, new Error(`Frame ${entry.filename} ended after ${entry.received} of ${entry.length} bytes`));
+      return entry.ready;
+    }
+
+    const segment = entry.segment;
+    const record = JSON.stringify({
+      filename: entry.filename,
+      deviceId: entry.deviceId,
+      timestamp: entry.timestamp,
+      offset: entry.offset,
+      length: entry.length
+    }) + '\n';
+
+    const writes = entry.writes;
+    entry.writes = null;
+    writes
+      .then(() => segment.indexHandle)
+      .then(indexHandle => indexHandle.write(record))
+      .then(() => {
+        entry.committed = true;
+        segment.entries.push(entry);
+        if (entry.timestamp > segment.newest) segment.newest = entry.timestamp;
+        this.stats.written++;
+        entry.resolve(entry);
+      }, err => {
+        this.forget(entry);
+        this.stats.failed++;
+        console.error(`[Frames] ❌ Writing ${entry.filename} to ${segment.name}: ${err.message}`);
+        // Later frames get a fresh segment instead of the broken one
+        if (this.current === segment) this.seal(segment);
+        entry.reject(err);
+      })
+      .finally(() => this.release(segment));
+    return entry.ready;
+  }
+
+  // Drops a frame whose upload did not complete; its bytes stay as a hole
+  abort(entry, reason = new Error(`Frame ${entry.filename} aborted`)) {
+    if (!entry.writes) return; // Already committed or aborted
+    const writes = entry.writes;
+    entry.writes = null;
+    this.forget(entry);
+    this.stats.aborted++;
+    entry.reject(reason);
+    writes.catch(() => {}).finally(() => this.release(entry.segment));
+  }
+
+  // reserve() + write() + commit() for a frame already in memory
+  append(deviceId, timestamp, data) {
+    const entry = this.reserve(deviceId, timestamp, data.length);
+    this.write(entry, data);
+    this.commit(entry);
+    return entry;
+  }
+
+  forget(entry) {
+    if (this.frames.get(entry.filename) === entry) this.frames.delete(entry.filename);
+  }
+
+  get(filename) {
+    return this.frames.get(filename) || null;
+  }
+
+  async read(entry) {
+    await entry.ready;
+    const handle = await fsp.open(entry.segment.path, 'r');
+    try {
+      const data = Buffer.allocUnsafe(entry.length);
+      const { bytesRead } = await handle.read(data, 0, entry.length, entry.offset);
+      if (bytesRead !== entry.length) throw new Error(`Short read of ${entry.filename}`);
+      return data;
+    } finally {
+      await handle.close();
+    }
+  }
+
+  // Call after entry.ready has resolved
+  createReadStream(entry) {
+    return fs.createReadStream(entry.segment.path, {
+      start: entry.offset,
+      end: entry.offset + entry.length - 1
+    });
+  }
+
+  // Committed frames, newest first, without touching the filesystem
+  list() {
+    const entries = [];
+    for (const entry of this.frames.values()) {
+      if (entry.committed) entries.push(entry);
+    }
+    return entries.sort((a, b) => b.timestamp - a.timestamp);
+  }
+
+  prune(now = Date.now()) {
+    const cutoff = now - this.maxAgeMs;
+    let total = this.segments.reduce((sum, segment) => sum + segment.used, 0);
+
+    while (this.segments.length > 0) {
+      const oldest = this.segments[0];
+      if (oldest.inFlight > 0 || (oldest.newest >= cutoff && total <= this.maxBytes)) break;
+      // An idle current segment expires too; the next frame opens a new one
+      if (oldest === this.current) this.seal(oldest);
+
+      this.segments.shift();
+      total -= oldest.used;
+      for (const entry of oldest.entries) this.forget(entry);
+      this.closeSegment(oldest);
+      Promise.all([fsp.rm(oldest.path, { force: true }), fsp.rm(oldest.indexPath, { force: true })])
+        .catch(err => console.error(`[Frames] ❌ Removing ${oldest.name}: ${err.message}`));
+      this.stats.prunedSegments++;
+      console.log(`🧹 [Frames] Removed segment ${oldest.name} (${oldest.entries.length} frames)`);
+    }
+  }
+
+  getStats() {
+    return {
+      segments: this.segments.length,
+      frames: this.frames.size,
+      bytes: this.segments.reduce((sum, segment) => sum + segment.used, 0),
+      segmentBytes: this.segmentBytes,
+      maxBytes: this.maxBytes,
+      ...this.stats
+    };
+  }
+}
+
+module.exports = {
+  FrameSegmentStore
+};
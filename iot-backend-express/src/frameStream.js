@@ -0,0 +1,131 @@
+// Incremental parser for the camera push stream (/api/v1/stream/push).
+//
+// Wire format (after HTTP de-chunking), repeated back to back:
+//   byte 0-1  magic  'J' 'F'
+//   byte 2    version (1, 2 or 3)
+//   byte 3    flags   (FRAME_FLAG_* bits: 1 = motion, 2 = keyframe, 4 = replayed)
+//   byte 4-7  JPEG length, uint32 big-endian
+//   byte 8-11 v2+: capture age in ms when sent, uint32 big-endian
+//   byte 12-15 v3: frame sequence number, uint32 big-endian
+//   byte 16-23 v3: capture time in epoch ms, uint64 big-endian (0 = camera clock not synced)
+//   then      JPEG bytes
+const FRAME_MAGIC_0 = 0x4a; // 'J'
+const FRAME_MAGIC_1 = 0x46; // 'F'
+const FRAME_VERSION = 3;
+const FRAME_HEADER_SIZES = { 1: 8, 2: 12, 3: 24 };
+const FRAME_PREFIX_SIZE = 4; // magic + version + flags, enough to know the header size
+const DEFAULT_MAX_FRAME_SIZE = 2 * 1024 * 1024;
+
+class FrameStreamParser {
+  constructor(options = {}) {
+    this.maxFrameSize = options.maxFrameSize || DEFAULT_MAX_FRAME_SIZE;
+    this.chunks = [];
+    this.buffered = 0;
+    this.header = null;
+    this.framesParsed = 0;
+  }
+
+  // Feed raw bytes from the request; returns the frames completed by them.
+  // Throws on a corrupt header so the caller can drop the connection.
+  push(chunk) {
+    this.chunks.push(chunk);
+    this.buffered += chunk.length;
+
+    const frames = [];
+    for (;;) {
+      if (!this.header) {
+        if (this.buffered < FRAME_PREFIX_SIZE) break;
+        const headerSize = this.headerSize();
+        if (this.buffered < headerSize) break;
+        this.header = this.parseHeader(this.take(headerSize));
+      }
+      if (this.buffered < this.header.length) break;
+
+      frames.push({
+        version: this.header.version,
+        flags: this.header.flags,
+        ageMs: this.header.ageMs,
+        seq: this.header.seq,
+        capturedAt: this.header.capturedAt,
+        data: this.take(this.header.length)
+      });
+      this.header = null;
+      this.framesParsed++;
+    }
+    return frames;
+  }
+
+  // Validates the fixed prefix and returns the full header size for its version.
+  headerSize() {
+    if (this.peek(0) !== FRAME_MAGIC_0 || this.peek(1) !== FRAME_MAGIC_1) {
+      throw new Error('Invalid frame magic');
+    }
+    const size = FRAME_HEADER_SIZES[this.peek(2)];
+    if (!size) {
+      throw new Error(`Unsupported frame version ${this.peek(2)}`);
+    }
+    return size;
+  }
+
+  parseHeader(buf) {
+    const length = buf.readUInt32BE(4);
+    if (length === 0 || length > this.maxFrameSize) {
+      throw new Error(`Invalid frame length ${length}`);
+    }
+    const ageMs = buf[2] >= 2 ? buf.readUInt32BE(8) : 0;
+    const seq = buf[2] >= 3 ? buf.readUInt32BE(12) : null;
+    const capturedAt = buf[2] >= 3 ? buf.readUInt32BE(16) * 0x100000000 + buf.readUInt32BE(20) : 0;
+    return { version: buf[2], flags: buf[3], length, ageMs, seq, capturedAt: capturedAt || null };
+  }
+
+  // Byte at offset i of the buffered data, without consuming it.
+  peek(i) {
+    for (const chunk of this.chunks) {
+      if (i < chunk.length) return chunk[i];
+      i -= chunk.length;
+    }
+    return undefined;
+  }
+
+  // Consume exactly n buffered bytes. Slices without copying when the bytes
+  // sit in a single chunk, which is the common case for socket reads.
+  take(n) {
+    const first = this.chunks[0];
+    if (first.length >= n) {
+      const out = first.subarray(0, n);
+      if (first.length === n) this.chunks.shift();
+      else this.chunks[0] = first.subarray(n);
+      this.buffered -= n;
+      return out;
+    }
+
+    const out = Buffer.allocUnsafe(n);
+    let offset = 0;
+    while (offset < n) {
+      const chunk = this.chunks[0];
+      const needed = n - offset;
+      if (chunk.length <= needed) {
+        chunk.copy(out, offset);
+        offset += chunk.length;
+        this.chunks.shift();
+      } else {
+        chunk.copy(out, offset, 0, needed);
+        this.chunks[0] = chunk.subarray(needed);
+        offset += needed;
+      }
+    }
+    this.buffered -= n;
+    return out;
+  }
+
+  // True when the stream ended between frames rather than mid-frame.
+  isIdle() {
+    return this.header === null && this.buffered === 0;
+  }
+}
+
+module.exports = {
+  FrameStreamParser,
+  FRAME_HEADER_SIZES,
+  FRAME_VERSION
+};
@@ -0,0 +1,181 @@
+// MQTT front door for sensor nodes (TRANSPORT_MQTT in main.ino).
+//
+// An embedded aedes broker keeps one TCP session per device instead of a
+// request per upload plus a parked long-poll, and bridges its topics into
+// the same dataStore calls the HTTP routes use. Topics, all under
+// <prefix>/<deviceId>/:
+//   sensors/batch    device -> server, QoS0, packed batch (see sensorBatch.js)
+//   buzzer/command   server -> device, QoS1, payload is the request id
+//   buzzer/complete  device -> server, QoS1, payload is the request id;
+//                    replaces PATCH /api/v1/buzzer/complete/:id
+// The client id must be the device id, and a client may only use the
+// topics under its own id.
+const net = require('net');
+const { decodeSensorBatch, toServerTime } = require('./sensorBatch');
+
+const DEFAULT_PORT = 1883;
+const DEFAULT_TOPIC_PREFIX = 'iot';
+
+const DEVICE_PUBLISH_TOPICS = ['sensors/batch', 'buzzer/complete'];
+const DEVICE_SUBSCRIBE_TOPICS = ['buzzer/command'];
+
+class MqttBridge {
+  constructor(dataStore, wss, options = {}) {
+    this.dataStore = dataStore;
+    this.wss = wss;
+    this.port = options.port || DEFAULT_PORT;
+    this.prefix = options.topicPrefix || DEFAULT_TOPIC_PREFIX;
+    // Loaded here, not at require time, so a backend with MQTT_ENABLED unset
+    // starts without aedes installed
+    const aedesFactory = require('aedes');
+    this.broker = aedesFactory();
+    this.server = net.createServer(this.broker.handle);
+    this.batchCount = 0;
+    this.sampleCount = 0;
+    this.commandCount = 0;
+    this.completionCount = 0;
+    this.rejectedCount = 0;
+
+    this.broker.authorizePublish = (client, packet, callback) => {
+      const parsed = this.parseTopic(packet.topic);
+      if (!parsed || parsed.deviceId !== client.id || !DEVICE_PUBLISH_TOPICS.includes(parsed.name)) {
+        this.rejectedCount++;
+        return callback(new Error(`Publish to ${packet.topic} not allowed`));
+      }
+      callback(null);
+    };
+
+    this.broker.authorizeSubscribe = (client, subscription, callback) => {
+      const parsed = this.parseTopic(subscription.topic);
+      if (!parsed || parsed.deviceId !== client.id || !DEVICE_SUBSCRIBE_TOPICS.includes(parsed.name)) {
+        this.rejectedCount++;
+        return callback(new Error(`Subscribe to ${subscription.topic} not allowed`));
+      }
+      callback(null, subscription);
+    };
+
+    // Runs before the broker acks a QoS1 publish, so a completion is only
+    // acknowledged once it has been written
+    this.broker.published = (packet, client, done) => {
+      if (!client) return done(null); // Our own buzzer commands
+      this.handleDevicePublish(client.id, packet)
+        .catch(error => console.error(`[MQTT] ❌ ${packet.topic}:`, error.message))
+        .then(() => done(null));
+    };
+
+    // A device subscribes on every (clean) connect; resend whatever it
+    // missed while it was away
+    this.broker.on('subscribe', (subscriptions, client) => {
+      if (!client || !subscriptions.some(s => s.topic === this.topic(client.id, 'buzzer/command'))) return;
+      this.dataStore.getPendingBuzzerRequest(client.id)
+        .then(request => { if (request) this.sendBuzzerCommand(client.id, request); })
+        .catch(error => console.error(`[MQTT] ❌ Pending buzzer lookup for ${client.id}:`, error.message));
+    });
+
+    this.broker.on('client', client => {
+      console.log(`📡 [MQTT] ${client.id} connected (${this.broker.connectedClients} sessions)`);
+    });
+
+    this.broker.on('clientDisconnect', client => {
+      console.log(`📡 [MQTT] ${client.id} disconnected (${this.broker.connectedClients} sessions)`);
+    });
+  }
+
+  listen() {
+    return new Promise((resolve, reject) => {
+      this.server.once('error', reject);
+      this.server.listen(this.port, () => {
+        console.log(`📡 MQTT bridge listening on port ${this.port}`);
+        resolve();
+      });
+    });
+  }
+
+  close(callback) {
+    this.broker.close(() => this.server.close(callback));
+  }
+
+  topic(deviceId, name) {
+    return `${this.prefix}/${deviceId}/${name}`;
+  }
+
+  // <prefix>/<deviceId>/<name> -> { deviceId, name }, or null for topics
+  // outside the bridge
+  parseTopic(topic) {
+    if (typeof topic !== 'string' || !topic.startsWith(this.prefix + '/')) return null;
+    const rest = topic.slice(this.prefix.length + 1);
+    const slash = rest.indexOf('/');
+    if (slash <= 0) return null;
+    return { deviceId: rest.slice(0, slash), name: rest.slice(slash + 1) };
+  }
+
+  async handleDevicePublish(deviceId, packet) {
+    const { name } = this.parseTopic(packet.topic);
+    if (name === 'sensors/batch') {
+      await this.handleSensorBatch(deviceId, packet.payload);
+    } else if (name === 'buzzer/complete') {
+      await this.handleBuzzerComplete(deviceId, packet.payload.toString());
+    }
+  }
+
+  // Same decoding and time mapping as POST /api/v1/ingest/sensor-batch
+  async handleSensorBatch(deviceId, payload) {
+    const receivedAt = Date.now();
+    const batch = decodeSensorBatch(payload);
+    const samples = batch.samples.map(sample => ({
+      ...sample,
+      timestamp: toServerTime(sample.deviceTimeMs, batch.sentAtMs, receivedAt)
+    }));
+
+    const result = await this.dataStore.saveSensorDataBatch(deviceId, samples);
+    this.batchCount++;
+    this.sampleCount += result.count;
+  }
+
+  async handleBuzzerComplete(deviceId, requestId) {
+    const request = await this.dataStore.completeBuzzerRequest(requestId);
+    this.completionCount++;
+    console.log(`[MQTT] Buzzer request ${requestId} completed by ${deviceId}`);
+
+    this.wss.broadcastToAll({
+      type: 'buzzer_completed',
+      deviceId,
+      requestId,
+      timestamp: request && request.buzzedAt
+    });
+  }
+
+  // QoS1: the device acks it, and resends its completion until we ack that
+  sendBuzzerCommand(deviceId, request) {
+    const requestId = String(request.id || request.requestedAt);
+    this.broker.publish({
+      cmd: 'publish',
+      topic: this.topic(deviceId, 'buzzer/command'),
+      payload: Buffer.from(requestId),
+      qos: 1,
+      retain: false,
+      dup: false
+    }, error => {
+      if (error) console.error(`[MQTT] ❌ Buzzer command for ${deviceId}:`, error.message);
+    });
+    this.commandCount++;
+  }
+
+  getStats() {
+    return {
+      port: this.port,
+      sessions: this.broker.connectedClients,
+      batches: this.batchCount,
+      samples: this.sampleCount,
+      buzzerCommands: this.commandCount,
+      buzzerCompletions: this.completionCount,
+      rejected: this.rejectedCount
+    };
+  }
+}
+
+module.exports = {
+  MqttBridge,
+  DEFAULT_PORT,
+  DEFAULT_TOPIC_PREFIX
+};
@@ -0,0 +1,159 @@
+// Picks which camera frames go to face recognition and runs them on a
+// bounded worker pool.
+//
+// Frames are offered with a priority class from the camera's flags. Each
+// class has a per-device rate target, and a device is due again once
+// 1000 / rate ms have passed since its last admitted frame. That interval
+// stretches while jobs are queued, so plain frames back off first when the
+// recognizer is busy and a flagged frame is never out-sampled by them.
+// Each device has at most one queued job: a newer frame of the same or
+// higher class replaces it. When the queue is full, a new frame displaces
+// the lowest-class job or is turned away. Jobs older than maxAgeMs are
+// discarded rather than recognized late.
+const PRIORITY_PLAIN = 0;  // Unflagged frame from a camera without a detector
+const PRIORITY_MOTION = 1; // FRAME_FLAG_MOTION
+const PRIORITY_FACE = 2;   // FRAME_FLAG_FACE or an ROI crop
+
+const CLASS_NAMES = ['plain', 'motion', 'face'];
+const DEFAULT_RATES = [1, 2, 5];  // Recognitions per second per device, by class
+const DEFAULT_CONCURRENCY = 2;
+const DEFAULT_QUEUE_SIZE = 8;
+const DEFAULT_MAX_AGE_MS = 2000;
+
+class RecognitionScheduler {
+  // recognize(buffer) -> Promise<result>, e.g. dataStore.performFaceRecognition
+  constructor(recognize, options = {}) {
+    this.recognize = recognize;
+    this.concurrency = options.concurrency || DEFAULT_CONCURRENCY;
+    this.queueSize = options.queueSize || DEFAULT_QUEUE_SIZE;
+    this.maxAgeMs = options.maxAgeMs || DEFAULT_MAX_AGE_MS;
+    this.intervalsMs = (options.rates || DEFAULT_RATES).map(rate => 1000 / rate);
+    this.queue = [];
+    this.active = 0;
+    this.lastAdmitted = new Map(); // deviceId -> ms
+    this.stats = {
+      offered: 0,
+      notDue: 0,
+      superseded: 0,
+      displaced: 0,
+      rejected: 0,
+      stale: 0,
+      completed: 0,
+      failed: 0,
+      byClass: { plain: 0, motion: 0, face: 0 }
+    };
+    this.totalLatencyMs = 0;
+  }
+
+  // job: { deviceId, priority, timestamp (capture time, ms), load() ->
+  // Promise<Buffer>, onResult(result) }. Returns true when it was queued.
+  offer(job, now = Date.now()) {
+    this.stats.offered++;
+    if (now - job.timestamp > this.maxAgeMs) {
+      this.stats.stale++;
+      return false;
+    }
+
+    const last = this.lastAdmitted.get(job.deviceId);
+    const interval = this.intervalsMs[job.priority] * (1 + this.queue.length / this.concurrency);
+    if (last !== undefined && now - last < interval) {
+      this.stats.notDue++;
+      return false;
+    }
+
+    const queuedIndex = this.queue.findIndex(queued => queued.deviceId === job.deviceId);
+    if (queuedIndex >= 0) {
+      if (this.queue[queuedIndex].priority > job.priority) {
+        this.stats.rejected++;
+        return false;
+      }
+      this.queue.splice(queuedIndex, 1);
+      this.stats.superseded++;
+    } else if (this.queue.length >= this.queueSize) {
+      const lowest = this.lowestQueued();
+      if (this.queue[lowest].priority >= job.priority) {
+        this.stats.rejected++;
+        return false;
+      }
+      this.queue.splice(lowest, 1);
+      this.stats.displaced++;
+    }
+
+    job.queuedAt = now;
+    this.queue.push(job);
+    this.lastAdmitted.set(job.deviceId, now);
+    this.stats.byClass[CLASS_NAMES[job.priority]]++;
+    this.pump();
+    return true;
+  }
+
+  // Lowest class, oldest first
+  lowestQueued() {
+    let lowest = 0;
+    for (let i = 1; i < this.queue.length; i++) {
+      if (this.queue[i].priority < this.queue[lowest].priority) lowest = i;
+    }
+    return lowest;
+  }
+
+  // Highest class, oldest first, skipping jobs that went stale while queued
+  next(now) {
+    while (this.queue.length > 0) {
+      let best = 0;
+      for (let i = 1; i < this.queue.length; i++) {
+        if (this.queue[i].priority > this.queue[best].priority) best = i;
+      }
+      const [job] = this.queue.splice(best, 1);
+      if (now - job.timestamp <= this.maxAgeMs) return job;
+      this.stats.stale++;
+    }
+    return null;
+  }
+
+  pump() {
+    while (this.active < this.concurrency) {
+      const job = this.next(Date.now());
+      if (!job) return;
+      this.active++;
+      this.run(job);
+    }
+  }
+
+  run(job) {
+    const started = Date.now();
+    Promise.resolve()
+      .then(() => job.load())
+      .then(data => this.recognize(data))
+      .then(result => {
+        this.stats.completed++;
+        this.totalLatencyMs += Date.now() - job.queuedAt;
+        job.onResult(result);
+      })
+      .catch(error => {
+        this.stats.failed++;
+        console.error(`[Recognition] ❌ ${job.deviceId} after ${Date.now() - started} ms: ${error.message}`);
+      })
+      .finally(() => {
+        this.active--;
+        this.pump();
+      });
+  }
+
+  getStats() {
+    return {
+      concurrency: this.concurrency,
+      active: this.active,
+      queued: this.queue.length,
+      queueSize: this.queueSize,
+      avgLatencyMs: this.stats.completed ? Math.round(this.totalLatencyMs / this.stats.completed) : null,
+      ...this.stats
+    };
+  }
+}
+
+module.exports = {
+  RecognitionScheduler,
+  PRIORITY_PLAIN,
+  PRIORITY_MOTION,
+  PRIORITY_FACE
+};
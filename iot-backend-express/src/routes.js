@@ -1,14 +1,25 @@
 const express = require('express');
 const multer = require('multer');
-const WebSocket = require('ws');
 const fs = require('fs');
 const fsp = require('fs').promises;
 const path = require('path');
 const os = require('os');
+const { monitorEventLoopDelay } = require('perf_hooks');
 const ffmpeg = require('fluent-ffmpeg');
 const sharp = require('sharp');
 const { dataDir, recordingsDir } = require('./dataStore');
 const { BuzzerRequest } = require('./database');
+const { FrameStreamParser } = require('./frameStream');
+const { FrameLatencyTracker } = require('./frameLatency');
+const { FrameSegmentStore } = require('./frameSegments');
+const { RecognitionScheduler, PRIORITY_PLAIN, PRIORITY_MOTION, PRIORITY_FACE } = require('./recognitionScheduler');
+const { BuzzerNotifier } = require('./buzzerNotifier');
+const { DeviceConfigStore, deviceKind } = require('./deviceConfig');
+const { FirmwareStore } = require('./firmwareStore');
+const { decodeSensorBatch, toServerTime } = require('./sensorBatch');
+
+// Sensor nodes report their heap low-water mark with each batch
+const LOW_HEAP_WARNING_BYTES = 20 * 1024;
 
 // Multer configurations (still needed for other uploads)
 const permittedFaceUpload = multer({ storage: multer.memoryStorage() });
@@ -30,7 +41,17 @@ function addNoCacheHeaders(res) {
   });
 }
 
-function setupRoutes(app, dataStore, wss) {
+function setupRoutes(app, dataStore, wss, mqttBridge = null, udpFrames = null) {
+  // Parked ESP32 buzzer long-polls, woken when a request is created
+  const buzzerNotifier = new BuzzerNotifier();
+  const deviceConfig = new DeviceConfigStore();
+
+  // Hands a new buzzer request to the device however it is connected: a
+  // parked long-poll, or its MQTT session
+  function pushBuzzerRequest(deviceId, request) {
+    buzzerNotifier.notify(deviceId, request);
+    if (mqttBridge) mqttBridge.sendBuzzerCommand(deviceId, request);
+  }
 
   // =========================================================================
   // --- ENHANCED STREAMING ENDPOINT WITH DEVICE REGISTRATION ---
@@ -96,11 +117,7 @@ function setupRoutes(app, dataStore, wss) {
         url: `/data/${filename}`,
         recognition: { status: 'pending' }
       };
-      wss.clients.forEach(client => {
-        if (client.readyState === WebSocket.OPEN) {
-          client.send(JSON.stringify(newFrameMessage));
-        }
-      });
+      wss.broadcastToDevice(deviceInfo.id, newFrameMessage, { droppable: true });
 
       // Respond immediately for high FPS performance
       res.status(200).json({
@@ -123,11 +140,7 @@ function setupRoutes(app, dataStore, wss) {
               timestamp,
               recognition: recognitionResult
             };
-            wss.clients.forEach(client => {
-              if (client.readyState === WebSocket.OPEN) {
-                client.send(JSON.stringify(recognitionCompleteMessage));
-              }
-            });
+            wss.broadcastToDevice(deviceInfo.id, recognitionCompleteMessage);
           })
           .catch(recogErr => console.error(`[Recognition BG] Error for ${filename}:`, recogErr));
       });
@@ -153,71 +166,326 @@ function setupRoutes(app, dataStore, wss) {
   });
 
 
-  // Maximum FPS streaming endpoint optimized for OV2640
-  app.post('/api/v1/stream/fast', express.raw({
-    type: 'image/jpeg',
-    limit: '20mb' // Support XGA resolution
-  }), (req, res) => {
+  // Capture age reported by the camera, clamped to something plausible.
+  const MAX_FRAME_AGE_MS = 24 * 60 * 60 * 1000;
+  function frameAgeMs(value) {
+    const age = parseInt(value, 10);
+    return age > 0 ? Math.min(age, MAX_FRAME_AGE_MS) : 0;
+  }
+
+  // Camera FRAME_FLAG_* bits that change how a frame is handled
+  const FRAME_FLAG_MOTION = 0x01;   // Motion gate fired (or the camera does no gating)
+  const FRAME_FLAG_REPLAYED = 0x04; // Buffered through a WiFi outage, arrives late
+  const FRAME_FLAG_ROI = 0x08;      // Full-resolution crop, always recognised
+  const FRAME_FLAG_PREVIEW = 0x10;  // Low-res preview, never recognised
+  const FRAME_FLAG_FACE = 0x20;     // Camera's own detector found a face
+  const MIN_FRAME_BYTES = 5000;
+  const MIN_PREVIEW_FRAME_BYTES = 1000;
+
+  function minFrameBytes(flags) {
+    return flags & FRAME_FLAG_PREVIEW ? MIN_PREVIEW_FRAME_BYTES : MIN_FRAME_BYTES;
+  }
+
+  // "x,y,w,h" in sensor coordinates from the Frame-Roi header
+  function parseFrameRoi(value) {
+    if (!value) return null;
+    const parts = String(value).split(',').map(v => parseInt(v, 10));
+    if (parts.length !== 4 || parts.some(v => !(v >= 0))) return null;
+    return { x: parts[0], y: parts[1], w: parts[2], h: parts[3] };
+  }
+
+  // "x,y,w,h,score;..." from the Frame-Faces header, in frame pixels
+  function parseFrameFaces(value) {
+    if (!value) return [];
+    return String(value).split(';').map(entry => {
+      const [x, y, w, h, score] = entry.split(',').map(v => parseInt(v, 10));
+      return { x, y, w, h, score: score / 100 };
+    }).filter(face => [face.x, face.y, face.w, face.h, face.score].every(Number.isFinite));
+  }
+
+  // Cameras running on-device face detection (Device-Face-Detect: 1). Their
+  // frames without FRAME_FLAG_FACE are known to be empty, so they are not
+  // sampled for recognition.
+  const faceDetectingDevices = new Set();
+
+  // Sequence and per-stage latency accounting for camera frames
+  const frameLatency = new FrameLatencyTracker();
+
+  // Frame-Seq / Frame-Captured-At headers; missing or malformed values are null
+  function headerInt(value) {
+    const n = parseInt(value, 10);
+    return Number.isFinite(n) && n >= 0 ? n : null;
+  }
+
+  // Devices owed a Roi-Request header on their next per-frame POST response
+  const roiRequests = new Set();
+
+  // Camera frames from /stream/fast, the push stream and UDP go into
+  // append-only segment files instead of one file each (see frameSegments.js)
+  const MAX_FAST_FRAME_BYTES = 20 * 1024 * 1024; // Supports XGA resolution
+  const frameStore = new FrameSegmentStore(path.join(dataDir, 'segments'), {
+    segmentBytes: (parseInt(process.env.FRAME_SEGMENT_MB, 10) || 0) * 1024 * 1024 || undefined,
+    maxBytes: (parseInt(process.env.FRAME_STORE_MAX_MB, 10) || 0) * 1024 * 1024 || undefined
+  });
+
+  // Bounded worker pool in front of the recognition service, fed with
+  // per-device rate targets instead of random sampling
+  const recognitionScheduler = new RecognitionScheduler(
+    frameData => dataStore.performFaceRecognition(frameData), {
+      concurrency: parseInt(process.env.RECOGNITION_CONCURRENCY, 10) || undefined,
+      maxAgeMs: parseInt(process.env.RECOGNITION_MAX_AGE_MS, 10) || undefined
+    });
+
+  // Shared post-response work for every frame that reaches the server,
+  // whether it arrived as its own POST, inside a push stream or as UDP
+  // datagrams.
+  // `flags` carries the camera's FRAME_FLAG_* bits (1 = motion, 2 = keyframe,
+  // 4 = replayed after a WiFi outage, 8 = ROI crop, 16 = preview, 32 = face).
+  // `timing` comes from frameLatency.frameReceived() and collects the stages.
+  // `stored` is the frame's frameStore entry, which may still be writing;
+  // `frame` is its JPEG when already in memory, otherwise it is read back
+  // from the store if recognition wants it.
+  function processFastFrame(deviceId, headers, stored, flags, timing, frame = null) {
+    const { filename, timestamp } = stored;
+
+    // Segment write (non-blocking); /data/<filename> waits for it
+    stored.ready
+      .then(() => {
+        frameLatency.stageDone(timing, 'save');
+        console.log(`[FastStream] 💾 Saved ${filename}`);
+      })
+      .catch(err => console.log(`[FastStream] ❌ Save failed: ${err.message}`));
+
+    // Instant WebSocket broadcast
+    const roi = flags & FRAME_FLAG_ROI ? parseFrameRoi(headers['frame-roi']) : null;
+    const faces = flags & FRAME_FLAG_FACE ? parseFrameFaces(headers['frame-faces']) : [];
+    const msg = `{"type":"new_frame","deviceId":"${deviceId}","timestamp":${timestamp},"filename":"${filename}","url":"/data/${filename}","flags":${flags},"roi":${JSON.stringify(roi)},"faces":${JSON.stringify(faces)},"seq":${timing.seq},"capturedAt":${timing.capturedAt},"recognition":{"status":"pending"}}`;
+    const viewers = wss.broadcastToDevice(deviceId, msg, { droppable: true });
+    frameLatency.stageDone(timing, 'broadcast');
+    console.log(`[FastStream] 📡 Broadcasted to ${viewers} clients`);
+
+    // Background device update - cameras only attach Device-* metadata
+    // headers every N frames, so update the registry when they are present
+    if (headers['device-uptime'] !== undefined) {
+      const detectsFaces = headers['device-face-detect'] === '1';
+      if (detectsFaces) {
+        faceDetectingDevices.add(deviceId);
+      } else {
+        faceDetectingDevices.delete(deviceId);
+      }
+      dataStore.registerDevice({
+        id: deviceId,
+        name: headers['device-name'] || 'OV2640-CAM',
+        type: 'ESP32-CAM',
+        ipAddress: headers['device-ip'] || '0.0.0.0',
+        status: 'online',
+        uptime: parseInt(headers['device-uptime']) || 0,
+        freeHeap: parseInt(headers['device-freeheap']) || 0,
+        wifiRssi: parseInt(headers['device-wifirssi']) || 0,
+        capabilities: detectsFaces ? ['camera', 'ov2640', 'high_fps', 'face_detect'] : ['camera', 'ov2640', 'high_fps']
+      }).catch(() => {});
+    }
+
+    // Face recognition candidates: ROI crops and frames the camera found a
+    // face in first, then motion, then plain frames. Never previews, nor
+    // frames a detecting camera found empty. The scheduler picks which run.
+    const priority = flags & FRAME_FLAG_ROI ? PRIORITY_FACE
+      : flags & FRAME_FLAG_PREVIEW ? null
+      : flags & FRAME_FLAG_FACE ? PRIORITY_FACE
+      : faceDetectingDevices.has(deviceId) ? null
+      : flags & FRAME_FLAG_MOTION ? PRIORITY_MOTION
+      : PRIORITY_PLAIN;
+    if (priority !== null) {
+      recognitionScheduler.offer({
+        deviceId,
+        priority,
+        timestamp,
+        load: () => (frame ? Promise.resolve(frame) : frameStore.read(stored)),
+        onResult: result => {
+          const recogMsg = `{"type":"recognition_complete","filename":"${filename}","deviceId":"${deviceId}","timestamp":${timestamp},"recognition":${JSON.stringify(result)}}`;
+          wss.broadcastToDevice(deviceId, recogMsg);
+          frameLatency.stageDone(timing, 'recognition');
+        }
+      });
+    }
+  }
+
+  // Maximum FPS streaming endpoint optimized for OV2640. The body is not
+  // buffered: it streams into the range reserved for it in the frame store.
+  app.post('/api/v1/stream/fast', (req, res) => {
     const deviceId = req.headers['device-id'] || 'unknown_device';
-    const timestamp = Date.now();
-    const filename = `${deviceId}_${timestamp}.jpg`;
+    const length = parseInt(req.headers['content-length'], 10) || 0;
+    // Frames replayed after an outage carry their age so they keep their capture time
+    const ageMs = frameAgeMs(req.headers['frame-age-ms']);
+    const timestamp = Date.now() - ageMs;
+
+    console.log(`[FastStream] 📸 Receiving frame from ${deviceId}: ${length} bytes`);
 
-    console.log(`[FastStream] 📸 Received frame from ${deviceId}: ${req.body ? req.body.length : 0} bytes`);
+    // Cameras without motion gating send every frame as if it had motion
+    const flags = req.headers['frame-flags'] !== undefined ? (parseInt(req.headers['frame-flags'], 10) || 0) : 1;
 
-    // Lightning-fast validation
-    if (!req.body || req.body.length < 5000) {
-      console.log(`[FastStream] ❌ Invalid frame: ${req.body ? req.body.length : 0} bytes`);
+    // Lightning-fast validation, before a byte of the body is read. Cameras
+    // always send Content-Length, which sizes the reservation.
+    if (!req.is('image/jpeg') || length < minFrameBytes(flags) || length > MAX_FAST_FRAME_BYTES) {
+      console.log(`[FastStream] ❌ Invalid frame: ${length} bytes`);
       res.writeHead(400);
       res.end();
       return;
     }
 
-    // Instant response - zero overhead
-    res.writeHead(200, { 'Content-Type': 'application/json' });
-    res.end('{"success":true}');
-    console.log(`[FastStream] ✅ Response sent to ${deviceId}`);
+    const stored = frameStore.reserve(deviceId, timestamp, length);
+    req.on('data', chunk => frameStore.write(stored, chunk));
+    // No-op once committed; drops the reservation when the camera goes away mid-frame
+    req.on('close', () => frameStore.abort(stored));
 
-    // Immediate async processing
-    setImmediate(() => {
-      // File save (non-blocking)
-      fsp.writeFile(path.join(dataDir, filename), req.body)
-        .then(() => console.log(`[FastStream] 💾 Saved ${filename}`))
-        .catch(err => console.log(`[FastStream] ❌ Save failed: ${err.message}`));
+    req.on('end', () => {
+      const receivedAt = Date.now();
+      frameStore.commit(stored).catch(() => {}); // Reported by processFastFrame
 
-      // Instant WebSocket broadcast
-      const msg = `{"type":"new_frame","deviceId":"${deviceId}","timestamp":${timestamp},"filename":"${filename}","url":"/data/${filename}","recognition":{"status":"pending"}}`;
-      wss.clients.forEach(client => {
-        if (client.readyState === 1) client.send(msg);
+      // Instant response - zero overhead. An explicit Content-Length keeps the
+      // response un-chunked so keep-alive clients can reuse the socket cleanly.
+      const responseHeaders = { 'Content-Type': 'application/json', 'Content-Length': 16 };
+      if (roiRequests.delete(deviceId)) {
+        responseHeaders['Roi-Request'] = '1';
+      }
+      const configPending = deviceConfig.pendingVersion(deviceId);
+      if (configPending) {
+        responseHeaders['Config-Pending'] = String(configPending);
+      }
+      res.writeHead(200, responseHeaders);
+      res.end('{"success":true}');
+      console.log(`[FastStream] ✅ Response sent to ${deviceId}`);
+
+      // Immediate async processing
+      const timing = frameLatency.frameReceived(deviceId, {
+        seq: headerInt(req.headers['frame-seq']),
+        capturedAt: headerInt(req.headers['frame-captured-at']),
+        ageMs,
+        receivedAt,
+        replayed: (flags & FRAME_FLAG_REPLAYED) !== 0
       });
-      console.log(`[FastStream] 📡 Broadcasted to ${wss.clients.size} clients`);
+      setImmediate(() => processFastFrame(deviceId, req.headers, stored, flags, timing));
+    });
+  });
+
+  // Push streaming endpoint: one long-lived chunked POST per camera carrying
+  // length-prefixed JPEG frames (see frameStream.js). Frames are parsed as
+  // bytes arrive instead of buffering whole requests with express.raw.
+  app.post('/api/v1/stream/push', (req, res) => {
+    const deviceId = req.headers['device-id'] || 'unknown_device';
+    const parser = new FrameStreamParser();
+    // Device-* metadata is sent once when the stream opens
+    let frameHeaders = req.headers;
+    let failed = false;
+
+    console.log(`[PushStream] 🔌 Stream opened by ${deviceId}`);
+
+    req.on('data', chunk => {
+      if (failed) return;
 
-      // Background device update (every 10th frame)
-      if (Math.random() < 0.1) {
+      let frames;
+      try {
+        frames = parser.push(chunk);
+      } catch (err) {
+        failed = true;
+        console.log(`[PushStream] ❌ Corrupt stream from ${deviceId}: ${err.message}`);
+        res.writeHead(400, { 'Content-Type': 'application/json', 'Connection': 'close' });
+        res.end(JSON.stringify({ success: false, error: err.message, frames: parser.framesParsed }));
+        req.destroy();
+        return;
+      }
+
+      for (const frame of frames) {
+        if (frame.data.length < minFrameBytes(frame.flags)) {
+          console.log(`[PushStream] ❌ Invalid frame: ${frame.data.length} bytes`);
+          continue;
+        }
+        const receivedAt = Date.now();
+        const ageMs = frameAgeMs(frame.ageMs);
+        const timestamp = receivedAt - ageMs; // frameStore keeps the filename unique
+        const timing = frameLatency.frameReceived(deviceId, {
+          seq: frame.seq,
+          capturedAt: frame.capturedAt,
+          ageMs,
+          receivedAt,
+          replayed: (frame.flags & FRAME_FLAG_REPLAYED) !== 0
+        });
+        const stored = frameStore.append(deviceId, timestamp, frame.data);
+        processFastFrame(deviceId, frameHeaders, stored, frame.flags, timing, frame.data);
+        frameHeaders = {};
+      }
+    });
+
+    req.on('end', () => {
+      if (failed) return;
+      console.log(`[PushStream] 🔌 Stream from ${deviceId} closed after ${parser.framesParsed} frames`);
+      res.status(parser.isIdle() ? 200 : 400).json({
+        success: parser.isIdle(),
+        frames: parser.framesParsed
+      });
+    });
+
+    req.on('error', err => {
+      console.log(`[PushStream] ❌ Stream error from ${deviceId}: ${err.message}`);
+    });
+  });
+
+  // Lossy UDP transport (see frameDatagram.js): frames arrive already
+  // reassembled. Datagrams carry no Device-* metadata, so a camera is
+  // registered when it first streams from a new address and its heartbeats
+  // keep the registry fresh.
+  if (udpFrames) {
+    const udpCameras = new Map(); // deviceId -> { address }
+
+    udpFrames.on('frame', frame => {
+      const deviceId = frame.deviceId;
+      if (frame.data.length < minFrameBytes(frame.flags)) {
+        console.log(`[UdpStream] ❌ Invalid frame: ${frame.data.length} bytes`);
+        return;
+      }
+
+      let camera = udpCameras.get(deviceId);
+      if (!camera || camera.address !== frame.address) {
+        camera = { address: frame.address };
+        udpCameras.set(deviceId, camera);
+        console.log(`[UdpStream] 🔌 ${deviceId} streaming from ${frame.address}`);
         dataStore.registerDevice({
           id: deviceId,
-          name: req.headers['device-name'] || 'OV2640-CAM',
+          name: 'OV2640-CAM',
           type: 'ESP32-CAM',
-          ipAddress: req.headers['device-ip'] || '0.0.0.0',
+          ipAddress: frame.address,
           status: 'online',
-          uptime: parseInt(req.headers['device-uptime']) || 0,
-          freeHeap: parseInt(req.headers['device-freeheap']) || 0,
-          wifiRssi: parseInt(req.headers['device-wifirssi']) || 0,
-          capabilities: ['camera', 'ov2640', 'high_fps']
+          capabilities: ['camera', 'ov2640', 'high_fps', 'udp_stream']
         }).catch(() => {});
       }
 
-      // Face recognition (every 20th frame)
-      if (Math.random() < 0.05) {
-        dataStore.performFaceRecognition(req.body)
-          .then(result => {
-            const recogMsg = `{"type":"recognition_complete","filename":"${filename}","deviceId":"${deviceId}","timestamp":${timestamp},"recognition":${JSON.stringify(result)}}`;
-            wss.clients.forEach(client => {
-              if (client.readyState === 1) client.send(recogMsg);
-            });
-          })
-          .catch(() => {});
-      }
+      const receivedAt = Date.now();
+      const ageMs = frameAgeMs(frame.ageMs);
+      const timestamp = receivedAt - ageMs; // frameStore keeps the filename unique
+      const timing = frameLatency.frameReceived(deviceId, {
+        seq: frame.seq,
+        capturedAt: frame.capturedAt,
+        ageMs,
+        receivedAt,
+        replayed: (frame.flags & FRAME_FLAG_REPLAYED) !== 0
+      });
+      const stored = frameStore.append(deviceId, timestamp, frame.data);
+      processFastFrame(deviceId, {}, stored, frame.flags, timing, frame.data);
     });
+  }
+
+  // Per-camera loss/reordering and latency percentiles for each stage
+  app.get('/api/v1/stream/latency', (req, res) => {
+    res.json({ success: true, devices: frameLatency.getStats() });
+  });
+
+  // Ask a camera for full-resolution ROI crops. Delivered as a Roi-Request
+  // header on the camera's next /stream/fast response; push-stream and UDP
+  // cameras have no per-frame response and only crop on motion.
+  app.post('/api/v1/stream/roi/:deviceId', (req, res) => {
+    roiRequests.add(req.params.deviceId);
+    console.log(`[FastStream] 🎯 ROI crop requested from ${req.params.deviceId}`);
+    res.json({ success: true, deviceId: req.params.deviceId });
   });
 
   // --- ALL OTHER ROUTES BELOW ARE UNCHANGED ---
@@ -255,6 +523,9 @@ function setupRoutes(app, dataStore, wss) {
       });
 
       await buzzerRequest.save();
+      if (statusEnum === 'pending') {
+        pushBuzzerRequest(deviceId, buzzerRequest);
+      }
 
       // Log the request
       console.log(`Buzzer control request received:`, {
@@ -295,6 +566,7 @@ function setupRoutes(app, dataStore, wss) {
       });
 
       await buzzerRequest.save();
+      pushBuzzerRequest(deviceId, buzzerRequest);
 
       // Log the ping request
       console.log(`Buzzer ping request received:`, {
@@ -375,11 +647,7 @@ function setupRoutes(app, dataStore, wss) {
         timestamp: Date.now()
       };
 
-      wss.clients.forEach(client => {
-        if (client.readyState === WebSocket.OPEN) {
-          client.send(JSON.stringify(deviceMessage));
-        }
-      });
+      wss.broadcastToAll(deviceMessage);
 
       addNoCacheHeaders(res);
       res.json({
@@ -397,10 +665,14 @@ function setupRoutes(app, dataStore, wss) {
     }
   });
 
+  // Latest firmware metrics window per device (phase histograms, heap/PSRAM
+  // low-water marks, WiFi retries), as piggybacked on the heartbeat
+  const deviceMetrics = new Map();
+
   // Optimized heartbeat endpoint
   app.post('/api/v1/devices/heartbeat', async (req, res) => {
     const startTime = Date.now();
-    const { deviceId, uptime, freeHeap, wifiRssi, status } = req.body;
+    const { deviceId, uptime, freeHeap, wifiRssi, status, metrics } = req.body;
 
     if (!deviceId) {
       return res.status(400).json({
@@ -409,6 +681,10 @@ function setupRoutes(app, dataStore, wss) {
       });
     }
 
+    if (metrics && typeof metrics === 'object') {
+      deviceMetrics.set(deviceId, { receivedAt: startTime, metrics });
+    }
+
     try {
       const updatedDevice = await dataStore.updateDevice(deviceId, {
         uptime: uptime,
@@ -419,7 +695,10 @@ function setupRoutes(app, dataStore, wss) {
 
       if (updatedDevice) {
         addNoCacheHeaders(res);
+        // First key: the firmware keeps only the start of this response
+        const configPending = deviceConfig.pendingVersion(deviceId);
         res.json({
+          ...(configPending ? { configPending } : {}),
           message: 'Heartbeat received',
           status: 'success',
           device: updatedDevice,
@@ -454,6 +733,9 @@ function setupRoutes(app, dataStore, wss) {
     try {
       const request = await dataStore.createBuzzerRequest(deviceId);
 
+      // Wake the device if it is long-polling or subscribed over MQTT
+      pushBuzzerRequest(deviceId, request);
+
       // Real-time notification
       const buzzerMessage = {
         type: 'buzzer_request',
@@ -462,11 +744,7 @@ function setupRoutes(app, dataStore, wss) {
         timestamp: request.requestedAt
       };
 
-      wss.clients.forEach(client => {
-        if (client.readyState === WebSocket.OPEN) {
-          client.send(JSON.stringify(buzzerMessage));
-        }
-      });
+      wss.broadcastToAll(buzzerMessage);
 
       addNoCacheHeaders(res);
       res.json({
@@ -484,38 +762,50 @@ function setupRoutes(app, dataStore, wss) {
     }
   });
 
-  // ESP32 buzzer status endpoint - matches what ESP32 polls for
+  // ESP32 buzzer status endpoint - matches what ESP32 polls for.
+  // With ?wait=<ms> the request is held open until a buzzer request arrives
+  // for the device or the wait expires, replacing the 150 ms polling loop.
   app.get('/api/v1/buzzer/status/:deviceId', async (req, res) => {
     const startTime = Date.now();
     const { deviceId } = req.params;
+    const waitMs = parseInt(req.query.wait, 10) || 0;
+
+    // Register before the database lookup so a request created meanwhile still wakes us
+    const pushed = waitMs > 0 ? buzzerNotifier.wait(deviceId, waitMs) : null;
 
     try {
       await dataStore.dbReady;
       
       // Get the most recent pending buzzer request for this device
-      const request = await dataStore.dbOptimizer.optimizedFindOne(dataStore.BuzzerRequest, {
-        where: { 
-          deviceId: deviceId,
-          status: 'pending'
-        },
-        order: [['requestedAt', 'DESC']]
-      });
+      let request = await dataStore.getPendingBuzzerRequest(deviceId);
+
+      if (request) {
+        if (pushed) pushed.cancel();
+      } else if (pushed) {
+        res.on('close', () => pushed.cancel()); // device gave up or reconnected
+        request = await pushed;
+        if (res.writableEnded || res.destroyed) return;
+      }
 
+      addNoCacheHeaders(res);
+      const configPending = deviceConfig.pendingVersion(deviceId);
+      const extra = configPending ? { configPending } : {};
       if (request) {
         // Return pending status with request ID - match ESP32 expectations
-        addNoCacheHeaders(res);
         res.json({
           status: 'pending',
-          requestId: request.id.toString()
+          requestId: String(request.id || request.requestedAt),
+          ...extra
         });
       } else {
         // No pending requests
-        addNoCacheHeaders(res);
         res.json({
-          status: 'no_requests'
+          status: 'no_requests',
+          ...extra
         });
       }
     } catch (error) {
+      if (pushed) pushed.cancel();
       console.error('[API Error] /buzzer/status:', error);
       res.status(500).json({
         error: 'Failed to get buzzer status',
@@ -586,11 +876,7 @@ function setupRoutes(app, dataStore, wss) {
           timestamp: request.buzzedAt
         };
 
-        wss.clients.forEach(client => {
-          if (client.readyState === WebSocket.OPEN) {
-            client.send(JSON.stringify(completionMessage));
-          }
-        });
+        wss.broadcastToAll(completionMessage);
       }
 
       addNoCacheHeaders(res);
@@ -609,6 +895,21 @@ function setupRoutes(app, dataStore, wss) {
     }
   });
 
+  // Last metrics window a device reported with its heartbeat
+  app.get('/api/v1/devices/:deviceId/metrics', (req, res) => {
+    const entry = deviceMetrics.get(req.params.deviceId);
+    if (!entry) {
+      return res.status(404).json({ success: false, error: 'No metrics reported by this device' });
+    }
+    addNoCacheHeaders(res);
+    res.json({
+      success: true,
+      deviceId: req.params.deviceId,
+      receivedAt: new Date(entry.receivedAt).toISOString(),
+      metrics: entry.metrics
+    });
+  });
+
   // Get all devices
   app.get('/api/v1/devices', async (req, res) => {
     try {
@@ -663,6 +964,35 @@ function setupRoutes(app, dataStore, wss) {
     const startTime = Date.now();
     const sensorData = req.body;
 
+    // A JSON array is a batch of samples from one device
+    if (Array.isArray(sensorData)) {
+      const deviceId = sensorData.length > 0 && sensorData[0].deviceId;
+      if (!deviceId || sensorData.some(sample => sample.deviceId !== deviceId)) {
+        return res.status(400).json({
+          error: 'Batch samples must share one deviceId',
+          responseTime: Date.now() - startTime
+        });
+      }
+
+      try {
+        const result = await dataStore.saveSensorDataBatch(deviceId, sensorData);
+        addNoCacheHeaders(res);
+        return res.json({
+          success: true,
+          message: 'Batch received',
+          count: result.count,
+          responseTime: Date.now() - startTime
+        });
+      } catch (error) {
+        console.error('[API Error] /ingest/sensor-data (batch):', error);
+        return res.status(500).json({
+          error: 'Failed to save sensor data batch',
+          details: process.env.NODE_ENV === 'development' ? error.message : 'Internal server error',
+          responseTime: Date.now() - startTime
+        });
+      }
+    }
+
     if (!sensorData.deviceId) {
       return res.status(400).json({
         error: 'Missing required field: deviceId',
@@ -704,6 +1034,65 @@ function setupRoutes(app, dataStore, wss) {
     }
   });
 
+  // Packed binary batch from a sensor node (see sensorBatch.js). Sample
+  // stamps are device millis(); they are mapped onto server time using the
+  // send time carried in the batch header.
+  app.post('/api/v1/ingest/sensor-batch', express.raw({
+    type: 'application/octet-stream',
+    limit: '64kb'
+  }), async (req, res) => {
+    const startTime = Date.now();
+    const deviceId = req.headers['device-id'];
+
+    if (!deviceId) {
+      return res.status(400).json({
+        error: 'Missing required header: Device-Id',
+        responseTime: Date.now() - startTime
+      });
+    }
+
+    let batch;
+    try {
+      batch = decodeSensorBatch(req.body);
+    } catch (error) {
+      return res.status(400).json({
+        error: error.message,
+        responseTime: Date.now() - startTime
+      });
+    }
+
+    try {
+      const samples = batch.samples.map(sample => ({
+        ...sample,
+        timestamp: toServerTime(sample.deviceTimeMs, batch.sentAtMs, startTime)
+      }));
+      const minFreeHeap = parseInt(req.headers['device-minfreeheap'], 10);
+      if (minFreeHeap && minFreeHeap < LOW_HEAP_WARNING_BYTES) {
+        console.warn(`⚠️  ${deviceId} heap low-water mark ${minFreeHeap} bytes ` +
+                     `(largest block ${req.headers['device-maxallocheap']} bytes)`);
+      }
+
+      const result = await dataStore.saveSensorDataBatch(deviceId, samples, {
+        name: req.headers['device-name'],
+        freeHeap: parseInt(req.headers['device-freeheap'], 10) || 0
+      });
+
+      addNoCacheHeaders(res);
+      res.json({
+        success: true,
+        count: result.count,
+        responseTime: Date.now() - startTime
+      });
+    } catch (error) {
+      console.error('[API Error] /ingest/sensor-batch:', error);
+      res.status(500).json({
+        error: 'Failed to save sensor batch',
+        details: process.env.NODE_ENV === 'development' ? error.message : 'Internal server error',
+        responseTime: Date.now() - startTime
+      });
+    }
+  });
+
   // Optimized sensor data retrieval with caching
   app.get('/api/v1/sensor-data', async (req, res) => {
     const startTime = Date.now();
@@ -747,6 +1136,10 @@ function setupRoutes(app, dataStore, wss) {
       const now = Date.now();
       const maxAgeMs = 30 * 1000; // Consider making this configurable
 
+      // Camera frames live in the segment store; /stream/stream uploads are still files
+      const storedFrames = frameStore.list()
+        .filter(entry => now - entry.timestamp <= maxAgeMs)
+        .map(entry => ({ entry, timestamp: entry.timestamp }));
       const imageFiles = files
         .map(file => {
           const match = file.match(/_(\d+)\.jpg$/);
@@ -756,6 +1149,7 @@ function setupRoutes(app, dataStore, wss) {
           return { path: path.join(dataDir, file), timestamp };
         })
         .filter(Boolean)
+        .concat(storedFrames)
         .sort((a, b) => a.timestamp - b.timestamp);
 
       if (imageFiles.length < 2) {
@@ -765,7 +1159,11 @@ function setupRoutes(app, dataStore, wss) {
       tempDir = await fsp.mkdtemp(path.join(os.tmpdir(), 'rec-'));
       for (let i = 0; i < imageFiles.length; i++) {
         const tempName = `img-${String(i).padStart(5, '0')}.jpg`;
-        await fsp.copyFile(imageFiles[i].path, path.join(tempDir, tempName));
+        if (imageFiles[i].entry) {
+          await fsp.writeFile(path.join(tempDir, tempName), await frameStore.read(imageFiles[i].entry));
+        } else {
+          await fsp.copyFile(imageFiles[i].path, path.join(tempDir, tempName));
+        }
       }
 
       const recordingId = `rec_${Date.now()}.mp4`;
@@ -841,15 +1239,23 @@ function setupRoutes(app, dataStore, wss) {
     // File-system based.
     try {
       res.set({ 'Cache-Control': 'no-cache' });
+      // Segment-store frames come from its in-memory index, with no stat per
+      // frame; only /stream/stream uploads are still files in data/
+      const stored = frameStore.list().map(entry => ({
+        id: entry.filename,
+        url: `/data/${entry.filename}`,
+        createdAt: new Date(entry.timestamp).toISOString(),
+        size: entry.length
+      }));
       const files = await fsp.readdir(dataDir);
-      const frames = await Promise.all(
+      const frames = stored.concat(await Promise.all(
         files
           .filter(f => f.toLowerCase().endsWith('.jpg'))
           .map(async file => {
             const stats = await fsp.stat(path.join(dataDir, file));
             return { id: file, url: `/data/${file}`, createdAt: stats.birthtime.toISOString(), size: stats.size };
           })
-      );
+      ));
       res.json({ success: true, data: frames.sort((a, b) => new Date(b.createdAt) - new Date(a.createdAt)) });
     } catch (err) {
       res.status(500).json({ success: false, error: 'Failed to retrieve frames' });
@@ -878,36 +1284,188 @@ function setupRoutes(app, dataStore, wss) {
     }
   });
 
-  // Send a command to a device (conceptual, needs actual implementation for device communication)
+  // Queues a config patch and lets the device know on its next response.
+  // A parked buzzer long-poll is answered at once so sensor nodes pick the
+  // patch up without waiting out the poll.
+  function pushDeviceConfig(deviceId, deviceType, config) {
+    const result = deviceConfig.push(deviceId, deviceType, config);
+    if (!result.error) {
+      buzzerNotifier.notify(deviceId, null);
+      console.log(`⚙️ [Config] Version ${result.version} queued for ${deviceId}: ${JSON.stringify(result.settings)}`);
+    }
+    return result;
+  }
+
+  // Send a command to a device. The only one so far is
+  //   { "command": "config", "config": { "TARGET_FPS": 10 } }
+  // which is delivered as a config patch (see deviceConfig.js).
   app.post('/api/v1/devices/:deviceId/command', async (req, res) => {
     const { deviceId } = req.params;
-    const { command } = req.body;
+    const { command, config } = req.body;
     try {
       const device = await dataStore.getDevice(deviceId);
       if (!device) {
         return res.status(404).json({ success: false, message: "Device not found" });
       }
-      console.log(`Received command '${command}' for device ${deviceId} (IP: ${device.ipAddress})`);
-      // Actual command sending logic would be implemented here (e.g., HTTP request to device.ipAddress)
-      // For now, just acknowledge.
-      res.json({ success: true, message: `Command '${command}' notionally sent to ${deviceId}.` });
+      if (command !== 'config') {
+        return res.status(400).json({ success: false, message: `Unknown command '${command}'` });
+      }
+      const result = pushDeviceConfig(deviceId, device.type, config);
+      if (result.error) {
+        return res.status(400).json({ success: false, message: result.error });
+      }
+      res.json({ success: true, deviceId, version: result.version, settings: result.settings });
     } catch (error) {
       console.error('[API Error] /devices/:deviceId/command:', error);
       res.status(500).json({ error: 'Failed to process command for device', details: error.message });
     }
   });
 
+  // Same patch for every registered device of a kind:
+  //   { "deviceType": "ESP32-CAM", "config": { "JPEG_QUALITY": 12 } }
+  app.post('/api/v1/devices/config', async (req, res) => {
+    const { deviceType, config } = req.body;
+    if (!deviceType) {
+      return res.status(400).json({ success: false, message: 'deviceType is required' });
+    }
+    try {
+      const kind = deviceKind(deviceType);
+      const devices = (await dataStore.getAllDevices()).filter(device => deviceKind(device.type) === kind);
+      const results = [];
+      for (const device of devices) {
+        const result = pushDeviceConfig(device.id, device.type, config);
+        if (result.error) {
+          // Same settings for every device, so the first error holds for all
+          return res.status(400).json({ success: false, message: result.error });
+        }
+        results.push({ deviceId: device.id, version: result.version });
+      }
+      res.json({ success: true, kind, devices: results });
+    } catch (error) {
+      console.error('[API Error] /devices/config:', error);
+      res.status(500).json({ error: 'Failed to queue config', details: error.message });
+    }
+  });
+
+  // Fetched by the device once it has seen a configPending version.
+  // Plain KEY=VALUE lines, parsed in place by the firmware.
+  app.get('/api/v1/devices/:deviceId/config', (req, res) => {
+    const text = deviceConfig.fetch(req.params.deviceId);
+    addNoCacheHeaders(res);
+    if (!text) {
+      return res.status(204).end();
+    }
+    res.type('text/plain').send(text);
+  });
+
+  // { version, applied, rejected: "KEY,KEY" } once the patch is saved on the device
+  app.post('/api/v1/devices/:deviceId/config/applied', (req, res) => {
+    const { deviceId } = req.params;
+    const version = parseInt(req.body.version, 10) || 0;
+    if (!deviceConfig.ack(deviceId, version, req.body.applied, req.body.rejected)) {
+      return res.status(404).json({ success: false });
+    }
+    const note = req.body.rejected ? `, rejected ${req.body.rejected}` : '';
+    console.log(`✅ [Config] ${deviceId} at version ${version}, ${req.body.applied} settings applied${note}`);
+    res.json({ success: true });
+  });
+
+  app.get('/api/v1/devices/:deviceId/config/status', (req, res) => {
+    res.json({ success: true, deviceId: req.params.deviceId, ...(deviceConfig.status(req.params.deviceId) || {}) });
+  });
+
+  // Firmware images for OTA updates, one channel per sketch
+  const firmwareStore = new FirmwareStore(path.join(dataDir, 'firmware'));
+
+  // Publish a build as the channel's current image:
+  //   curl --data-binary @sketch.ino.bin -H 'Content-Type: application/octet-stream' \
+  //        'http://localhost:9003/api/v1/firmware/camera?version=1.4.0'
+  app.post('/api/v1/firmware/:channel', express.raw({
+    type: 'application/octet-stream',
+    limit: '4mb'
+  }), async (req, res) => {
+    if (!Buffer.isBuffer(req.body) || req.body.length === 0) {
+      return res.status(400).json({ success: false, message: 'Send the .bin as application/octet-stream' });
+    }
+    try {
+      const result = await firmwareStore.publish(req.params.channel, req.body, req.query.version);
+      res.json({ success: true, channel: req.params.channel, ...result });
+    } catch (error) {
+      console.error('[API Error] /firmware publish:', error.message);
+      res.status(400).json({ success: false, message: error.message });
+    }
+  });
+
+  // Device update check. 204 when current; otherwise the image or a delta
+  // against the running one, streamed from disk.
+  app.get('/api/v1/firmware/:channel', (req, res) => {
+    const deviceId = req.headers['device-id'] || 'unknown_device';
+    const offer = firmwareStore.offer(req.params.channel, deviceId,
+      req.headers['firmware-md5'], req.headers['firmware-rejected']);
+    addNoCacheHeaders(res);
+    if (!offer) {
+      return res.status(204).end();
+    }
+
+    console.log(`📦 [Firmware] ${deviceId} gets ${offer.headers['Firmware-Version']} (${offer.format}, ${offer.length} bytes)`);
+    res.writeHead(200, { ...offer.headers, 'Content-Length': offer.length });
+    const stream = fs.createReadStream(offer.file);
+    stream.on('error', error => {
+      console.error(`❌ [Firmware] ${offer.file}: ${error.message}`);
+      res.destroy();
+    });
+    stream.pipe(res);
+  });
+
+  app.get('/api/v1/firmware', (req, res) => {
+    res.json({ success: true, ...firmwareStore.getStats(), devices: firmwareStore.deviceStatus() });
+  });
+
 
 
   // Serve static files for frames and recordings
+  // Segment-store frames by their per-file names; anything else falls
+  // through to the files in data/. A frame still being written is served
+  // once its write completes.
+  app.get('/data/:filename', (req, res, next) => {
+    const entry = frameStore.get(req.params.filename);
+    if (!entry) return next();
+    entry.ready.then(() => {
+      addCacheHeaders(res, 600);
+      res.set({ 'Content-Type': 'image/jpeg', 'Content-Length': entry.length });
+      frameStore.createReadStream(entry)
+        .on('error', () => res.destroy()) // Segment pruned while streaming
+        .pipe(res);
+    }, () => next());
+  });
   app.use('/data', express.static(dataDir));
   app.use('/recordings', express.static(recordingsDir));
 
+  // Event-loop delay since startup, or since the last ?reset=1 (the load
+  // generator takes one window per fleet size that way)
+  const EVENT_LOOP_RESOLUTION_MS = 10;
+  const eventLoopDelay = monitorEventLoopDelay({ resolution: EVENT_LOOP_RESOLUTION_MS });
+  eventLoopDelay.enable();
+  let eventLoopWindowStart = Date.now();
+
   // Performance monitoring endpoint
   app.get('/api/v1/system/performance', async (req, res) => {
     try {
       const memUsage = process.memoryUsage();
       const uptime = process.uptime();
+      // Samples include the sampling interval itself; report only the lag on top
+      const nsToMs = ns => Math.max(0, Math.round((ns / 1e6 - EVENT_LOOP_RESOLUTION_MS) * 100) / 100);
+      const eventLoop = {
+        windowMs: Date.now() - eventLoopWindowStart,
+        meanMs: eventLoopDelay.count ? nsToMs(eventLoopDelay.mean) : null,
+        p50Ms: eventLoopDelay.count ? nsToMs(eventLoopDelay.percentile(50)) : null,
+        p99Ms: eventLoopDelay.count ? nsToMs(eventLoopDelay.percentile(99)) : null,
+        maxMs: eventLoopDelay.count ? nsToMs(eventLoopDelay.max) : null
+      };
+      if (req.query.reset === '1') {
+        eventLoopDelay.reset();
+        eventLoopWindowStart = Date.now();
+      }
 
       // Get device count
       const allDevices = await dataStore.getAllDevices();
@@ -917,6 +1475,7 @@ function setupRoutes(app, dataStore, wss) {
         success: true,
         performance: {
           uptime: Math.floor(uptime),
+          eventLoop,
           memory: {
             rss: Math.round(memUsage.rss / 1024 / 1024) + ' MB',
             heapUsed: Math.round(memUsage.heapUsed / 1024 / 1024) + ' MB',
@@ -929,6 +1488,14 @@ function setupRoutes(app, dataStore, wss) {
             offline: allDevices.length - onlineDevices
           },
           websocketConnections: wss.clients.size,
+          broadcast: wss.broadcastStats(),
+          buzzerLongPolls: buzzerNotifier.getStats(),
+          deviceConfig: deviceConfig.getStats(),
+          firmware: firmwareStore.getStats(),
+          mqtt: mqttBridge ? mqttBridge.getStats() : null,
+          udpFrames: udpFrames ? udpFrames.getStats() : null,
+          frameStore: frameStore.getStats(),
+          recognition: recognitionScheduler.getStats(),
           nodeVersion: process.version,
           platform: process.platform
         }
@@ -938,6 +1505,9 @@ function setupRoutes(app, dataStore, wss) {
       res.status(500).json({ error: 'Failed to get performance metrics', details: error.message });
     }
   });
+
+  // What server.js shuts down on SIGTERM/SIGINT
+  return { frameStore };
 }
 
 module.exports = setupRoutes;
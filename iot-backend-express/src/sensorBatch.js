@@ -0,0 +1,93 @@
+// Decoder for packed sensor batches (/api/v1/ingest/sensor-batch).
+//
+// Little-endian, matching the ESP32's native struct layout:
+//   header (8 bytes)
+//     byte 0-1  magic 'S' 'B'
+//     byte 2    version (1 or 2)
+//     byte 3    sample count
+//     byte 4-7  device millis() when the batch was sent, uint32
+//   then per sample (v1: 14 bytes, v2: 24 bytes)
+//     byte 0-3   device millis() when sampled, uint32
+//     byte 4-5   temperature, int16, 0.01 °C
+//     byte 6-7   humidity, uint16, 0.01 %
+//     byte 8-9   distance, uint16, 0.1 cm (v2: median of the cycle's pings)
+//     byte 10-11 light level, uint16, ADC counts (v2: EMA-filtered)
+//     v2 only, per-cycle aggregates:
+//     byte 12-17 light mean, min, max, uint16 each, ADC counts
+//     byte 18-21 distance min, max, uint16 each, 0.1 cm
+//     last two bytes: SAMPLE_VALID_* bits (a cleared bit means the field is
+//     null), then reserved
+const BATCH_MAGIC_0 = 0x53; // 'S'
+const BATCH_MAGIC_1 = 0x42; // 'B'
+const BATCH_VERSION = 2;
+const BATCH_HEADER_SIZE = 8;
+const SAMPLE_SIZES = { 1: 14, 2: 24 };
+
+const SAMPLE_VALID_TEMPERATURE = 0x01;
+const SAMPLE_VALID_HUMIDITY = 0x02;
+const SAMPLE_VALID_DISTANCE = 0x04;
+const SAMPLE_VALID_LIGHT = 0x08;
+
+// Throws on a malformed batch so the route can answer 400.
+function decodeSensorBatch(buf) {
+  if (!Buffer.isBuffer(buf) || buf.length < BATCH_HEADER_SIZE) {
+    throw new Error('Sensor batch too short');
+  }
+  if (buf[0] !== BATCH_MAGIC_0 || buf[1] !== BATCH_MAGIC_1) {
+    throw new Error('Invalid sensor batch magic');
+  }
+  const version = buf[2];
+  const sampleSize = SAMPLE_SIZES[version];
+  if (!sampleSize) {
+    throw new Error(`Unsupported sensor batch version ${version}`);
+  }
+
+  const count = buf[3];
+  if (buf.length !== BATCH_HEADER_SIZE + count * sampleSize) {
+    throw new Error(`Sensor batch length ${buf.length} does not match ${count} samples`);
+  }
+
+  const sentAtMs = buf.readUInt32LE(4);
+  const samples = new Array(count);
+  for (let i = 0; i < count; i++) {
+    const o = BATCH_HEADER_SIZE + i * sampleSize;
+    const valid = buf[o + sampleSize - 2];
+    const sample = {
+      deviceTimeMs: buf.readUInt32LE(o),
+      temperature: valid & SAMPLE_VALID_TEMPERATURE ? buf.readInt16LE(o + 4) / 100 : null,
+      humidity: valid & SAMPLE_VALID_HUMIDITY ? buf.readUInt16LE(o + 6) / 100 : null,
+      distance: valid & SAMPLE_VALID_DISTANCE ? buf.readUInt16LE(o + 8) / 10 : null,
+      lightLevel: valid & SAMPLE_VALID_LIGHT ? buf.readUInt16LE(o + 10) : null
+    };
+
+    // Aggregates have no columns of their own; they go to customData
+    if (version >= 2) {
+      sample.customData = {};
+      if (valid & SAMPLE_VALID_LIGHT) {
+        sample.customData.lightMean = buf.readUInt16LE(o + 12);
+        sample.customData.lightMin = buf.readUInt16LE(o + 14);
+        sample.customData.lightMax = buf.readUInt16LE(o + 16);
+      }
+      if (valid & SAMPLE_VALID_DISTANCE) {
+        sample.customData.distanceMin = buf.readUInt16LE(o + 18) / 10;
+        sample.customData.distanceMax = buf.readUInt16LE(o + 20) / 10;
+      }
+    }
+    samples[i] = sample;
+  }
+  return { sentAtMs, samples };
+}
+
+// Maps a device millis() stamp onto server time using the batch's send time.
+// uint32 subtraction keeps this right across the device's 49-day wrap.
+function toServerTime(deviceTimeMs, sentAtMs, receivedAt) {
+  return receivedAt - ((sentAtMs - deviceTimeMs) >>> 0);
+}
+
+module.exports = {
+  decodeSensorBatch,
+  toServerTime,
+  BATCH_VERSION,
+  BATCH_HEADER_SIZE,
+  SAMPLE_SIZES
+};
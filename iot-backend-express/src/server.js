@@ -12,6 +12,9 @@ const { createSshTunnel } = require('../job/tunnel');
 const { DataStore } = require('./dataStore');
 const setupRoutes = require('./routes');
 const { initializeDatabase } = require('./database');
+const { MqttBridge } = require('./mqttBridge');
+const { UdpFrameReceiver } = require('./frameDatagram');
+const { BroadcastHub } = require('./broadcastHub');
 
 // Load environment variables
 dotenv.config();
@@ -50,7 +53,7 @@ const apiLimiter = rateLimit({
   legacyHeaders: false,
   skip: (req) => {
     // Skip rate limiting for high-frequency endpoints
-    return req.path.includes('/stream/fast') || req.path.includes('/heartbeat');
+    return req.path.includes('/stream/fast') || req.path.includes('/stream/push') || req.path.includes('/heartbeat');
   }
 });
 // app.use('/api/', apiLimiter);
@@ -66,6 +69,9 @@ const wss = new WebSocket.Server({
   perMessageDeflate: true // Enable compression
 });
 
+// Fan-out with per-camera subscriptions and slow-client dropping
+const broadcastHub = new BroadcastHub(wss);
+
 // WebSocket connection management
 let wsConnectionCount = 0;
 const MAX_WS_CONNECTIONS = 1000;
@@ -80,6 +86,7 @@ wss.on('connection', (ws, request) => {
   }
 
   console.log(`📡 WebSocket connected (${wsConnectionCount} active connections)`);
+  broadcastHub.track(ws, request);
   
   // Send welcome message with server capabilities
   ws.send(JSON.stringify({
@@ -103,6 +110,8 @@ wss.on('connection', (ws, request) => {
       // Handle specific message types if needed
       if (data.type === 'ping') {
         ws.send(JSON.stringify({ type: 'pong', timestamp: Date.now() }));
+      } else {
+        broadcastHub.handleMessage(ws, data);
       }
     } catch (error) {
       console.error('WebSocket message parse error:', error.message);
@@ -121,21 +130,12 @@ wss.on('connection', (ws, request) => {
   });
 });
 
-// Broadcast helper function for high-performance messaging
-wss.broadcastToAll = (message) => {
-  const messageStr = typeof message === 'string' ? message : JSON.stringify(message);
-  const clients = Array.from(wss.clients);
-  
-  clients.forEach(client => {
-    if (client.readyState === WebSocket.OPEN) {
-      try {
-        client.send(messageStr);
-      } catch (error) {
-        console.error('WebSocket broadcast error:', error.message);
-      }
-    }
-  });
-};
+// Broadcast helpers for high-performance messaging; both serialize once.
+// broadcastToDevice only reaches clients viewing that camera, and
+// { droppable: true } lets slow clients skip the message.
+wss.broadcastToAll = (message) => broadcastHub.broadcast(message);
+wss.broadcastToDevice = (deviceId, message, options) => broadcastHub.publish(deviceId, message, options);
+wss.broadcastStats = () => broadcastHub.getStats();
 
 // Performance monitoring for WebSocket
 setInterval(() => {
@@ -144,8 +144,26 @@ setInterval(() => {
   }
 }, 60000); // Log every minute
 
+// Optional MQTT transport for sensor nodes, bridged into the same DataStore
+const mqttBridge = process.env.MQTT_ENABLED === 'true'
+  ? new MqttBridge(dataStore, wss, {
+      port: parseInt(process.env.MQTT_PORT, 10) || undefined,
+      topicPrefix: process.env.MQTT_TOPIC_PREFIX
+    })
+  : null;
+
+// Optional lossy UDP frame transport for cameras, feeding the same broadcast
+// as /api/v1/stream/fast
+const udpFrames = process.env.UDP_FRAMES_ENABLED === 'true'
+  ? new UdpFrameReceiver({
+      port: parseInt(process.env.UDP_FRAMES_PORT, 10) || undefined,
+      jitterMs: parseInt(process.env.UDP_FRAMES_JITTER_MS, 10)
+    })
+  : null;
+
 // Initialize and start high-performance server
 let server; // Declare server variable in module scope
+let frameStore = null; // Segment store from setupRoutes, sealed on shutdown
 
 (async () => {
   try {
@@ -169,7 +187,7 @@ let server; // Declare server variable in module scope
     console.log('🚀 Starting optimized server...');
     
     // Setup routes with high-performance dependencies
-    setupRoutes(app, dataStore, wss);
+    ({ frameStore } = setupRoutes(app, dataStore, wss, mqttBridge, udpFrames));
     
     // Add global error handler
     app.use((err, req, res, next) => {
@@ -188,6 +206,18 @@ let server; // Declare server variable in module scope
       console.log(`💾 Memory usage: ${Math.round(process.memoryUsage().heapUsed / 1024 / 1024)}MB`);
     });
     
+    if (mqttBridge) {
+      await mqttBridge.listen();
+    } else {
+      console.log('ℹ️  MQTT bridge disabled (MQTT_ENABLED is not true)');
+    }
+    
+    if (udpFrames) {
+      await udpFrames.listen();
+    } else {
+      console.log('ℹ️  UDP frame receiver disabled (UDP_FRAMES_ENABLED is not true)');
+    }
+    
     // Configure server for high traffic
     server.keepAliveTimeout = 65000; // Slightly higher than load balancer timeout
     server.headersTimeout = 66000; // Higher than keepAliveTimeout
@@ -238,7 +268,8 @@ let server; // Declare server variable in module scope
 // Graceful shutdown handling
 process.on('SIGTERM', () => {
   console.log('📤 SIGTERM received, shutting down gracefully');
-  server.close(() => {
+  server.close(async () => {
+    if (frameStore) await frameStore.close();
     console.log('✅ Server closed');
     process.exit(0);
   });
@@ -246,7 +277,8 @@ process.on('SIGTERM', () => {
 
 process.on('SIGINT', () => {
   console.log('📤 SIGINT received, shutting down gracefully');
-  server.close(() => {
+  server.close(async () => {
+    if (frameStore) await frameStore.close();
     console.log('✅ Server closed');
     process.exit(0);
   });
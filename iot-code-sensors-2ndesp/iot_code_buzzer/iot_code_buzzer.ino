@@ -6,45 +6,75 @@
  * - VCC = D23 (Power pin)
  */
 
+// Build with the shared core library (iot-firmware-core/, see IotCore.h)
+#define LOG_LEVEL LOG_LEVEL_INFO
+#define IOT_CORE_OFFLINE     // No WiFi, HTTP or stored config on this board
+#include <IotCore.h>
+
 // Pin definitions
 #define BUZZER_VCC_PIN 23   // Power pin for the buzzer
 #define BUZZER_IO_PIN 25    // Signal/Control pin for the buzzer
 
-// Buzzer control variables
-bool buzzerEnabled = false;
-unsigned long lastBuzzerTime = 0;
-int buzzerPattern = 0; // 0=off, 1=single beep, 2=double beep, 3=continuous, 4=alarm pattern
+// The buzzer profile drives BUZZER_IO_PIN from LEDC and switches
+// BUZZER_VCC_PIN with it; patterns play from a timer, so nothing blocks
+struct Device : iot::BuzzerProfile {
+  static constexpr int kBuzzerPin = BUZZER_IO_PIN;
+  static constexpr int kBuzzerVccPin = BUZZER_VCC_PIN;
+};
+
+const iot::BuzzerStep SINGLE_BEEP_STEPS[] = { {iot::BUZZER_DC, 200} };
+const iot::BuzzerStep DOUBLE_BEEP_STEPS[] = { {iot::BUZZER_DC, 150}, {0, 100}, {iot::BUZZER_DC, 150} };
+const iot::BuzzerStep CONTINUOUS_STEPS[] = { {iot::BUZZER_DC, 1000} };
+const iot::BuzzerStep ALARM_STEPS[] = { {iot::BUZZER_DC, 500}, {0, 500} };
+const iot::BuzzerStep SHORT_BEEP_STEPS[] = { {iot::BUZZER_DC, 100} };
+const iot::BuzzerStep LONG_BEEP_STEPS[] = { {iot::BUZZER_DC, 500} };
+const iot::BuzzerStep WARNING_STEPS[] = { {iot::BUZZER_DC, 100}, {0, 100} };
+const iot::BuzzerStep MELODY_STEPS[] = {
+  {262, 200}, {0, 50}, // C4
+  {294, 200}, {0, 50}, // D4
+  {330, 200}, {0, 50}, // E4
+  {349, 200}, {0, 50}, // F4
+  {392, 400}, {0, 50}  // G4
+};
+
+const iot::BuzzerPattern SINGLE_BEEP = IOT_BUZZER_PATTERN(SINGLE_BEEP_STEPS, 1);
+const iot::BuzzerPattern DOUBLE_BEEP = IOT_BUZZER_PATTERN(DOUBLE_BEEP_STEPS, 1);
+const iot::BuzzerPattern CONTINUOUS = IOT_BUZZER_PATTERN(CONTINUOUS_STEPS, 0);
+const iot::BuzzerPattern ALARM = IOT_BUZZER_PATTERN(ALARM_STEPS, 0);
+const iot::BuzzerPattern SHORT_BEEP = IOT_BUZZER_PATTERN(SHORT_BEEP_STEPS, 1);
+const iot::BuzzerPattern LONG_BEEP = IOT_BUZZER_PATTERN(LONG_BEEP_STEPS, 1);
+const iot::BuzzerPattern WARNING = IOT_BUZZER_PATTERN(WARNING_STEPS, 1);
+const iot::BuzzerPattern MELODY = IOT_BUZZER_PATTERN(MELODY_STEPS, 1);
+
+iot::BuzzerEngine<Device> buzzer;
 
 void setup() {
   // Initialize serial communication
   Serial.begin(921600);  // Initialize serial for debugging
-  Serial.println("ESP32 Buzzer Controller Starting...");
-  
+  LOG_I("ESP32 Buzzer Controller Starting...\n");
+
   // Configure buzzer pins
-  pinMode(BUZZER_VCC_PIN, OUTPUT);
-  pinMode(BUZZER_IO_PIN, OUTPUT);
-  
+  buzzer.begin();
+
   // Initialize buzzer to OFF state
   buzzerOff();
-  
+
   Serial.println("Buzzer initialized. Send commands:");
   Serial.println("1 - Single beep");
   Serial.println("2 - Double beep");
   Serial.println("3 - Start continuous buzzer");
   Serial.println("4 - Alarm pattern");
+  Serial.println("5 - Melody");
   Serial.println("0 - Turn off buzzer");
 }
 
 void loop() {
-  // Check for serial commands
+  // Check for serial commands; patterns play from the timer meanwhile
   if (Serial.available()) {
     char command = Serial.read();
     handleSerialCommand(command);
   }
-  
-  // Handle buzzer patterns
-  handleBuzzerPatterns();
-  
+
   delay(10); // Small delay to prevent excessive CPU usage
 }
 
@@ -52,139 +82,78 @@ void handleSerialCommand(char command) {
   switch (command) {
     case '0':
       buzzerOff();
-      Serial.println("Buzzer turned OFF");
+      LOG_I("Buzzer turned OFF\n");
       break;
     case '1':
       singleBeep();
-      Serial.println("Single beep");
+      LOG_I("Single beep\n");
       break;
     case '2':
       doubleBeep();
-      Serial.println("Double beep");
+      LOG_I("Double beep\n");
       break;
     case '3':
       continuousBuzzer();
-      Serial.println("Continuous buzzer ON");
+      LOG_I("Continuous buzzer ON\n");
       break;
     case '4':
       alarmPattern();
-      Serial.println("Alarm pattern started");
+      LOG_I("Alarm pattern started\n");
+      break;
+    case '5':
+      playMelody();
+      LOG_I("Melody started\n");
       break;
     default:
-      Serial.println("Invalid command. Use 0-4");
+      LOG_W("Invalid command. Use 0-5\n");
       break;
   }
 }
 
+// --- Buzzer functions ---
 void buzzerOn() {
-  digitalWrite(BUZZER_VCC_PIN, HIGH);  // Power on
-  digitalWrite(BUZZER_IO_PIN, HIGH);   // Signal on
-  buzzerEnabled = true;
+  buzzer.play(CONTINUOUS);
 }
 
 void buzzerOff() {
-  digitalWrite(BUZZER_VCC_PIN, LOW);   // Power off
-  digitalWrite(BUZZER_IO_PIN, LOW);    // Signal off
-  buzzerEnabled = false;
-  buzzerPattern = 0;
+  buzzer.stop();
 }
 
 void singleBeep() {
-  buzzerOn();
-  delay(200);
-  buzzerOff();
+  buzzer.play(SINGLE_BEEP);
 }
 
 void doubleBeep() {
-  buzzerOn();
-  delay(150);
-  buzzerOff();
-  delay(100);
-  buzzerOn();
-  delay(150);
-  buzzerOff();
+  buzzer.play(DOUBLE_BEEP);
 }
 
 void continuousBuzzer() {
-  buzzerPattern = 3;
-  buzzerOn();
+  buzzer.play(CONTINUOUS);
 }
 
 void alarmPattern() {
-  buzzerPattern = 4;
-  lastBuzzerTime = millis();
-}
-
-void handleBuzzerPatterns() {
-  unsigned long currentTime = millis();
-  
-  switch (buzzerPattern) {
-    case 3: // Continuous buzzer - already handled by keeping it on
-      break;
-      
-    case 4: // Alarm pattern - intermittent beeping
-      if (currentTime - lastBuzzerTime >= 500) {
-        if (buzzerEnabled) {
-          buzzerOff();
-        } else {
-          buzzerOn();
-        }
-        lastBuzzerTime = currentTime;
-      }
-      break;
-  }
+  buzzer.play(ALARM);
 }
 
 // Additional utility functions for specific use cases
 void shortBeep() {
-  buzzerOn();
-  delay(100);
-  buzzerOff();
+  buzzer.play(SHORT_BEEP);
 }
 
 void longBeep() {
-  buzzerOn();
-  delay(500);
-  buzzerOff();
+  buzzer.play(LONG_BEEP);
 }
 
 void warningBeeps(int count) {
-  for (int i = 0; i < count; i++) {
-    buzzerOn();
-    delay(100);
-    buzzerOff();
-    delay(100);
-  }
+  buzzer.play(WARNING, (uint8_t)constrain(count, 1, 255));
 }
 
 // Function to create custom tones (if buzzer supports frequency control)
 void playTone(int frequency, int duration) {
-  digitalWrite(BUZZER_VCC_PIN, HIGH);  // Power on
-  tone(BUZZER_IO_PIN, frequency, duration);
-  delay(duration);
-  noTone(BUZZER_IO_PIN);
-  digitalWrite(BUZZER_VCC_PIN, LOW);   // Power off
+  buzzer.playTone((uint16_t)frequency, (uint16_t)duration);
 }
 
 // Play a simple melody
 void playMelody() {
-  digitalWrite(BUZZER_VCC_PIN, HIGH);  // Power on
-  
-  // Simple melody notes (frequency, duration)
-  int melody[][2] = {
-    {262, 200}, // C4
-    {294, 200}, // D4
-    {330, 200}, // E4
-    {349, 200}, // F4
-    {392, 400}, // G4
-    {0, 0}      // End marker
-  };
-  
-  for (int i = 0; melody[i][0] != 0; i++) {
-    tone(BUZZER_IO_PIN, melody[i][0], melody[i][1]);
-    delay(melody[i][1] + 50); // Small pause between notes
-    noTone(BUZZER_IO_PIN);
-  }
-  
-  digitalWrite(BUZZER_VCC_PIN, LOW);   // Power off
-}
\ No newline at end of file
+  buzzer.play(MELODY);
+}
@@ -2,26 +2,136 @@
 // WITH IoT Backend Integration using .env configuration
 
 // --- LIBRARIES ---
-#include <Ticker.h>
-#include <Preferences.h>
-#include <WiFi.h>
-#include <HTTPClient.h>
+// WiFi, HTTP, config, metrics, logging and the buzzer engine come from the
+// shared firmware core (iot-firmware-core/, see IotCore.h); it is included
+// below once LOG_LEVEL is set
+#include <esp_timer.h>
+#include <esp_sleep.h>
 #include <ArduinoJson.h>
 #include <DHT.h>
 
 // --- HARDWARE PIN DEFINITIONS ---
 #define BUZZER_PIN 25
-#define BUZZER_POLL_INTERVAL 150  // Poll every 150ms
+#define BUZZER_POLL_INTERVAL 150  // Poll every 150ms (only when long-polling is off)
+#define BUZZER_LONG_POLL_MS 25000 // Server holds the status request until a buzz arrives; 0 = short polling
+#define BUZZER_RETRY_INTERVAL 1000 // Back-off after a failed or repeated long-poll
 #define TRIG_PIN 19
 #define ECHO_PIN 18
 #define DHT_PIN 23
 #define DHT_TYPE DHT11
 #define LDR_PIN 32
 
-// --- GLOBAL OBJECTS AND VARIABLES ---
+// --- TASK AND TIMING CONFIGURATION ---
+#define NETWORK_TASK_CORE 0       // HTTP runs next to the WiFi stack, sensors stay on the loop core
+#define NETWORK_TASK_STACK 8192
+#define BUZZER_TASK_STACK 6144
+#define HTTP_TIMEOUT_MS 1000      // Bound every request so one slow call cannot stall polling
+#define ECHO_TIMEOUT_US 30000     // ~5 m round trip, past the HC-SR04's range
+
+// --- SAMPLING AND FILTERING ---
+#define LDR_SAMPLE_RATE_HZ 2000        // ADC continuous-mode rate for the LDR (core 3.x)
+#define LDR_CONVERSIONS_PER_FRAME 20   // Conversions averaged by the driver per frame (100 frames/s)
+#define LDR_EMA_SHIFT 3                // Reported light level is an EMA with weight 1/8 per frame
+#define ULTRASONIC_PINGS 5             // Median-of-N echoes per sensor cycle
+#define ULTRASONIC_PING_GAP_MS 60      // HC-SR04 needs ~60 ms for the last echo to die out
+#define REGISTER_RETRY_INTERVAL 10000
+#define HTTP_HEADER_BUFFER 384        // Request head, formatted in place
+#define HTTP_RESPONSE_BUFFER 256      // Largest response body we keep (longer ones are truncated)
+#define JSON_ARENA_BYTES 2048         // Static backing store for each task's JSON documents
+
+// --- TRANSPORT ---
+// HTTP: a keep-alive request per upload plus a parked buzzer long-poll.
+// MQTT: one persistent session to the backend's broker (MQTT_ENABLED=true
+// there). Sensor batches publish at QoS0, buzzer commands arrive at QoS1 on
+// a subscribed topic and are acknowledged at QoS1 instead of the completion
+// PATCH. Registration and the metrics heartbeat stay on HTTP either way.
+#define TRANSPORT_HTTP 0
+#define TRANSPORT_MQTT 1
+#define TRANSPORT_MODE TRANSPORT_HTTP
+#define MQTT_TOPIC_PREFIX "iot"       // Must match the backend's MQTT_TOPIC_PREFIX
+#define MQTT_KEEPALIVE_S 30
+
+// --- SENSOR BATCHING ---
+#define SENSOR_BATCH_MODE 1          // 1 = packed batches to /ingest/sensor-batch, 0 = one JSON POST per send interval
+#define SENSOR_RING_CAPACITY 64      // Samples held on-device; the oldest is overwritten when full
+#define SENSOR_BATCH_MAX 32          // Samples per POST
+#define SENSOR_BATCH_FLUSH_MS 10000  // Flush at least this often
+#define SENSOR_BATCH_VERSION 2
+#define SENSOR_BATCH_HEADER_SIZE 8
+
+// --- POWER PROFILE ---
+// Duty-cycled mode for battery use: wake on a timer, sample once, keep the
+// sample in RTC memory, and only bring WiFi up every few wakes to flush the
+// batch and pick up buzzer requests. The buzzer wake pin brings the node up
+// at once (ext0), for a button or an external "buzz now" signal.
+#define POWER_PROFILE_DUTY_CYCLE 0     // 1 = deep-sleep between samples, 0 = always on
+#define SLEEP_INTERVAL_MS 30000        // Deep-sleep time between wakes
+#define UPLOAD_EVERY_WAKES 4           // Bring WiFi up on every Nth wake
+#define BUZZER_WAKE_PIN 33             // ext0 wake source (must be an RTC GPIO); -1 = none
+#define BUZZER_WAKE_LEVEL 0            // Level that wakes the node
+#define DHT_SETTLE_MS 1100             // DHT11 needs ~1 s after power-up before a read
+
+// --- FIRMWARE UPDATES ---
+// networkTask asks the backend for a new image now and then (see
+// OtaUpdater.h) and downloads it in short slices between requests. A
+// duty-cycled node checks on every Nth upload wake instead and downloads
+// in one go. Flash with a partition scheme that has two OTA slots.
+#define OTA_ENABLED 1
+#define OTA_CHANNEL "sensor"           // Images are published per channel on the backend
+#define OTA_CHECK_EVERY_WAKES 120      // Duty cycle: one check an hour at 30 s wakes
+
+// WiFi bring-up: try the cached BSSID/channel first, then a normal scan;
+// DHCP runs unless STATIC_IP is set
+#define WIFI_FAST_CONNECT_MS 1000      // Budget for a join from the cache
+#define WIFI_JOIN_TIMEOUT_MS 15000     // Budget for a full scan + DHCP join
+#define WIFI_RETRY_INTERVAL_MS 5000    // Wait after a failed full join
+
+// --- TELEMETRY ---
+// LOG_LEVEL_DEBUG logs every sensor reading and upload; the serial config
+// console is not logging and always prints
+#define LOG_LEVEL LOG_LEVEL_INFO
+#define METRICS_ENABLED 1              // Phase histograms, reported with a heartbeat
+#define METRICS_REPORT_INTERVAL_MS 60000
+
+#include <IotCore.h>
 
-// Persistent storage for configuration
-Preferences preferences;
+// Multi-sensor profile: buzzer engine on BUZZER_PIN, modem sleep allowed,
+// 26 histogram buckets since a long-poll can run past 8 s
+struct Device : iot::MultiSensorProfile {
+  static constexpr int kBuzzerPin = BUZZER_PIN;
+  static constexpr bool kMetrics = METRICS_ENABLED;
+  static constexpr uint32_t kWifiFastConnectMs = WIFI_FAST_CONNECT_MS;
+  static constexpr uint32_t kWifiJoinTimeoutMs = WIFI_JOIN_TIMEOUT_MS;
+  static constexpr uint32_t kWifiRetryIntervalMs = WIFI_RETRY_INTERVAL_MS;
+};
+
+// The sample ring and deadband state must outlive deep sleep; an always-on
+// node starts them fresh on each boot since millis() starts over too
+#if POWER_PROFILE_DUTY_CYCLE
+#define SLEEP_RETAINED RTC_DATA_ATTR
+#else
+#define SLEEP_RETAINED
+#endif
+
+#if POWER_PROFILE_DUTY_CYCLE && !SENSOR_BATCH_MODE
+#error "POWER_PROFILE_DUTY_CYCLE needs SENSOR_BATCH_MODE: samples wait in RTC memory between uploads"
+#endif
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT && POWER_PROFILE_DUTY_CYCLE
+#error "TRANSPORT_MQTT keeps a session open; a duty-cycled node should use TRANSPORT_HTTP"
+#endif
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT && !SENSOR_BATCH_MODE
+#error "TRANSPORT_MQTT publishes packed sensor batches; it needs SENSOR_BATCH_MODE"
+#endif
+
+// SensorSample.valid bits; a cleared bit means the reading failed
+#define SAMPLE_VALID_TEMPERATURE 0x01
+#define SAMPLE_VALID_HUMIDITY 0x02
+#define SAMPLE_VALID_DISTANCE 0x04
+#define SAMPLE_VALID_LIGHT 0x08
+
+// --- GLOBAL OBJECTS AND VARIABLES ---
 
 // Configuration Structure (.env compatible)
 struct Config {
@@ -32,6 +142,24 @@ struct Config {
   char deviceId[32];
   char deviceName[64];
   char deviceType[32];
+  // Fixed address that skips DHCP; an empty STATIC_IP runs DHCP
+  char staticIp[16];
+  char gateway[16];
+  char subnet[16];
+  // Report-on-change deadbands: a sample is only reported once a channel
+  // moves this far from the last reported value (0 = report every sample)
+  float deadbandTemp;      // °C
+  float deadbandHumidity;  // % RH
+  float deadbandDistance;  // cm
+  int deadbandLight;       // ADC counts
+  uint32_t maxSilenceMs;   // Report anyway after this long, as a heartbeat
+  int mqttPort;            // Broker port on SERVER_IP (TRANSPORT_MQTT)
+  // Cadence; read live, so a patch from the backend takes effect at once
+  uint32_t sensorIntervalMs;  // Sensor read cycle
+  uint32_t sendIntervalMs;    // One JSON POST per interval (SENSOR_BATCH_MODE 0)
+  uint32_t buzzerPollMs;      // Short buzzer poll (BUZZER_LONG_POLL_MS 0)
+  uint32_t batchFlushMs;      // Batch flushed at least this often (SENSOR_BATCH_MODE 1)
+  uint32_t configVersion;     // Last backend patch applied (see RemoteConfig.h)
 };
 
 Config config;
@@ -44,48 +172,301 @@ const Config defaultConfig = {
   9003,                      // SERVER_PORT
   "esp32-multi-sensor-1",    // DEVICE_ID
   "Lab Sensor Unit",         // DEVICE_NAME
-  "DHT11-LDR-HCSR04"        // DEVICE_TYPE
+  "DHT11-LDR-HCSR04",       // DEVICE_TYPE
+  "",                        // STATIC_IP
+  "",                        // GATEWAY
+  "255.255.255.0",           // SUBNET
+  0.5f,                      // DEADBAND_TEMP
+  2.0f,                      // DEADBAND_HUM
+  1.0f,                      // DEADBAND_DIST
+  20,                        // DEADBAND_LIGHT
+  60000,                     // MAX_SILENCE_MS
+  1883,                      // MQTT_PORT
+  2000,                      // SENSOR_INTERVAL_MS
+  1000,                      // SEND_INTERVAL_MS
+  BUZZER_POLL_INTERVAL,      // BUZZER_POLL_MS
+  SENSOR_BATCH_FLUSH_MS,     // BATCH_FLUSH_MS
+  0                          // CONFIG_VERSION
 };
 
+// Every key below can be changed over serial (SET KEY=VALUE) and is kept in
+// Preferences; the table drives load, save and the console. The REMOTE ones
+// can also be pushed from the backend (/api/v1/devices/:id/command).
+const iot::ConfigField CONFIG_FIELDS[] = {
+  IOT_CONFIG_STRING(Config, wifiSsid, "WIFI_SSID"),
+  IOT_CONFIG_STRING(Config, wifiPassword, "WIFI_PASSWORD"),
+  IOT_CONFIG_STRING(Config, serverIp, "SERVER_IP"),
+  IOT_CONFIG_INT(Config, serverPort, "SERVER_PORT"),
+  IOT_CONFIG_STRING(Config, deviceId, "DEVICE_ID"),
+  IOT_CONFIG_STRING(Config, deviceName, "DEVICE_NAME"),
+  IOT_CONFIG_STRING(Config, deviceType, "DEVICE_TYPE"),
+  IOT_CONFIG_STRING(Config, staticIp, "STATIC_IP"),
+  IOT_CONFIG_STRING(Config, gateway, "GATEWAY"),
+  IOT_CONFIG_STRING(Config, subnet, "SUBNET"),
+  IOT_CONFIG_REMOTE_FLOAT(Config, deadbandTemp, "DEADBAND_TEMP"),
+  IOT_CONFIG_REMOTE_FLOAT(Config, deadbandHumidity, "DEADBAND_HUM"),
+  IOT_CONFIG_REMOTE_FLOAT(Config, deadbandDistance, "DEADBAND_DIST"),
+  IOT_CONFIG_REMOTE_INT(Config, deadbandLight, "DEADBAND_LIGHT"),
+  IOT_CONFIG_REMOTE_UINT(Config, maxSilenceMs, "MAX_SILENCE_MS"),
+  IOT_CONFIG_INT(Config, mqttPort, "MQTT_PORT"),
+  IOT_CONFIG_REMOTE_UINT(Config, sensorIntervalMs, "SENSOR_INTERVAL_MS"),
+  IOT_CONFIG_REMOTE_UINT(Config, sendIntervalMs, "SEND_INTERVAL_MS"),
+  IOT_CONFIG_REMOTE_UINT(Config, buzzerPollMs, "BUZZER_POLL_MS"),
+  IOT_CONFIG_REMOTE_UINT(Config, batchFlushMs, "BATCH_FLUSH_MS"),
+  IOT_CONFIG_REMOTE_UINT(Config, configVersion, "CONFIG_VERSION"),
+};
+iot::ConfigStore<Device, Config> configStore(CONFIG_FIELDS, defaultConfig);
+
+// Patches advertised on buzzer-poll and heartbeat responses; fetched and
+// applied by networkTask
+iot::RemoteConfig<Device, Config> remoteConfig(configStore, config, &Config::configVersion);
+
+#if OTA_ENABLED
+// A new image boots on probation and is kept once it has registered with
+// the backend; until then the bootloader can still go back
+extern "C" bool verifyRollbackLater() { return true; }
+iot::OtaUpdater<Device> ota(OTA_CHANNEL);
+#endif
+
+// The connection manager re-reads these on every join
+const iot::WifiSettings wifiSettings = {
+  config.wifiSsid, config.wifiPassword, config.staticIp, config.gateway, config.subnet
+};
+
+// Backend address for every request, filled in by buildRequestPaths()
+iot::HttpTarget serverTarget = { "", 0, "", NULL };
+
 // --- REMOVED --- State machine and related timing variables for the complex buzzer pattern
 
+// Task handles and shared-state lock (sensor values are written by the loop
+// and read by the network task)
+TaskHandle_t networkTaskHandle = NULL;
+TaskHandle_t buzzerTaskHandle = NULL;
+portMUX_TYPE sensorMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Interrupt-timed HC-SR04 echo
+volatile unsigned long echoRiseUs = 0;
+volatile unsigned long echoFallUs = 0;
+volatile bool echoComplete = false;
+bool pingPending = false;
+unsigned long pingStartedUs = 0;
+
+// Median-of-N ping sequence, one per sensor cycle
+float pingResults[ULTRASONIC_PINGS];
+uint8_t pingsValid = 0;
+uint8_t pingsRemaining = 0;
+unsigned long nextPingAt = 0;
+
+// LDR oversampling: frames accumulate into the current window, which is
+// closed into lightMean/Min/Max once per sensor cycle
+struct LightWindow {
+  uint32_t sum;
+  uint32_t count;
+  uint16_t min;
+  uint16_t max;
+};
+LightWindow lightWindow = {0, 0, UINT16_MAX, 0};
+int32_t lightEmaQ4 = -1;  // EMA in 1/16 ADC counts; -1 until the first frame
+bool lightContinuous = false;  // ADC continuous mode is running
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+volatile bool adcFrameReady = false;
+#endif
+
 // Sensor variables
 unsigned long lastSensorRead = 0;
-const unsigned long sensorInterval = 2000;  // Read sensors every 2 seconds
 DHT dht(DHT_PIN, DHT_TYPE);  // Initialize DHT sensor
 
 // Timing for backend communication
 unsigned long lastSendMillis = 0;
-const unsigned long sendInterval = 1000;   // Send data every 250 miliseconds
 bool deviceRegistered = false;
+unsigned long lastRegisterAttempt = 0;
 
 // Buzzer enable/disable flag (set to false to mute buzzer)
 bool buzzerEnabled = true;
 
 // Buzzer control variables
 bool buzzerActive = false;
-String buzzerRequestId = "";
+char buzzerRequestId[24] = "";
 unsigned long lastBuzzerPoll = 0;
-const unsigned long singleBeepDuration = 250; // How long a single beep should be (in ms)
+
+const iot::BuzzerStep SINGLE_BEEP_STEPS[] = { {iot::BUZZER_DC, 250} };
+const iot::BuzzerPattern SINGLE_BEEP = IOT_BUZZER_PATTERN(SINGLE_BEEP_STEPS, 1);
+
+// Plays patterns from a timer; the only code touching the buzzer pin once up
+iot::BuzzerEngine<Device> buzzer;
 
 // Global sensor variables for backend sending
-float distance = 0.0;
+float distance = 0.0;      // Median of the last ping sequence
 float temperature = 0.0;
 float humidity = 0.0;
-int lightLevel = 0;
+int lightLevel = 0;        // EMA-filtered
+
+// Per-cycle aggregates behind the filtered values above
+float distanceMin = NAN;
+float distanceMax = NAN;
+uint16_t lightMean = 0;
+uint16_t lightMin = 0;
+uint16_t lightMax = 0;
+
+// One packed sample as sent on the wire (little-endian, see the backend's
+// sensorBatch.js). Fixed-point keeps it at 24 bytes.
+struct __attribute__((packed)) SensorSample {
+  uint32_t sampledAt;    // millis()
+  int16_t temperature;   // 0.01 °C
+  uint16_t humidity;     // 0.01 %
+  uint16_t distance;     // 0.1 cm, median of the cycle's pings
+  uint16_t lightLevel;   // ADC counts, EMA-filtered
+  uint16_t lightMean;    // ADC counts over the cycle
+  uint16_t lightMin;
+  uint16_t lightMax;
+  uint16_t distanceMin;  // 0.1 cm over the cycle's pings
+  uint16_t distanceMax;
+  uint8_t valid;         // SAMPLE_VALID_* bits
+  uint8_t reserved;
+};
+static_assert(sizeof(SensorSample) == 24, "SensorSample must match the backend layout");
+
+// Sample ring: sampleHead counts every sample ever written (slot = count %
+// capacity); samplesSent is how far the server has acknowledged.
+SLEEP_RETAINED SensorSample sampleRing[SENSOR_RING_CAPACITY];
+SLEEP_RETAINED volatile uint32_t sampleHead = 0;
+SLEEP_RETAINED uint32_t samplesSent = 0;
+SLEEP_RETAINED uint32_t samplesDropped = 0;
+
+// Last reported readings; deadbands are measured against these. Each mode
+// has one owner: recordSample() on the loop core with SENSOR_BATCH_MODE,
+// sendSensorData() on the network task without it.
+SLEEP_RETAINED float reportedTemperature = NAN;
+SLEEP_RETAINED float reportedHumidity = NAN;
+SLEEP_RETAINED float reportedDistance = NAN;
+SLEEP_RETAINED int reportedLightLevel = -1;
+SLEEP_RETAINED uint32_t lastReportAt = 0;  // deviceMillis()
+SLEEP_RETAINED uint32_t samplesSuppressed = 0;
+
+// Last good association; RTC memory keeps it across deep sleep and the
+// connection manager mirrors it to Preferences across power cycles
+RTC_DATA_ATTR iot::WifiCache wifiCache = {};
+iot::WifiManager<Device> wifi(wifiCache);
+
+// Phase timings, one histogram each (iot::PhaseMetrics)
+enum MetricId { METRIC_SENSORS, METRIC_CONNECT, METRIC_SEND, METRIC_POLL, METRIC_LOOP, METRIC_COUNT };
+const char* const METRIC_NAMES[METRIC_COUNT] = { "sensors", "connect", "send", "poll", "loop" };
+
+iot::MetricsFor<Device, METRIC_COUNT> metrics;  // Empty when METRICS_ENABLED is 0
+unsigned long lastMetricsReport = 0;
+
+// Duty-cycle bookkeeping across deep sleeps
+RTC_DATA_ATTR uint32_t wakeCount = 0;
+RTC_DATA_ATTR bool registeredBeforeSleep = false;
+
+// Bump allocator over a fixed buffer for ArduinoJson, so documents never
+// touch the heap. Call reset() before building each document; when the
+// arena runs out the document reports overflowed() instead of allocating.
+template <size_t N>
+class JsonArena : public ArduinoJson::Allocator {
+ public:
+  void reset() { used = 0; last = nullptr; }
+
+  void* allocate(size_t size) override {
+    size_t start = align(used);
+    if (start + sizeof(size_t) + size > N) return nullptr;
+    memcpy(buffer + start, &size, sizeof(size_t));
+    last = buffer + start + sizeof(size_t);
+    used = start + sizeof(size_t) + size;
+    return last;
+  }
+
+  void deallocate(void* ptr) override {
+    // Only the newest block can be given back; the rest go on reset()
+    if (ptr && ptr == last) {
+      used = (uint8_t*)ptr - sizeof(size_t) - buffer;
+      last = nullptr;
+    }
+  }
+
+  void* reallocate(void* ptr, size_t newSize) override {
+    if (!ptr) return allocate(newSize);
+    size_t oldSize;
+    memcpy(&oldSize, (uint8_t*)ptr - sizeof(size_t), sizeof(size_t));
+    if (ptr == last) {
+      // Grow or shrink the newest block in place
+      size_t start = (uint8_t*)ptr - buffer;
+      if (start + newSize > N) return nullptr;
+      memcpy((uint8_t*)ptr - sizeof(size_t), &newSize, sizeof(size_t));
+      used = start + newSize;
+      return ptr;
+    }
+    if (newSize <= oldSize) return ptr;
+    void* moved = allocate(newSize);
+    if (moved) memcpy(moved, ptr, oldSize);
+    return moved;
+  }
+
+ private:
+  static size_t align(size_t n) { return (n + 7) & ~(size_t)7; }
+  alignas(8) uint8_t buffer[N];
+  size_t used = 0;
+  void* last = nullptr;
+};
+
+// One keep-alive connection plus its scratch buffers. Each task owns one, so
+// requests never share a socket and nothing is allocated per request.
+struct HttpConnection {
+  iot::HttpClient<HTTP_HEADER_BUFFER, HTTP_RESPONSE_BUFFER> http;
+  JsonArena<JSON_ARENA_BYTES> json;
+};
+
+HttpConnection networkHttp;   // networkTask (and setup, before the tasks start)
+HttpConnection buzzerHttp;    // buzzerTask
+
+// Request paths that embed the device ID, built once after loadConfig()
+char buzzerStatusPath[96];
+char buzzerCompletePath[96];
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT
+iot::MqttClient<Device> mqtt;
+char mqttBatchTopic[72];      // <prefix>/<deviceId>/sensors/batch
+char mqttCommandTopic[72];    // <prefix>/<deviceId>/buzzer/command
+char mqttCompleteTopic[72];   // <prefix>/<deviceId>/buzzer/complete
+
+// Buzzer command handed over from the MQTT task to networkTask
+char pendingCommandId[24] = "";
+portMUX_TYPE commandMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
 
 // --- FUNCTION PROTOTYPES (Forward Declarations) ---
-void pollBuzzerStatus();
-void activateBuzzer(String requestId);
+bool pollBuzzerStatus();
+void activateBuzzer(const char* requestId);
 void deactivateBuzzer();
+void sendBuzzerCompletion(const char* requestId);
+void onMqttMessage(const char* topic, size_t topicLen, const char* data, size_t len);
+void serviceBuzzerCommand();
 void loadConfig();
-void saveConfig();
-void checkForConfigUpdate();
-void connectToWifi();
+void applyTuning();
+uint32_t deviceMillis();
+void runDutyCycle();
+void enterDeepSleep();
 void registerDevice();
 void sendSensorData();
+void sendSensorBatch();
+void recordSample(bool distanceValid);
+bool shouldReport(float t, float h, float d, int light);
+void markReported(float t, float h, float d, int light);
 void readSensors();
-float readDistanceSensor();
+void startDistancePing();
+void serviceDistancePing();
+void finishDistanceSequence();
+void startLightSampler();
+void serviceLightSampler();
+void closeLightWindow();
+void networkTask(void* param);
+void buzzerTask(void* param);
+void IRAM_ATTR onEchoEdge();
+void buildRequestPaths();
+int httpRequest(HttpConnection& conn, const char* method, const char* path,
+                const char* contentType, const uint8_t* body, size_t bodyLen,
+                const char* extraHeaders, unsigned long timeoutMs);
+void sendHeartbeat();
 
 
 // =================================================================
@@ -96,6 +477,8 @@ void setup() {
   pinMode(TRIG_PIN, OUTPUT);
   pinMode(ECHO_PIN, INPUT);
   digitalWrite(BUZZER_PIN, LOW);
+  buzzer.begin();
+  attachInterrupt(digitalPinToInterrupt(ECHO_PIN), onEchoEdge, CHANGE);
   Serial.begin(921600);  // Initialize serial for debugging
   
   Serial.println("\n=== ESP32 IoT Sensor System ===");
@@ -106,14 +489,35 @@ void setup() {
   
   // Load configuration from flash memory
   loadConfig();
+  buildRequestPaths();
+#if OTA_ENABLED
+  ota.begin();
+#endif
   
   dht.begin();  // Start DHT sensor
+  startLightSampler();
+
+#if POWER_PROFILE_DUTY_CYCLE
+  runDutyCycle(); // Samples, maybe uploads, then deep-sleeps; never returns
+#endif
   
-  // Connect to WiFi
-  connectToWifi();
-  
-  // Register device with backend
-  registerDevice();
+  // Start joining WiFi; networkTask registers the device once the link is up
+  wifi.begin(wifiSettings);
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT
+  // The client connects by itself once the link is up, and after every drop
+  mqtt.subscribe(mqttCommandTopic, 1);
+  mqtt.begin(config.serverIp, (uint16_t)config.mqttPort, config.deviceId, onMqttMessage, MQTT_KEEPALIVE_S);
+#endif
+
+  // All HTTP traffic runs in its own task so the loop never waits on the network
+  xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, NULL, 1,
+                          &networkTaskHandle, NETWORK_TASK_CORE);
+#if BUZZER_LONG_POLL_MS > 0 && TRANSPORT_MODE == TRANSPORT_HTTP
+  // The long-poll holds its connection open, so it gets a task of its own
+  xTaskCreatePinnedToCore(buzzerTask, "buzzer", BUZZER_TASK_STACK, NULL, 1,
+                          &buzzerTaskHandle, NETWORK_TASK_CORE);
+#endif
   
   Serial.println("System ready!");
 }
@@ -121,32 +525,115 @@ void setup() {
 // =================================================================
 // --- MAIN LOOP ---
 // =================================================================
+// The loop only handles local work (serial config, sensors); buzzer polling
+// and data upload run in networkTask() on the other core.
 void loop() {
   unsigned long currentMillis = millis();
-  
-  // Handle buzzer status polling
-  if (currentMillis - lastBuzzerPoll >= BUZZER_POLL_INTERVAL) {
-    pollBuzzerStatus();
-    lastBuzzerPoll = currentMillis;
+
+  // Loop period; its spread is the sensor loop's jitter
+  static uint32_t lastLoopCycles = 0;
+  uint32_t loopCycles = metrics.start();
+  if (lastLoopCycles != 0) {
+    metrics.recordCycles(METRIC_LOOP, loopCycles - lastLoopCycles);
   }
+  lastLoopCycles = loopCycles;
   
   // Handle configuration updates via Serial
-  checkForConfigUpdate();
+  configStore.serviceConsole(config);
+
+  // Rejoin WiFi in the background after a drop
+  wifi.service();
   
   // Handle sensor reading (non-blocking)
-  if (currentMillis - lastSensorRead >= sensorInterval) {
+  if (currentMillis - lastSensorRead >= config.sensorIntervalMs) {
     readSensors(); // This will update global sensor variables
     lastSensorRead = currentMillis;
   }
-  
-  // Handle data sending (non-blocking)
-  if (currentMillis - lastSendMillis >= sendInterval) {
-    sendSensorData();
-    lastSendMillis = currentMillis;
+
+  // Pick up the ultrasonic echo once the interrupt has timed it
+  serviceDistancePing();
+
+  // Fold in any LDR samples taken since the last pass
+  serviceLightSampler();
+
+  delay(1); // Yield to the idle task
+}
+
+// =================================================================
+// --- NETWORK TASK ---
+// =================================================================
+// Runs the sensor upload cadence (and the short buzzer poll when long-polling
+// is off). Each request is bounded by HTTP_TIMEOUT_MS, and nothing here blocks
+// the sensor loop.
+void networkTask(void* param) {
+  for (;;) {
+    unsigned long currentMillis = millis();
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT
+    serviceBuzzerCommand();
+#elif BUZZER_LONG_POLL_MS == 0
+    // Handle buzzer status polling
+    if (currentMillis - lastBuzzerPoll >= config.buzzerPollMs) {
+      lastBuzzerPoll = currentMillis;
+      pollBuzzerStatus();
+    }
+#endif
+
+    // Handle data sending
+#if SENSOR_BATCH_MODE
+    if (sampleHead - samplesSent >= SENSOR_BATCH_MAX ||
+        currentMillis - lastSendMillis >= config.batchFlushMs) {
+      lastSendMillis = currentMillis;
+      sendSensorBatch();
+    }
+#else
+    if (currentMillis - lastSendMillis >= config.sendIntervalMs) {
+      lastSendMillis = currentMillis;
+      sendSensorData();
+    }
+#endif
+
+    // Register as soon as the link is up, then retry until it succeeds
+    if (!deviceRegistered && wifi.up() &&
+        (lastRegisterAttempt == 0 || currentMillis - lastRegisterAttempt >= REGISTER_RETRY_INTERVAL)) {
+      lastRegisterAttempt = currentMillis;
+      registerDevice();
+    }
+
+#if METRICS_ENABLED
+    if (deviceRegistered && currentMillis - lastMetricsReport >= METRICS_REPORT_INTERVAL_MS) {
+      lastMetricsReport = currentMillis;
+      sendHeartbeat();
+    }
+#endif
+
+    // A config patch advertised by the backend
+    if (deviceRegistered && remoteConfig.service(networkHttp.http, serverTarget, HTTP_TIMEOUT_MS)) {
+      applyTuning();
+    }
+
+#if OTA_ENABLED
+    if (ota.onProbation() && deviceRegistered) {
+      ota.confirm(); // The new image reached the backend
+    }
+    // Swap once the beep is over; samples not yet sent are lost with RAM
+    if (ota.service(serverTarget, HTTP_TIMEOUT_MS) && !buzzer.playing()) {
+      ota.restart();
+    }
+#endif
+
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+}
+
+// Keeps one long-poll parked on the server at all times; a buzzer request
+// comes back as soon as it is created instead of on the next 150 ms poll.
+void buzzerTask(void* param) {
+  for (;;) {
+    if (!pollBuzzerStatus()) {
+      vTaskDelay(pdMS_TO_TICKS(BUZZER_RETRY_INTERVAL));
+    }
   }
-  
-  // --- REMOVED --- The buzzer state machine is no longer needed in the main loop.
-  // The entire buzzer logic is now handled within pollBuzzerStatus() and activateBuzzer().
 }
 
 // =================================================================
@@ -155,157 +642,74 @@ void loop() {
 
 // --- Configuration Functions ---
 void loadConfig() {
-  preferences.begin("config", false);
-  
-  // Load configuration or use defaults (.env style)
-  strlcpy(config.wifiSsid, preferences.getString("WIFI_SSID", defaultConfig.wifiSsid).c_str(), sizeof(config.wifiSsid));
-  strlcpy(config.wifiPassword, preferences.getString("WIFI_PASSWORD", defaultConfig.wifiPassword).c_str(), sizeof(config.wifiPassword));
-  strlcpy(config.serverIp, preferences.getString("SERVER_IP", defaultConfig.serverIp).c_str(), sizeof(config.serverIp));
-  config.serverPort = preferences.getInt("SERVER_PORT", defaultConfig.serverPort);
-  strlcpy(config.deviceId, preferences.getString("DEVICE_ID", defaultConfig.deviceId).c_str(), sizeof(config.deviceId));
-  strlcpy(config.deviceName, preferences.getString("DEVICE_NAME", defaultConfig.deviceName).c_str(), sizeof(config.deviceName));
-  strlcpy(config.deviceType, preferences.getString("DEVICE_TYPE", defaultConfig.deviceType).c_str(), sizeof(config.deviceType));
-  
-  preferences.end();
-  
+  configStore.load(config);
+  applyTuning();
+
   // Print loaded configuration
   Serial.println("=== Configuration Loaded ===");
-  Serial.printf("WIFI_SSID=%s\n", config.wifiSsid);
-  Serial.printf("WIFI_PASSWORD=%s\n", config.wifiPassword);
-  Serial.printf("SERVER_IP=%s\n", config.serverIp);
-  Serial.printf("SERVER_PORT=%d\n", config.serverPort);
-  Serial.printf("DEVICE_ID=%s\n", config.deviceId);
-  Serial.printf("DEVICE_NAME=%s\n", config.deviceName);
-  Serial.printf("DEVICE_TYPE=%s\n", config.deviceType);
+  configStore.print(config);
   Serial.println("============================");
 }
 
-void saveConfig() {
-  preferences.begin("config", false);
-  
-  preferences.putString("WIFI_SSID", config.wifiSsid);
-  preferences.putString("WIFI_PASSWORD", config.wifiPassword);
-  preferences.putString("SERVER_IP", config.serverIp);
-  preferences.putInt("SERVER_PORT", config.serverPort);
-  preferences.putString("DEVICE_ID", config.deviceId);
-  preferences.putString("DEVICE_NAME", config.deviceName);
-  preferences.putString("DEVICE_TYPE", config.deviceType);
-  
-  preferences.end();
-  Serial.println("Configuration saved to flash memory!");
-}
-
-void checkForConfigUpdate() {
-  if (Serial.available()) {
-    String input = Serial.readStringUntil('\n');
-    input.trim();
-    
-    if (input == "CONFIG") {
-      // Display current configuration
-      Serial.println("\n=== Current Configuration ===");
-      Serial.printf("WIFI_SSID=%s\n", config.wifiSsid);
-      Serial.printf("WIFI_PASSWORD=%s\n", config.wifiPassword);
-      Serial.printf("SERVER_IP=%s\n", config.serverIp);
-      Serial.printf("SERVER_PORT=%d\n", config.serverPort);
-      Serial.printf("DEVICE_ID=%s\n", config.deviceId);
-      Serial.printf("DEVICE_NAME=%s\n", config.deviceName);
-      Serial.printf("DEVICE_TYPE=%s\n", config.deviceType);
-      Serial.println("============================\n");
-      
-    } else if (input == "RESET") {
-      // Reset to defaults
-      memcpy(&config, &defaultConfig, sizeof(Config));
-      saveConfig();
-      Serial.println("Configuration reset to defaults. Restarting...");
-      delay(1000);
-      ESP.restart();
-      
-    } else if (input.startsWith("SET ")) {
-      // Parse SET command: SET WIFI_SSID=MyWiFi
-      String command = input.substring(4);
-      int equals = command.indexOf('=');
-      if (equals != -1) {
-        String key = command.substring(0, equals);
-        String value = command.substring(equals + 1);
-        
-        bool updated = false;
-        if (key == "WIFI_SSID") {
-          strlcpy(config.wifiSsid, value.c_str(), sizeof(config.wifiSsid));
-          updated = true;
-        } else if (key == "WIFI_PASSWORD") {
-          strlcpy(config.wifiPassword, value.c_str(), sizeof(config.wifiPassword));
-          updated = true;
-        } else if (key == "SERVER_IP") {
-          strlcpy(config.serverIp, value.c_str(), sizeof(config.serverIp));
-          updated = true;
-        } else if (key == "SERVER_PORT") {
-          config.serverPort = value.toInt();
-          updated = true;
-        } else if (key == "DEVICE_ID") {
-          strlcpy(config.deviceId, value.c_str(), sizeof(config.deviceId));
-          updated = true;
-        } else if (key == "DEVICE_NAME") {
-          strlcpy(config.deviceName, value.c_str(), sizeof(config.deviceName));
-          updated = true;
-        } else if (key == "DEVICE_TYPE") {
-          strlcpy(config.deviceType, value.c_str(), sizeof(config.deviceType));
-          updated = true;
-        }
-        
-        if (updated) {
-          saveConfig();
-          Serial.printf("Updated %s=%s\n", key.c_str(), value.c_str());
-          Serial.println("Send 'RESTART' to apply WiFi changes or they will apply on next boot.");
-        } else {
-          Serial.printf("Unknown configuration key: %s\n", key.c_str());
-        }
-      }
-    } else if (input == "RESTART") {
-      Serial.println("Restarting ESP32...");
-      delay(1000);
-      ESP.restart();
-    }
-  }
+// Keeps the cadence settings in ranges the node can run at, whether they
+// came from Preferences, the console or a backend patch. The loop and
+// networkTask read them live, so nothing else needs restarting.
+void applyTuning() {
+  config.sensorIntervalMs = constrain(config.sensorIntervalMs, (uint32_t)1000, (uint32_t)3600000); // DHT11: 1 read/s at most
+  config.sendIntervalMs = constrain(config.sendIntervalMs, (uint32_t)100, (uint32_t)3600000);
+  config.buzzerPollMs = constrain(config.buzzerPollMs, (uint32_t)50, (uint32_t)60000);
+  config.batchFlushMs = constrain(config.batchFlushMs, (uint32_t)1000, (uint32_t)3600000);
+  LOG_I("[Config] Sensors every %u ms, send every %u ms, buzzer poll %u ms, batch flush %u ms\n",
+        (unsigned)config.sensorIntervalMs, (unsigned)config.sendIntervalMs,
+        (unsigned)config.buzzerPollMs, (unsigned)config.batchFlushMs);
 }
 
 // --- Sensor Functions ---
 void readSensors() {
-  // Read and print distance with timestamp
-  distance = readDistanceSensor(); // Assign to global variable
-  Serial.print("[");
-  Serial.print(millis());
-  Serial.print("] Distance: ");
-  Serial.print(distance);
-  Serial.println(" cm");
+  uint32_t started = metrics.start();
+
+  // Start a ping sequence; serviceDistancePing() runs it and records the sample
+  pingsRemaining = ULTRASONIC_PINGS;
+  pingsValid = 0;
+  nextPingAt = millis();
   
   // Read and print temperature and humidity with timestamp
-  temperature = dht.readTemperature(); // Assign to global variable
-  humidity = dht.readHumidity();    // Assign to global variable
-  Serial.print("[");
-  Serial.print(millis());
-  Serial.print("] ");
-  
+  float newTemperature = dht.readTemperature();
+  float newHumidity = dht.readHumidity();
+  closeLightWindow();
+
+  portENTER_CRITICAL(&sensorMux);
+  temperature = newTemperature; // Assign to global variables
+  humidity = newHumidity;
+  lightLevel = lightEmaQ4 < 0 ? 0 : lightEmaQ4 >> 4;
+  portEXIT_CRITICAL(&sensorMux);
+  metrics.end(METRIC_SENSORS, started);
+
   if (!isnan(temperature)) {
-    Serial.print("Temperature: ");
-    Serial.print(temperature);
-    Serial.println(" °C");
+    LOG_D("[%lu] Temperature: %.2f °C\n", millis(), temperature);
   }
-  
   if (!isnan(humidity)) {
-    Serial.print("Humidity: ");
-    Serial.print(humidity);
-    Serial.println(" %");
+    LOG_D("[%lu] Humidity: %.2f %%\n", millis(), humidity);
   }
-  
-  // Read and print light level with timestamp
-  lightLevel = analogRead(LDR_PIN); // Assign to global variable
-  Serial.print("[");
-  Serial.print(millis());
-  Serial.print("] Light Level: ");
-  Serial.println(lightLevel);
+  LOG_D("[%lu] Light Level: %d (mean %u, min %u, max %u)\n",
+        millis(), lightLevel, lightMean, lightMin, lightMax);
 }
 
-float readDistanceSensor() {
+// Echo pin ISR: timestamps both edges so the pulse is measured without busy-waiting.
+void IRAM_ATTR onEchoEdge() {
+  unsigned long now = micros();
+  if (digitalRead(ECHO_PIN) == HIGH) {
+    echoRiseUs = now;
+  } else if (echoRiseUs != 0) {
+    echoFallUs = now;
+    echoComplete = true;
+  }
+}
+
+void startDistancePing() {
+  echoRiseUs = 0;
+  echoComplete = false;
+
   // Clear the trigger
   digitalWrite(TRIG_PIN, LOW);
   delayMicroseconds(2);
@@ -314,128 +718,333 @@ float readDistanceSensor() {
   digitalWrite(TRIG_PIN, HIGH);
   delayMicroseconds(10);
   digitalWrite(TRIG_PIN, LOW);
-  
-  // Measure pulse duration on echo pin
-  long duration = pulseIn(ECHO_PIN, HIGH);
-  
-  // Calculate distance in cm (speed of sound = 0.034 cm/µs)
-  return duration * 0.034 / 2;
+
+  pingStartedUs = micros();
+  pingPending = true;
 }
 
-// --- Buzzer Control Functions ---
-void pollBuzzerStatus() {
-  if (WiFi.status() != WL_CONNECTED) return;
+// Runs the cycle's ping sequence: one ping at a time, ULTRASONIC_PING_GAP_MS
+// apart, then the median of the echoes that came back.
+void serviceDistancePing() {
+  if (!pingPending) {
+    if (pingsRemaining > 0 && (long)(millis() - nextPingAt) >= 0) {
+      pingsRemaining--;
+      startDistancePing();
+    }
+    return;
+  }
 
-  HTTPClient http;
-  String url = "http://" + String(config.serverIp) + ":" + String(config.serverPort) +
-               "/api/v1/buzzer/status/" + String(config.deviceId);
-  http.begin(url);
-  
-  int httpCode = http.GET();
-  if (httpCode == HTTP_CODE_OK) {
-    String payload = http.getString();
-    JsonDocument doc;
-    deserializeJson(doc, payload);
-    
-    String status = doc["status"];
-    String requestId = doc["requestId"];
-    
-    if (status == "pending" && !buzzerActive) {
-      activateBuzzer(requestId);
-    } else if (status != "pending" && buzzerActive) {
-      deactivateBuzzer();
+  if (echoComplete) {
+    pingPending = false;
+    unsigned long duration = echoFallUs - echoRiseUs;
+
+    // Calculate distance in cm (speed of sound = 0.034 cm/µs)
+    pingResults[pingsValid++] = duration * 0.034 / 2;
+  } else if (micros() - pingStartedUs > ECHO_TIMEOUT_US) {
+    // No echo (nothing in range or sensor unplugged)
+    pingPending = false;
+  } else {
+    return;
+  }
+
+  nextPingAt = millis() + ULTRASONIC_PING_GAP_MS;
+  if (pingsRemaining == 0) {
+    finishDistanceSequence();
+  }
+}
+
+void finishDistanceSequence() {
+  if (pingsValid == 0) {
+    // Keep the last reading, but report the channel as missing
+    LOG_D("[%lu] Distance: no echo\n", millis());
+    recordSample(false);
+    return;
+  }
+
+  // Insertion sort; N is tiny
+  for (uint8_t i = 1; i < pingsValid; i++) {
+    float v = pingResults[i];
+    int8_t j = i - 1;
+    while (j >= 0 && pingResults[j] > v) {
+      pingResults[j + 1] = pingResults[j];
+      j--;
     }
+    pingResults[j + 1] = v;
+  }
+  float median = pingsValid % 2 ? pingResults[pingsValid / 2]
+                                : (pingResults[pingsValid / 2 - 1] + pingResults[pingsValid / 2]) / 2;
+
+  portENTER_CRITICAL(&sensorMux);
+  distance = median;
+  portEXIT_CRITICAL(&sensorMux);
+  distanceMin = pingResults[0];
+  distanceMax = pingResults[pingsValid - 1];
+
+  LOG_D("[%lu] Distance: %.1f cm (min %.1f, max %.1f, %u/%u echoes)\n",
+        millis(), median, distanceMin, distanceMax, pingsValid, ULTRASONIC_PINGS);
+  recordSample(true);
+}
+
+// --- LDR oversampling ---
+// On core 3.x the ADC runs in continuous (DMA) mode and the driver hands us
+// one averaged frame per LDR_CONVERSIONS_PER_FRAME conversions. Older cores
+// fall back to one analogRead() per loop pass (~1 kHz).
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+void ARDUINO_ISR_ATTR onAdcFrame() {
+  adcFrameReady = true;
+}
+#endif
+
+void startLightSampler() {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  uint8_t pins[] = {LDR_PIN};
+  analogContinuousSetWidth(12);
+  analogContinuousSetAtten(ADC_11db);
+  if (analogContinuous(pins, 1, LDR_CONVERSIONS_PER_FRAME, LDR_SAMPLE_RATE_HZ, &onAdcFrame) &&
+      analogContinuousStart()) {
+    lightContinuous = true;
+    LOG_I("[Sampler] LDR continuous ADC at %d Hz\n", LDR_SAMPLE_RATE_HZ);
   } else {
-    Serial.print("[");
-    Serial.print(millis());
-    Serial.print("] Buzzer status polling failed. Error: ");
-    Serial.println(http.errorToString(httpCode).c_str());
+    LOG_W("[Sampler] Continuous ADC unavailable, using analogRead()\n");
+  }
+#endif
+}
+
+void addLightSample(uint16_t value) {
+  lightWindow.sum += value;
+  lightWindow.count++;
+  if (value < lightWindow.min) lightWindow.min = value;
+  if (value > lightWindow.max) lightWindow.max = value;
+
+  // Fixed-point EMA: ema += (x - ema) / 2^LDR_EMA_SHIFT, in 1/16 counts
+  int32_t sample = (int32_t)value << 4;
+  if (lightEmaQ4 < 0) {
+    lightEmaQ4 = sample;
+  } else {
+    lightEmaQ4 += (sample - lightEmaQ4) >> LDR_EMA_SHIFT;
+  }
+}
+
+void serviceLightSampler() {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  if (lightContinuous) {
+    if (adcFrameReady) {
+      adcFrameReady = false;
+      adc_continuous_data_t* result = NULL;
+      if (analogContinuousRead(&result, 0)) {
+        addLightSample((uint16_t)result[0].avg_read_raw);
+      }
+    }
+    return;
+  }
+#endif
+  addLightSample((uint16_t)analogRead(LDR_PIN));
+}
+
+// Publishes the window's mean/min/max and starts a new one.
+void closeLightWindow() {
+  if (lightWindow.count == 0 && !lightContinuous) {
+    addLightSample((uint16_t)analogRead(LDR_PIN)); // Never report an empty window
+  }
+  if (lightWindow.count == 0) return; // Keep the previous aggregates
+  lightMean = lightWindow.sum / lightWindow.count;
+  lightMin = lightWindow.min;
+  lightMax = lightWindow.max;
+  lightWindow = {0, 0, UINT16_MAX, 0};
+}
+
+// Appends the current readings to the sample ring. Runs once per sensor
+// cycle, after the ping sequence has resolved.
+void recordSample(bool distanceValid) {
+#if SENSOR_BATCH_MODE
+  float sampleDistance = distanceValid ? distance : NAN;
+  if (!shouldReport(temperature, humidity, sampleDistance, lightLevel)) {
+    samplesSuppressed++;
+    return;
+  }
+  markReported(temperature, humidity, sampleDistance, lightLevel);
+#endif
+
+  SensorSample sample = {};
+  sample.sampledAt = deviceMillis();
+  if (!isnan(temperature)) {
+    sample.temperature = (int16_t)lroundf(temperature * 100);
+    sample.valid |= SAMPLE_VALID_TEMPERATURE;
   }
-  http.end();
+  if (!isnan(humidity)) {
+    sample.humidity = (uint16_t)lroundf(humidity * 100);
+    sample.valid |= SAMPLE_VALID_HUMIDITY;
+  }
+  if (distanceValid && distanceMin >= 0 && distanceMax < 6553.5f) {
+    sample.distance = (uint16_t)lroundf(distance * 10);
+    sample.distanceMin = (uint16_t)lroundf(distanceMin * 10);
+    sample.distanceMax = (uint16_t)lroundf(distanceMax * 10);
+    sample.valid |= SAMPLE_VALID_DISTANCE;
+  }
+  sample.lightLevel = (uint16_t)lightLevel;
+  sample.lightMean = lightMean;
+  sample.lightMin = lightMin;
+  sample.lightMax = lightMax;
+  sample.valid |= SAMPLE_VALID_LIGHT;
+
+  portENTER_CRITICAL(&sensorMux);
+  sampleRing[sampleHead % SENSOR_RING_CAPACITY] = sample;
+  sampleHead = sampleHead + 1;
+  portEXIT_CRITICAL(&sensorMux);
+}
+
+// True when a reading moves past its deadband, or when nothing has been
+// reported for config.maxSilenceMs (the heartbeat that keeps the device
+// showing as online). Gaining or losing a reading always counts as a change.
+bool changedBeyond(float value, float reported, float deadband) {
+  if (isnan(value) || isnan(reported)) return isnan(value) != isnan(reported);
+  return fabsf(value - reported) >= deadband;
+}
+
+bool shouldReport(float t, float h, float d, int light) {
+  if (lastReportAt == 0 || deviceMillis() - lastReportAt >= config.maxSilenceMs) return true;
+  return changedBeyond(t, reportedTemperature, config.deadbandTemp) ||
+         changedBeyond(h, reportedHumidity, config.deadbandHumidity) ||
+         changedBeyond(d, reportedDistance, config.deadbandDistance) ||
+         abs(light - reportedLightLevel) >= config.deadbandLight;
+}
+
+void markReported(float t, float h, float d, int light) {
+  reportedTemperature = t;
+  reportedHumidity = h;
+  reportedDistance = d;
+  reportedLightLevel = light;
+  lastReportAt = deviceMillis();
+}
+
+// --- Buzzer Control Functions ---
+// Returns false when the caller should back off before polling again: the
+// request failed, or the server repeated a request we already handled.
+bool pollBuzzerStatus() {
+  if (WiFi.status() != WL_CONNECTED) return false;
+
+  uint32_t started = metrics.start();
+  int httpCode = httpRequest(buzzerHttp, "GET", buzzerStatusPath, NULL, NULL, 0, "",
+                             BUZZER_LONG_POLL_MS + HTTP_TIMEOUT_MS);
+#if BUZZER_LONG_POLL_MS == 0
+  metrics.end(METRIC_POLL, started); // A long-poll's round trip is mostly waiting, not work
+#endif
+  if (httpCode != 200) {
+    LOG_W("[%lu] Buzzer status polling failed. Code: %d\n", millis(), httpCode);
+    return false;
+  }
+
+  buzzerHttp.json.reset();
+  JsonDocument doc(&buzzerHttp.json);
+  if (deserializeJson(doc, buzzerHttp.http.response())) return false;
+
+  const char* status = doc["status"] | "";
+  const char* requestId = doc["requestId"] | "";
+  remoteConfig.notice(doc["configPending"] | 0u);
+
+  bool pending = strcmp(status, "pending") == 0;
+  if (pending && strcmp(requestId, buzzerRequestId) != 0) {
+    activateBuzzer(requestId);
+  } else if (pending) {
+    return false; // Completion PATCH has not landed yet
+  } else if (buzzerActive) {
+    deactivateBuzzer();
+  }
+  return true;
 }
 
 // --- MODIFIED --- This function now performs a single, self-contained beep.
-void activateBuzzer(String requestId) {
+void activateBuzzer(const char* requestId) {
   buzzerActive = true; // Set our state to active to prevent re-triggering
-  buzzerRequestId = requestId;
+  strlcpy(buzzerRequestId, requestId, sizeof(buzzerRequestId));
   
-  Serial.print("[");
-  Serial.print(millis());
-  Serial.print("] Buzzer activated by request: ");
-  Serial.println(requestId);
+  LOG_I("[%lu] Buzzer activated by request: %s\n", millis(), buzzerRequestId);
   
-  // Perform the single beep if the buzzer is globally enabled
+  // Start the beep if the buzzer is globally enabled; the pattern engine
+  // plays it from a timer, so nothing waits for it to finish
   if (buzzerEnabled) {
-    digitalWrite(BUZZER_PIN, HIGH);
-    delay(singleBeepDuration); // Block for the beep duration - this is fine for a short, one-off event.
-    digitalWrite(BUZZER_PIN, LOW);
+    buzzer.play(SINGLE_BEEP);
   }
   
   // Immediately send completion notification to the server
-  HTTPClient http;
-  String url = "http://" + String(config.serverIp) + ":" + String(config.serverPort) +
-               "/api/v1/buzzer/complete/" + requestId;
-  http.begin(url);
-  http.addHeader("Content-Type", "application/json");
-  
-  JsonDocument doc;
-  doc["completedAt"] = millis(); // You can send any relevant data
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
-  
-  int httpCode = http.PATCH(jsonPayload);
+  sendBuzzerCompletion(buzzerRequestId);
+}
+
+void sendBuzzerCompletion(const char* requestId) {
+#if TRANSPORT_MODE == TRANSPORT_MQTT
+  // QoS1: esp-mqtt resends it until the broker acks, across reconnects
+  int msgId = mqtt.publish(mqttCompleteTopic, requestId, strlen(requestId), 1);
+  if (msgId >= 0) {
+    LOG_I("Buzzer completion queued for %s (msg %d)\n", requestId, msgId);
+  } else {
+    LOG_W("Buzzer completion failed for %s: MQTT offline\n", requestId);
+  }
+#else
+  snprintf(buzzerCompletePath, sizeof(buzzerCompletePath), "/api/v1/buzzer/complete/%s", requestId);
+  char body[40];
+  int bodyLen = snprintf(body, sizeof(body), "{\"completedAt\":%lu}", millis());
+
+  int httpCode = httpRequest(buzzerHttp, "PATCH", buzzerCompletePath, "application/json",
+                             (const uint8_t*)body, bodyLen, "", HTTP_TIMEOUT_MS);
   if (httpCode > 0) {
-    Serial.printf("Buzzer completion sent for %s. Response: %d\n", requestId.c_str(), httpCode);
+    LOG_I("Buzzer completion sent for %s. Response: %d\n", requestId, httpCode);
   } else {
-    Serial.printf("Buzzer completion failed for %s. Error: %s\n", requestId.c_str(), http.errorToString(httpCode).c_str());
+    LOG_W("Buzzer completion failed for %s. Code: %d\n", requestId, httpCode);
   }
-  http.end();
+#endif
+}
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT
+// Runs on the MQTT task: the payload is the request id. networkTask plays
+// it, so the buzzer state is only ever touched from one task.
+void onMqttMessage(const char* topic, size_t topicLen, const char* data, size_t len) {
+  if (topicLen != strlen(mqttCommandTopic) || strncmp(topic, mqttCommandTopic, topicLen) != 0) return;
+  if (len == 0 || len >= sizeof(pendingCommandId)) return;
+
+  portENTER_CRITICAL(&commandMux);
+  memcpy(pendingCommandId, data, len);
+  pendingCommandId[len] = '\0';
+  portEXIT_CRITICAL(&commandMux);
 }
 
+// A command can be delivered twice (QoS1 redelivery, or the backend resending
+// a pending request on reconnect); the request id filters repeats out
+void serviceBuzzerCommand() {
+  char requestId[sizeof(pendingCommandId)];
+  portENTER_CRITICAL(&commandMux);
+  memcpy(requestId, pendingCommandId, sizeof(requestId));
+  pendingCommandId[0] = '\0';
+  portEXIT_CRITICAL(&commandMux);
+
+  if (requestId[0] && strcmp(requestId, buzzerRequestId) != 0) {
+    activateBuzzer(requestId);
+  }
+}
+#endif
+
 // --- MODIFIED --- This function now simply resets the local state.
 void deactivateBuzzer() {
   buzzerActive = false;
-  buzzerRequestId = "";
-  digitalWrite(BUZZER_PIN, LOW); // Ensure buzzer is off, just in case.
+  buzzerRequestId[0] = '\0';
+  buzzer.stop(); // Ensure buzzer is off, just in case.
   
-  Serial.print("[");
-  Serial.print(millis());
-  Serial.println("] Buzzer state reset. Ready for next request.");
+  LOG_D("[%lu] Buzzer state reset. Ready for next request.\n", millis());
 }
 
 // --- Network Functions ---
-void connectToWifi() {
-  Serial.print("Connecting to WiFi ");
-  Serial.print(config.wifiSsid);
-  WiFi.begin(config.wifiSsid, config.wifiPassword);
-  int retries = 0;
-  while (WiFi.status() != WL_CONNECTED && retries < 30) {
-    delay(500);
-    Serial.print(".");
-    retries++;
-  }
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected!");
-    Serial.print("IP Address: ");
-    Serial.println(WiFi.localIP());
-  } else {
-    Serial.println("\nFailed to connect. Please check credentials and restart.");
-  }
-}
-
 void registerDevice() {
   if (WiFi.status() != WL_CONNECTED) return;
-  
-  HTTPClient http;
-  String serverUrl = "http://" + String(config.serverIp) + ":" + String(config.serverPort) + "/api/v1/devices/register";
-  http.begin(serverUrl);
-  http.addHeader("Content-Type", "application/json");
 
-  JsonDocument doc;
+  char ipAddress[16];
+  IPAddress ip = WiFi.localIP();
+  snprintf(ipAddress, sizeof(ipAddress), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+  networkHttp.json.reset();
+  JsonDocument doc(&networkHttp.json);
   doc["id"] = config.deviceId;
   doc["name"] = config.deviceName;
   doc["type"] = config.deviceType;
-  doc["ipAddress"] = WiFi.localIP().toString();
+  doc["ipAddress"] = ipAddress;
 
   JsonArray caps = doc["capabilities"].to<JsonArray>();
   caps.add("temperature");
@@ -443,65 +1052,324 @@ void registerDevice() {
   caps.add("distance");
   caps.add("lightLevel");
 
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+  static char jsonPayload[320];
+  size_t payloadLen = serializeJson(doc, jsonPayload, sizeof(jsonPayload));
 
-  int httpCode = http.POST(jsonPayload);
-  Serial.print("Registering device... ");
+  int httpCode = httpRequest(networkHttp, "POST", "/api/v1/devices/register", "application/json",
+                             (const uint8_t*)jsonPayload, payloadLen, "", HTTP_TIMEOUT_MS);
   if (httpCode > 0) {
-    Serial.printf("Response: %d\n", httpCode);
+    LOG_I("Registering device... Response: %d\n", httpCode);
     deviceRegistered = true;
   } else {
-    Serial.printf("Error: %s\n", http.errorToString(httpCode).c_str());
+    LOG_W("Registering device... Error: %d\n", httpCode);
+  }
+}
+
+// Heartbeat with the metrics window since the last one. The histograms are
+// reset even when the POST fails, so each report covers one window.
+void sendHeartbeat() {
+  if (WiFi.status() != WL_CONNECTED) return;
+
+  decltype(metrics)::Window window;
+  unsigned long windowMs = metrics.takeWindow(window);
+  unsigned long now = millis();
+
+  static char body[1024];
+  int len = snprintf(body, sizeof(body),
+      "{\"deviceId\":\"%s\",\"uptime\":%lu,\"freeHeap\":%u,\"wifiRssi\":%d,\"status\":\"online\","
+      "\"metrics\":{\"windowMs\":%lu,"
+      "\"heap\":{\"free\":%u,\"min\":%u,\"maxAlloc\":%u},"
+      "\"stack\":{\"network\":%u},"
+      "\"wifi\":{\"joins\":%u,\"disconnects\":%u},\"phases\":{",
+      config.deviceId, now, ESP.getFreeHeap(), WiFi.RSSI(), windowMs,
+      ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap(),
+      (unsigned)uxTaskGetStackHighWaterMark(NULL), // Runs on the network task
+      wifi.joins(), wifi.disconnects());
+  if (len < (int)sizeof(body)) {
+    len += metrics.formatPhases(body + len, sizeof(body) - len, METRIC_NAMES, window);
+  }
+  if (len < (int)sizeof(body)) {
+    len += snprintf(body + len, sizeof(body) - len, "}}}");
+  }
+  if (len >= (int)sizeof(body)) {
+    LOG_E("[Metrics] Heartbeat does not fit %u bytes\n", (unsigned)sizeof(body));
+    return;
+  }
+
+  int httpCode = httpRequest(networkHttp, "POST", "/api/v1/devices/heartbeat", "application/json",
+                             (const uint8_t*)body, len, "", HTTP_TIMEOUT_MS);
+  if (httpCode == 200) {
+    LOG_D("[Metrics] Heartbeat sent, %d bytes\n", len);
+    remoteConfig.noticeBody(networkHttp.http.response()); // Leads the body, so truncation keeps it
+  } else {
+    LOG_W("[Metrics] Heartbeat failed. Code: %d\n", httpCode);
+  }
+}
+
+// Posts up to SENSOR_BATCH_MAX unsent samples as one packed batch. Samples
+// stay in the ring until the server acknowledges them, so a failed POST is
+// retried on the next flush.
+void sendSensorBatch() {
+  if (WiFi.status() != WL_CONNECTED || !deviceRegistered) return;
+
+  static uint8_t batchBuffer[SENSOR_BATCH_HEADER_SIZE + SENSOR_BATCH_MAX * sizeof(SensorSample)];
+
+  portENTER_CRITICAL(&sensorMux);
+  uint32_t head = sampleHead;
+  uint32_t oldest = head > SENSOR_RING_CAPACITY ? head - SENSOR_RING_CAPACITY : 0;
+  if (samplesSent < oldest) {
+    samplesDropped += oldest - samplesSent; // Overwritten while we were offline
+    samplesSent = oldest;
+  }
+  uint32_t start = samplesSent;
+  uint8_t count = (uint8_t)min(head - start, (uint32_t)SENSOR_BATCH_MAX);
+  for (uint8_t i = 0; i < count; i++) {
+    memcpy(batchBuffer + SENSOR_BATCH_HEADER_SIZE + i * sizeof(SensorSample),
+           &sampleRing[(start + i) % SENSOR_RING_CAPACITY], sizeof(SensorSample));
+  }
+  portEXIT_CRITICAL(&sensorMux);
+
+  if (count == 0) return;
+
+  // Header: magic, version, count, then send time so the server can map
+  // each sample's millis() onto wall-clock time
+  uint32_t sentAt = deviceMillis();
+  batchBuffer[0] = 'S';
+  batchBuffer[1] = 'B';
+  batchBuffer[2] = SENSOR_BATCH_VERSION;
+  batchBuffer[3] = count;
+  memcpy(batchBuffer + 4, &sentAt, sizeof(sentAt));
+  size_t batchSize = SENSOR_BATCH_HEADER_SIZE + count * sizeof(SensorSample);
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT
+  // QoS0 has no ack: the samples count as sent once they are on the socket.
+  // Heap watermarks reach the server with the heartbeat instead of headers.
+  uint32_t started = metrics.start();
+  int resultCode = mqtt.publish(mqttBatchTopic, batchBuffer, batchSize, 0);
+  metrics.end(METRIC_SEND, started);
+  bool sent = resultCode >= 0;
+#else
+  // Heap watermarks ride along so fragmentation shows up server-side
+  char extraHeaders[96];
+  snprintf(extraHeaders, sizeof(extraHeaders),
+           "Device-FreeHeap: %u\r\nDevice-MinFreeHeap: %u\r\nDevice-MaxAllocHeap: %u\r\n",
+           ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+
+  uint32_t started = metrics.start();
+  int resultCode = httpRequest(networkHttp, "POST", "/api/v1/ingest/sensor-batch",
+                               "application/octet-stream", batchBuffer, batchSize,
+                               extraHeaders, HTTP_TIMEOUT_MS);
+  metrics.end(METRIC_SEND, started);
+  bool sent = resultCode == 200;
+#endif
+  if (sent) {
+    samplesSent = start + count;
+    LOG_D("[%lu] Sensor batch sent: %u samples, %u bytes (dropped so far: %u, unchanged: %u)\n",
+          millis(), count, (unsigned)batchSize, samplesDropped, samplesSuppressed);
+  } else {
+    LOG_W("[%lu] Error sending sensor batch. Code: %d\n", millis(), resultCode);
   }
-  http.end();
 }
 
 void sendSensorData() {
   if (WiFi.status() != WL_CONNECTED || !deviceRegistered) return;
 
+  // Snapshot the readings the loop core keeps updating
+  portENTER_CRITICAL(&sensorMux);
+  float currentTemperature = temperature;
+  float currentHumidity = humidity;
+  float currentDistance = distance;
+  int currentLightLevel = lightLevel;
+  portEXIT_CRITICAL(&sensorMux);
+
+  // Skip the POST while every reading sits inside its deadband
+  if (!shouldReport(currentTemperature, currentHumidity, currentDistance, currentLightLevel)) {
+    samplesSuppressed++;
+    return;
+  }
+  markReported(currentTemperature, currentHumidity, currentDistance, currentLightLevel);
+
   // Create JSON payload
-  JsonDocument doc;
+  networkHttp.json.reset();
+  JsonDocument doc(&networkHttp.json);
   doc["deviceId"] = config.deviceId;
   doc["timestamp"] = millis();
-  doc["temperature"] = temperature;
-  doc["humidity"] = humidity;
-  doc["distance"] = distance;
-  doc["lightLevel"] = lightLevel;
-
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
-  Serial.print("[");
-  Serial.print(millis());
-  Serial.print("] Sending payload: ");
-  Serial.println(jsonPayload);
+  doc["temperature"] = currentTemperature;
+  doc["humidity"] = currentHumidity;
+  doc["distance"] = currentDistance;
+  doc["lightLevel"] = currentLightLevel;
+  JsonObject aggregates = doc["customData"].to<JsonObject>();
+  aggregates["lightMean"] = lightMean;
+  aggregates["lightMin"] = lightMin;
+  aggregates["lightMax"] = lightMax;
+  if (!isnan(distanceMin)) {
+    aggregates["distanceMin"] = distanceMin;
+    aggregates["distanceMax"] = distanceMax;
+  }
 
-  // Send HTTP POST request
-  HTTPClient http;
-  String serverUrl = "http://" + String(config.serverIp) + ":" + String(config.serverPort) + "/api/v1/ingest/sensor-data";
-  http.begin(serverUrl);
-  http.addHeader("Content-Type", "application/json");
+  static char jsonPayload[320];
+  size_t payloadLen = serializeJson(doc, jsonPayload, sizeof(jsonPayload));
+  LOG_D("[%lu] Sending payload: %s\n", millis(), jsonPayload);
 
-  int httpResponseCode = http.POST(jsonPayload);
+  // Send HTTP POST request
+  uint32_t started = metrics.start();
+  int httpResponseCode = httpRequest(networkHttp, "POST", "/api/v1/ingest/sensor-data", "application/json",
+                                     (const uint8_t*)jsonPayload, payloadLen, "", HTTP_TIMEOUT_MS);
+  metrics.end(METRIC_SEND, started);
   if (httpResponseCode > 0) {
-    Serial.print("[");
-    Serial.print(millis());
-    Serial.print("] Sensor data sent. HTTP Response: ");
-    Serial.println(httpResponseCode);
-    
+    LOG_D("[%lu] Sensor data sent. HTTP Response: %d\n", millis(), httpResponseCode);
+
     // Log response payload if available
-    String responsePayload = http.getString();
-    if (responsePayload.length() > 0) {
-      Serial.print("[");
-      Serial.print(millis());
-      Serial.print("] Server response: ");
-      Serial.println(responsePayload);
+    if (networkHttp.http.response()[0] != '\0') {
+      LOG_D("[%lu] Server response: %s\n", millis(), networkHttp.http.response());
     }
   } else {
-    Serial.print("[");
-    Serial.print(millis());
-    Serial.print("] Error sending sensor data. Code: ");
-    Serial.println(http.errorToString(httpResponseCode).c_str());
+    LOG_W("[%lu] Error sending sensor data. Code: %d\n", millis(), httpResponseCode);
+  }
+}
+
+// =================================================================
+// --- HTTP CLIENT ---
+// =================================================================
+// Requests go through iot::HttpClient (keep-alive, no heap allocations in
+// steady state); this wrapper adds the backend address and connect timing.
+
+void buildRequestPaths() {
+  serverTarget.host = config.serverIp;
+  serverTarget.port = (uint16_t)config.serverPort;
+  serverTarget.deviceId = config.deviceId;
+
+#if BUZZER_LONG_POLL_MS > 0 && !POWER_PROFILE_DUTY_CYCLE
+  snprintf(buzzerStatusPath, sizeof(buzzerStatusPath), "/api/v1/buzzer/status/%s?wait=%d",
+           config.deviceId, BUZZER_LONG_POLL_MS);
+#else
+  snprintf(buzzerStatusPath, sizeof(buzzerStatusPath), "/api/v1/buzzer/status/%s", config.deviceId);
+#endif
+
+#if TRANSPORT_MODE == TRANSPORT_MQTT
+  snprintf(mqttBatchTopic, sizeof(mqttBatchTopic), MQTT_TOPIC_PREFIX "/%s/sensors/batch", config.deviceId);
+  snprintf(mqttCommandTopic, sizeof(mqttCommandTopic), MQTT_TOPIC_PREFIX "/%s/buzzer/command", config.deviceId);
+  snprintf(mqttCompleteTopic, sizeof(mqttCompleteTopic), MQTT_TOPIC_PREFIX "/%s/buzzer/complete", config.deviceId);
+#endif
+}
+
+// Returns the HTTP status code, or -1 on a connection, write or read failure
+// (the socket is then dropped and the next request reconnects).
+int httpRequest(HttpConnection& conn, const char* method, const char* path,
+                const char* contentType, const uint8_t* body, size_t bodyLen,
+                const char* extraHeaders, unsigned long timeoutMs) {
+  int httpCode = conn.http.request(serverTarget, method, path, contentType, body, bodyLen,
+                                   extraHeaders, timeoutMs, HTTP_TIMEOUT_MS);
+  if (conn.http.lastConnectCycles() != 0) {
+    metrics.recordCycles(METRIC_CONNECT, conn.http.lastConnectCycles());
   }
-  http.end();
-}
\ No newline at end of file
+  return httpCode;
+}
+
+// =================================================================
+// --- POWER PROFILE ---
+// =================================================================
+
+// Millisecond clock for sample timestamps and the deadband heartbeat.
+// millis() restarts on every wake from deep sleep, but the RTC-backed system
+// time keeps counting through it, so duty-cycled samples stay ordered.
+uint32_t deviceMillis() {
+#if POWER_PROFILE_DUTY_CYCLE
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint32_t)(tv.tv_sec * 1000ULL + tv.tv_usec / 1000);
+#else
+  return millis();
+#endif
+}
+
+// One wake: sample, upload on every UPLOAD_EVERY_WAKES-th wake (or at once
+// after a buzzer wake or when a batch is full), then sleep again.
+void runDutyCycle() {
+  wakeCount++;
+  bool buzzerWake = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0;
+  gpio_hold_dis((gpio_num_t)BUZZER_PIN);
+  LOG_I("[Power] Wake %u (%s)\n", wakeCount, buzzerWake ? "buzzer pin" : "timer");
+
+  // Let the DHT11 settle (the LDR window fills meanwhile), then run one
+  // normal sensor cycle; it ends in recordSample()
+  while (millis() < DHT_SETTLE_MS) {
+    serviceLightSampler();
+    delay(1);
+  }
+  readSensors();
+  while (pingsRemaining > 0 || pingPending) {
+    serviceDistancePing();
+    serviceLightSampler();
+    delay(1);
+  }
+
+  bool upload = buzzerWake || wakeCount % UPLOAD_EVERY_WAKES == 0 ||
+                sampleHead - samplesSent >= SENSOR_BATCH_MAX;
+#if OTA_ENABLED
+  // A new image that sleeps before it is confirmed is rolled back on wake
+  upload = upload || ota.onProbation();
+#endif
+  if (upload && wifi.waitFor(wifiSettings, WIFI_JOIN_TIMEOUT_MS)) {
+    deviceRegistered = registeredBeforeSleep;
+    if (!deviceRegistered) {
+      registerDevice();
+      registeredBeforeSleep = deviceRegistered;
+    }
+
+    // Drain the ring; stop on the first failure and retry next upload
+    while (deviceRegistered && sampleHead != samplesSent) {
+      uint32_t before = samplesSent;
+      sendSensorBatch();
+      if (samplesSent == before) break;
+    }
+
+#if METRICS_ENABLED
+    sendHeartbeat(); // Phase timings of this wake
+#endif
+
+    // Buzzer requests queued while asleep are picked up here, along with any
+    // config patch they advertise
+    pollBuzzerStatus();
+    if (deviceRegistered && remoteConfig.service(networkHttp.http, serverTarget, HTTP_TIMEOUT_MS)) {
+      applyTuning();
+    }
+    while (buzzer.playing()) {
+      delay(5); // Let the beep finish before the pin is held low
+    }
+
+#if OTA_ENABLED
+    if (deviceRegistered) {
+      ota.confirm();
+    }
+    // Only with the ring drained: RTC memory starts over in the new image
+    if (deviceRegistered && sampleHead == samplesSent && wakeCount % OTA_CHECK_EVERY_WAKES == 0 &&
+        ota.updateNow(serverTarget, HTTP_TIMEOUT_MS)) {
+      ota.restart();
+    }
+#endif
+  }
+
+  LOG_I("[Power] Awake %lu ms, %u samples pending\n", millis(), sampleHead - samplesSent);
+  enterDeepSleep();
+}
+
+void enterDeepSleep() {
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+
+  // Take the buzzer pin back from LEDC and hold it low so it cannot float
+  // and click while asleep
+  buzzer.end();
+  pinMode(BUZZER_PIN, OUTPUT);
+  digitalWrite(BUZZER_PIN, LOW);
+  gpio_hold_en((gpio_num_t)BUZZER_PIN);
+  gpio_deep_sleep_hold_en();
+
+  esp_sleep_enable_timer_wakeup((uint64_t)SLEEP_INTERVAL_MS * 1000ULL);
+#if BUZZER_WAKE_PIN >= 0
+  esp_sleep_enable_ext0_wakeup((gpio_num_t)BUZZER_WAKE_PIN, BUZZER_WAKE_LEVEL);
+#endif
+  Serial.flush();
+  esp_deep_sleep_start();
+}
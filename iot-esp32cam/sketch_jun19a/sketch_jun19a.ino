@@ -1,26 +1,39 @@
 /*
  * ESP32 CAM OV2640 Camera Streaming
- * Simplified to send a single HTTP POST request per frame.
+ * Sends a single HTTP POST request per frame (or a push stream or UDP
+ * datagrams, see TRANSPORT_MODE). With PIPELINE_MODE enabled, capture and upload run on
+ * separate cores so they overlap.
  */
 
-#include <WiFi.h>
 #include <HTTPClient.h>
 #include <esp_camera.h>
+#include <img_converters.h>
+#include <esp_timer.h>
+#include <time.h>
 
 // ===========================
 // Configuration Section
 // ===========================
 
-// Network Configuration
+// Network Configuration (defaults; SET KEY=VALUE over serial stores an override)
 #define WIFI_SSID "G123_967E"
 #define WIFI_PASSWORD "Ivan4321"
+#define WIFI_STATIC_IP ""              // Fixed address that skips DHCP; empty runs DHCP
+#define WIFI_GATEWAY ""
+#define WIFI_SUBNET "255.255.255.0"
+#define WIFI_FAST_CONNECT_MS 1000      // Budget for a join from the cached BSSID/channel
+#define WIFI_JOIN_TIMEOUT_MS 15000     // Budget for a full scan + DHCP join
 
 // Server Configuration
 #define SERVER_HOST "203.175.11.145"
 #define SERVER_PORT 9003
 #define SERVER_PATH "/api/v1/stream/fast"  // Use the high-performance endpoint
-#define SERVER_URL "http://" SERVER_HOST ":" "9003" SERVER_PATH
+#define SERVER_PUSH_PATH "/api/v1/stream/push" // Long-lived push stream endpoint
+#define SERVER_UDP_PORT 9004               // Backend UDP_FRAMES_PORT (TRANSPORT_UDP)
+#define HEARTBEAT_PATH "/api/v1/devices/heartbeat"
 #define API_KEY "dev-api-key-change-in-production"
+#define NTP_SERVER "pool.ntp.org"          // Capture stamps are only sent once this has synced
+#define TIME_SYNC_MIN_EPOCH 1700000000     // Clock reads earlier than this are not synced yet
 #define DEVICE_ID "ESP32-CAM-001"
 
 // ESP32 CAM Pin Configuration for AI-Thinker OV2640
@@ -48,14 +61,405 @@
 #define HTTP_TIMEOUT_MS 1500 // Ultra-fast timeout
 #define MAX_RETRIES 0 // No retries for maximum speed
 
+// Pipeline Configuration
+// 1 = capture and upload run as separate FreeRTOS tasks on different cores,
+// 0 = capture and upload take turns inside loop()
+#define PIPELINE_MODE 1
+#define FRAME_QUEUE_DEPTH 1      // Frames waiting for upload (fb_count - 1)
+#define CAPTURE_TASK_CORE 1      // APP_CPU, same core as the Arduino loop
+#define UPLOAD_TASK_CORE 0       // PRO_CPU, next to the lwIP/WiFi tasks
+#define CAPTURE_TASK_STACK 4096
+#define UPLOAD_TASK_STACK 8192
+
+// Connection Configuration
+#define KEEP_ALIVE_MODE 1             // Reuse one TCP connection for all frame POSTs
+#define METADATA_INTERVAL_FRAMES 20   // Send Device-* metadata headers every N frames
+
+// Transport Configuration
+#define TRANSPORT_HTTP_POST 0     // One POST per frame to SERVER_PATH via HTTPClient
+#define TRANSPORT_PUSH_STREAM 1   // One chunked POST to SERVER_PUSH_PATH carrying length-prefixed frames
+#define TRANSPORT_DIRECT_POST 2   // One POST per frame written straight from the frame buffer to the socket
+#define TRANSPORT_UDP 3           // Each frame as UDP datagrams to SERVER_UDP_PORT; lossy, never retransmitted
+#define TRANSPORT_MODE TRANSPORT_DIRECT_POST
+#define TCP_SLICE_BYTES 1436      // lwIP TCP_MSS - frame buffers are written in MSS-sized slices
+#define REQUEST_HEADER_BUFFER 1024 // Direct POST head; ~760 bytes with every config field at full width
+#define PUSH_STREAM_ROTATE_MS 60000   // Reopen the stream well before the server's request timeout
+#define PUSH_FRAME_VERSION 3
+#define PUSH_FRAME_HEADER_SIZE 24     // 'J' 'F' version flags, then big-endian uint32 length, age (ms),
+                                      // sequence and uint64 capture time (epoch ms, 0 = not synced)
+#define UDP_FRAME_VERSION 1
+#define UDP_FRAME_HEADER_SIZE 29      // 'J' 'D' version flags, then big-endian uint32 sequence, uint16
+                                      // fragment index and count, uint32 length, age (ms), uint64
+                                      // capture time, and the device id length; the id follows
+#define UDP_FRAGMENT_BYTES 1400       // JPEG bytes per datagram; header + id + fragment fit one 1472-byte UDP payload
+#define UDP_SEND_BACKOFF_MS 2         // Wait for lwIP buffers once before giving up on a frame
+
+// Adaptive Streaming Configuration
+// The controller degrades JPEG quality first, then resolution, then frame rate
+// when uploads exceed the latency budget, and restores them in reverse order.
+#define ADAPTIVE_MODE 1
+#define LATENCY_BUDGET_MS 150           // Target upload round trip per frame
+#define ADAPT_WINDOW_FRAMES 10          // Frames per controller decision
+#define ADAPT_MAX_FAILURE_PCT 20        // Degrade when more frames than this fail
+#define ADAPT_WEAK_RSSI_DBM -75         // Degrade pre-emptively below this signal level
+#define ADAPT_QUALITY_STEP 4
+#define ADAPT_WORST_QUALITY 20          // Higher is smaller; keeps frames above the 5 KB floor
+#define ADAPT_MAX_FRAME_INTERVAL_MS 500 // Never drop below 2 FPS
+
+// Motion Gating Configuration
+// Static scenes are only uploaded as a keyframe heartbeat; frames with motion
+// go out at the full rate.
+#define MOTION_OFF 0
+#define MOTION_JPEG_SIZE 1       // Compare JPEG sizes of consecutive frames (nearly free)
+#define MOTION_THUMBNAIL_SAD 2   // Decode a 1/8 scale thumbnail and diff its luma
+#define MOTION_MODE MOTION_JPEG_SIZE
+#define MOTION_KEYFRAME_INTERVAL_MS 2000 // Heartbeat frame rate while nothing moves
+#define MOTION_HOLD_MS 1000              // Keep streaming this long after the last motion
+#define MOTION_SIZE_DELTA_PCT 4          // MOTION_JPEG_SIZE: size change that counts as motion
+#define MOTION_PIXEL_DELTA 24            // MOTION_THUMBNAIL_SAD: luma change per pixel
+#define MOTION_CHANGED_PCT 2             // MOTION_THUMBNAIL_SAD: changed pixels that count as motion
+#define MOTION_THUMB_MAX_PIXELS (80 * 60) // VGA at 1/8 scale
+
+// ROI Configuration
+// The sensor streams a low-res preview (downscaled by the OV2640's DSP) and
+// only switches its window to a native-resolution crop when motion is seen
+// or the server asks for one (Roi-Request response header), so recognition
+// gets full detail without every frame being uploaded at full size.
+#define ROI_MODE 1
+#define ROI_PREVIEW_FRAMESIZE FRAMESIZE_QVGA
+#define ROI_SENSOR_WIDTH 1600            // OV2640 UXGA array the crop is cut from
+#define ROI_SENSOR_HEIGHT 1200
+#define ROI_WINDOW_WIDTH 640             // Crop size on the array; output is 1:1 and fits the VGA buffers
+#define ROI_WINDOW_HEIGHT 480
+#define ROI_BURST_FRAMES 2               // Crops sent per trigger
+#define ROI_MIN_INTERVAL_MS 1500         // Motion triggers a burst at most this often
+#define ROI_SETTLE_FRAMES 1              // Frames discarded after the window changes
+#define PREVIEW_MIN_JPEG_BYTES 1000      // Preview frames are legitimately small
+
+// Face Detection Configuration
+// Runs ESP-WHO's two-stage esp-dl face detector (MSR01 + MNP01, as in the
+// core's CameraWebServer example) on frames that pass the motion gate, so
+// the backend only has to recognise frames that actually contain a face.
+// Needs an ESP32 core 2.x build with esp-dl (CONFIG_ESP_FACE_DETECT_ENABLED)
+// and PSRAM; core 3.x no longer bundles esp-dl.
+#define FACE_DETECT_MODE 0
+#define FACE_UPLOAD_FILTER 1                   // Upload only frames with faces (plus keyframes)
+#define FACE_MAX_BOXES 3                       // Boxes reported per frame, largest first
+#define FACE_DETECT_MAX_PIXELS (320 * 240)     // Larger frames are decoded at 1/2 or 1/4 scale
+#define FACE_DETECT_STACK 12288                // Extra capture task stack for the detector
+
+// Per-frame flags sent alongside the JPEG (Frame-Flags header / push stream flags byte)
+#define FRAME_FLAG_MOTION 0x01
+#define FRAME_FLAG_KEYFRAME 0x02
+#define FRAME_FLAG_REPLAYED 0x04     // Captured during a WiFi outage and uploaded late
+#define FRAME_FLAG_ROI 0x08          // Full-resolution crop, meant for recognition
+#define FRAME_FLAG_PREVIEW 0x10      // Low-res preview frame
+#define FRAME_FLAG_FACE 0x20         // On-device detector found at least one face
+
+#if FACE_DETECT_MODE
+#if !CONFIG_ESP_FACE_DETECT_ENABLED
+#error "FACE_DETECT_MODE needs an ESP32 core built with esp-dl face detection"
+#endif
+#if !PIPELINE_MODE
+#error "FACE_DETECT_MODE needs PIPELINE_MODE; the detector runs on the capture task"
+#endif
+#include "human_face_detect_msr01.hpp"
+#include "human_face_detect_mnp01.hpp"
+#endif
+
+#if TRANSPORT_MODE == TRANSPORT_UDP
+#include <lwip/sockets.h>
+#endif
+
+// Outage Buffer Configuration
+// While WiFi is down, frames keep filling a PSRAM ring instead of being lost
+// and are replayed in bursts, with their original capture age, after reconnect.
+#define OUTAGE_BUFFER_ENABLED 1
+#define OUTAGE_BUFFER_BYTES (1024 * 1024)   // PSRAM reserved for offline frames
+#define OUTAGE_BUFFER_FRAMES 40             // Max frames kept; the oldest are overwritten
+#define OUTAGE_DRAIN_BURST 4                // Buffered frames sent before the next live frame
+#define WIFI_RETRY_INTERVAL_MS 5000         // Wait after a failed full join
+
+// Telemetry Configuration
+// Log lines above LOG_LEVEL compile to nothing, arguments included, so a
+// production build set to LOG_LEVEL_WARN pays nothing for per-frame logging.
+#define LOG_LEVEL LOG_LEVEL_INFO            // LOG_LEVEL_DEBUG adds every frame and the [Stats] line
+#define METRICS_ENABLED 1                   // Phase histograms, reported with a heartbeat
+#define METRICS_REPORT_INTERVAL_MS 60000
+#define HEARTBEAT_HEAD_BUFFER 256
+
+// Firmware Update Configuration
+// The upload side asks the backend for a new image now and then (see
+// OtaUpdater.h) and downloads it into the other app partition in short
+// slices between frames, so streaming carries on meanwhile. The restart
+// into it waits until the outage ring has drained, since PSRAM does not
+// survive it. Flash with a partition scheme that has two OTA slots.
+#define OTA_ENABLED 1
+#define OTA_CHANNEL "camera"                // Images are published per channel on the backend
+
+// Benchmark Configuration
+// BENCHMARK_MODE 1 runs one fixed-length capture/upload run once WiFi is up,
+// then stops streaming and prints a "[Bench] {...}" JSON line and POSTs it
+// to BENCHMARK_REPORT_PATH. Use scripts/camera-bench-sink.js in the backend
+// as the server. The camera runs with the BENCHMARK_* settings below. The
+// adaptive controller, motion gating and ROI are switched off so every
+// captured frame is sent, which keeps runs comparable across frame sizes,
+// qualities, buffer counts and TRANSPORT_MODEs.
+#define BENCHMARK_MODE 0
+#define BENCHMARK_WARMUP_MS 5000            // Not measured: AEC/AWB settling, first connects
+#define BENCHMARK_DURATION_MS 60000
+#define BENCHMARK_FRAMESIZE FRAMESIZE_VGA
+#define BENCHMARK_JPEG_QUALITY 10
+#define BENCHMARK_FB_COUNT 2                // Needs PSRAM above 1
+#define BENCHMARK_MAX_SAMPLES 4096          // Send latencies kept for exact percentiles
+#define BENCHMARK_REPORT_PATH "/api/v1/bench/report"
+
+#if BENCHMARK_MODE
+#undef ADAPTIVE_MODE
+#define ADAPTIVE_MODE 0
+#undef MOTION_MODE
+#define MOTION_MODE MOTION_OFF
+#undef ROI_MODE
+#define ROI_MODE 0
+#undef OTA_ENABLED
+#define OTA_ENABLED 0
+#endif
+
+#include <IotCore.h>
+
+// Camera profile: WiFi modem sleep off (it adds latency to every frame),
+// 24 histogram buckets (the last one is open-ended, >= 8 s)
+struct Device : iot::CameraProfile {
+  static constexpr bool kMetrics = METRICS_ENABLED;
+  static constexpr uint32_t kWifiFastConnectMs = WIFI_FAST_CONNECT_MS;
+  static constexpr uint32_t kWifiJoinTimeoutMs = WIFI_JOIN_TIMEOUT_MS;
+  static constexpr uint32_t kWifiRetryIntervalMs = WIFI_RETRY_INTERVAL_MS;
+};
+
+// Network settings (.env style): the #defines above are the defaults, and
+// every key can be changed over serial and is kept in Preferences. The
+// REMOTE ones can also be pushed from the backend (/api/v1/devices/:id/command).
+struct Config {
+  char wifiSsid[64];
+  char wifiPassword[64];
+  char serverHost[64];
+  int serverPort;
+  char deviceId[32];
+  char apiKey[64];
+  char staticIp[16];
+  char gateway[16];
+  char subnet[16];
+  int udpPort;
+  int targetFps;           // Capture rate the adaptive controller restores to
+  int jpegQuality;         // 4 (best) - 63; 0 keeps the quality initCamera() picked
+  uint32_t configVersion;  // Last backend patch applied (see RemoteConfig.h)
+};
+
+Config config;
+
+const Config defaultConfig = {
+  WIFI_SSID, WIFI_PASSWORD, SERVER_HOST, SERVER_PORT, DEVICE_ID, API_KEY,
+  WIFI_STATIC_IP, WIFI_GATEWAY, WIFI_SUBNET, SERVER_UDP_PORT,
+  TARGET_FPS, 0, 0
+};
+
+const iot::ConfigField CONFIG_FIELDS[] = {
+  IOT_CONFIG_STRING(Config, wifiSsid, "WIFI_SSID"),
+  IOT_CONFIG_STRING(Config, wifiPassword, "WIFI_PASSWORD"),
+  IOT_CONFIG_STRING(Config, serverHost, "SERVER_HOST"),
+  IOT_CONFIG_INT(Config, serverPort, "SERVER_PORT"),
+  IOT_CONFIG_STRING(Config, deviceId, "DEVICE_ID"),
+  IOT_CONFIG_STRING(Config, apiKey, "API_KEY"),
+  IOT_CONFIG_STRING(Config, staticIp, "STATIC_IP"),
+  IOT_CONFIG_STRING(Config, gateway, "GATEWAY"),
+  IOT_CONFIG_STRING(Config, subnet, "SUBNET"),
+  IOT_CONFIG_INT(Config, udpPort, "UDP_PORT"),
+  IOT_CONFIG_REMOTE_INT(Config, targetFps, "TARGET_FPS"),
+  IOT_CONFIG_REMOTE_INT(Config, jpegQuality, "JPEG_QUALITY"),
+  IOT_CONFIG_REMOTE_UINT(Config, configVersion, "CONFIG_VERSION"),
+};
+iot::ConfigStore<Device, Config> configStore(CONFIG_FIELDS, defaultConfig);
+
+// Patches advertised on frame (Config-Pending header) and heartbeat
+// responses; fetched and applied by the upload side
+iot::RemoteConfig<Device, Config> remoteConfig(configStore, config, &Config::configVersion);
+
+#if OTA_ENABLED
+// A new image boots on probation and is kept once it has sent a frame
+// (serviceOta()); until then the bootloader can still go back
+extern "C" bool verifyRollbackLater() { return true; }
+iot::OtaUpdater<Device> ota(OTA_CHANNEL);
+#endif
+
+// The connection manager re-reads these on every join
+const iot::WifiSettings wifiSettings = {
+  config.wifiSsid, config.wifiPassword, config.staticIp, config.gateway, config.subnet
+};
+
+// Filled in by loadConfig()
+iot::HttpTarget serverTarget = { config.serverHost, 0, config.deviceId, config.apiKey };
+char serverUrl[128] = "";           // TRANSPORT_HTTP_POST frame endpoint
+
 // Global variables
 WiFiClient client;
+#if KEEP_ALIVE_MODE
+HTTPClient streamHttp;              // Lives across frames so the socket stays open
+bool streamHttpReady = false;
+#endif
+uint32_t framesSinceMetadata = METADATA_INTERVAL_FRAMES; // Send metadata on the first frame
+#if TRANSPORT_MODE == TRANSPORT_DIRECT_POST
+char requestHeaders[REQUEST_HEADER_BUFFER]; // Reused for every frame, never on the heap
+#endif
+#if TRANSPORT_MODE == TRANSPORT_PUSH_STREAM
+WiFiClient pushClient;
+bool pushStreamOpen = false;
+unsigned long pushStreamOpenedAt = 0;
+#endif
+#if TRANSPORT_MODE == TRANSPORT_UDP
+int udpSocket = -1;
+struct sockaddr_in udpServerAddr;
+#endif
 unsigned long lastFrameTime = 0;
 uint32_t frameCount = 0;
 uint32_t successCount = 0;
 uint32_t dropCount = 0;
 unsigned long deviceStartTime = 0; // For tracking uptime
-int8_t wifiRetryCount = 0; // For tracking WiFi connection attempts
+volatile uint32_t frameIntervalMs = FRAME_INTERVAL_MS; // Adjusted at runtime by the adaptive controller
+uint32_t baseFrameIntervalMs = FRAME_INTERVAL_MS;      // 1000 / config.targetFps, set by applyTuning()
+
+// Adaptive controller state (owned by the upload side)
+const framesize_t ADAPT_FRAMESIZES[] = { FRAMESIZE_CIF, FRAMESIZE_HVGA, FRAMESIZE_VGA };
+const int ADAPT_FRAMESIZE_COUNT = sizeof(ADAPT_FRAMESIZES) / sizeof(ADAPT_FRAMESIZES[0]);
+int cameraJpegQuality = 10;                     // Set from the camera config in initCamera()
+int bestJpegQuality = 10;                       // cameraJpegQuality unless JPEG_QUALITY overrides it
+int currentJpegQuality = 10;
+int currentFramesizeIndex = ADAPT_FRAMESIZE_COUNT - 1;
+float uploadRttAvgMs = 0;                       // EWMA of the per-frame upload round trip
+uint16_t adaptWindowFrames = 0;
+uint16_t adaptWindowFailures = 0;
+
+// ROI crop position in UXGA sensor coordinates (all zero for other frames)
+struct RoiRect {
+  uint16_t x;
+  uint16_t y;
+  uint16_t w;
+  uint16_t h;
+};
+
+// Face bounding box in the frame's own pixel coordinates
+struct FaceBox {
+  uint16_t x;
+  uint16_t y;
+  uint16_t w;
+  uint16_t h;
+  uint8_t score;   // Detector confidence, percent
+};
+
+// A frame on its way to the server plus what the capture side learned about
+// it. Live frames point into a camera buffer (fb), frames replayed after an
+// outage point into the PSRAM outage ring (fb == NULL).
+struct CapturedFrame {
+  camera_fb_t* fb;
+  const uint8_t* buf;
+  size_t len;
+  uint8_t flags;
+  unsigned long capturedAt;    // millis() at capture
+  uint64_t capturedAtEpochMs;  // Wall clock at capture, 0 until SNTP has synced
+  uint32_t seq;                // Increments per frame accepted for upload
+  RoiRect roi;
+  uint8_t faceCount;
+  FaceBox faces[FACE_MAX_BOXES];
+};
+
+// Motion gating state (owned by the capture side)
+uint32_t skippedCount = 0;                 // Static frames not uploaded
+size_t lastJpegSize = 0;
+unsigned long lastMotionAt = 0;
+unsigned long lastKeyframeAt = 0;
+#if MOTION_MODE == MOTION_THUMBNAIL_SAD
+uint8_t* motionThumbRgb = NULL;            // RGB565 scratch for the decoded thumbnail
+uint8_t* motionThumbLuma = NULL;           // Luma of the previous thumbnail
+size_t motionThumbPixels = 0;
+#endif
+uint16_t roiCenterX = ROI_SENSOR_WIDTH / 2;     // Where the last motion or face was, sensor coordinates
+uint16_t roiCenterY = ROI_SENSOR_HEIGHT / 2;
+
+// ROI state: the capture side owns the sensor window, the upload side only
+// raises roiRequested when the server asks for a crop
+volatile bool roiRequested = false;
+uint8_t roiShotsLeft = 0;
+bool sensorInRoi = false;
+RoiRect currentRoi = {0, 0, 0, 0};
+unsigned long lastRoiAt = 0;
+uint32_t roiFrameCount = 0;
+uint32_t frameSeq = 0;             // Last sequence number handed out; gaps at the server are losses
+bool timeSyncStarted = false;
+bool timeSynced = false;
+uint32_t faceFrameCount = 0;
+
+#if FACE_DETECT_MODE
+HumanFaceDetectMSR01 faceStage1(0.1F, 0.5F, 10, 0.2F);
+HumanFaceDetectMNP01 faceStage2(0.5F, 0.3F, 5);
+uint8_t* faceRgb = NULL;          // RGB565 decode buffer, PSRAM
+#endif
+
+// Outage ring state, shared by capture (writer) and upload (reader)
+struct OutageSlot {
+  uint32_t offset;
+  uint32_t len;
+  uint8_t flags;
+  unsigned long capturedAt;
+  uint64_t capturedAtEpochMs;
+  uint32_t seq;
+  RoiRect roi;
+  uint8_t faceCount;
+  FaceBox faces[FACE_MAX_BOXES];
+};
+uint8_t* outageArena = NULL;
+OutageSlot outageSlots[OUTAGE_BUFFER_FRAMES];
+uint16_t outageHead = 0;            // Oldest buffered frame
+uint16_t outageCount = 0;
+uint32_t outageWriteOffset = 0;
+bool outageInFlight = false;        // Oldest frame is being uploaded straight from the arena
+uint32_t outageEvicted = 0;
+SemaphoreHandle_t outageMutex = NULL;
+
+// Kept in RTC memory across soft resets; the manager mirrors it to Preferences
+RTC_DATA_ATTR iot::WifiCache wifiCache = {};
+iot::WifiManager<Device> wifi(wifiCache);
+
+// Phase timings: one log2 histogram per phase, filled from the CPU cycle
+// counter and reset each time it is reported. Jitter is how far each
+// capture started from its slot on the TARGET_FPS grid.
+enum MetricId {
+  METRIC_CAPTURE, METRIC_PROCESS, METRIC_CONNECT, METRIC_SEND, METRIC_RESPONSE, METRIC_JITTER, METRIC_COUNT
+};
+const char* const METRIC_NAMES[METRIC_COUNT] = { "capture", "process", "connect", "send", "response", "jitter" };
+
+iot::MetricsFor<Device, METRIC_COUNT> metrics;
+unsigned long lastMetricsReport = 0;
+uint32_t lastCaptureCycles = 0;
+
+// Pipeline state
+QueueHandle_t frameQueue = NULL;
+TaskHandle_t captureTaskHandle = NULL;
+TaskHandle_t uploadTaskHandle = NULL;
+portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+#if BENCHMARK_MODE
+// Benchmark run state; samples and byte counts are taken under statsMux
+enum BenchState { BENCH_WAITING, BENCH_WARMUP, BENCH_RUNNING, BENCH_DONE };
+volatile BenchState benchState = BENCH_WAITING;
+unsigned long benchPhaseStartedAt = 0;
+uint16_t benchSendMs[BENCHMARK_MAX_SAMPLES];
+uint32_t benchSamples = 0;
+uint64_t benchBytes = 0;
+uint32_t benchMinFreeHeap = UINT32_MAX;
+uint32_t benchMinMaxAlloc = UINT32_MAX;
+uint32_t benchStart[4];             // frameCount, successCount, dropCount, skippedCount at the start
+uint32_t benchEnd[4];               // ... and at the end of the window
+int benchFbCount = 1;
+#endif
 
 // Buzzer control variables
 bool buzzerActive = false;
@@ -63,11 +467,26 @@ unsigned long lastBuzzerPoll = 0;
 const unsigned long BUZZER_POLL_INTERVAL = 150; // Poll every 150ms
 const unsigned long SINGLE_BEEP_DURATION = 200; // Duration of single beep in ms
 
+// ===========================
+// Metrics
+// ===========================
+// Call as each capture slot starts; records its distance from the ideal cadence
+void metricCaptureSlot() {
+#if METRICS_ENABLED
+  uint32_t now = ESP.getCycleCount();
+  if (lastCaptureCycles != 0) {
+    int32_t periodUs = (now - lastCaptureCycles) / ESP.getCpuFreqMHz();
+    metrics.record(METRIC_JITTER, abs(periodUs - (int32_t)(frameIntervalMs * 1000)));
+  }
+  lastCaptureCycles = now;
+#endif
+}
+
 // ===========================
 // Camera Initialization
 // ===========================
 void initCamera() {
-  Serial.println("\n[Camera] Initializing OV2640...");
+  LOG_I("\n[Camera] Initializing OV2640...\n");
   
   camera_config_t config;
   config.ledc_channel = LEDC_CHANNEL_0;
@@ -96,21 +515,36 @@ void initCamera() {
   config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
 
   if (psramFound()) {
-    Serial.println("[Camera] PSRAM detected - enabling high quality mode");
+    LOG_I("[Camera] PSRAM detected - enabling high quality mode\n");
     config.jpeg_quality = 8;
     config.fb_count = 2;
+#if PIPELINE_MODE
+    // With one buffer uploading and one queued, always hand out the newest frame
+    config.grab_mode = CAMERA_GRAB_LATEST;
+#endif
   }
 
+#if BENCHMARK_MODE
+  config.frame_size = BENCHMARK_FRAMESIZE;
+  config.jpeg_quality = BENCHMARK_JPEG_QUALITY;
+  config.fb_count = psramFound() ? BENCHMARK_FB_COUNT : 1;
+  benchFbCount = config.fb_count;
+#endif
+
+  cameraJpegQuality = config.jpeg_quality;
+  bestJpegQuality = config.jpeg_quality;
+  currentJpegQuality = config.jpeg_quality;
+
   esp_err_t err = esp_camera_init(&config);
   if (err != ESP_OK) {
-    Serial.printf("[Camera] ❌ Init failed: 0x%x\n", err);
+    LOG_E("[Camera] ❌ Init failed: 0x%x\n", err);
     delay(1000);
     ESP.restart();
   }
 
   sensor_t * s = esp_camera_sensor_get();
   if (s) {
-    s->set_framesize(s, FRAMESIZE_VGA);
+    s->set_framesize(s, BENCHMARK_MODE ? BENCHMARK_FRAMESIZE : FRAMESIZE_VGA);
     s->set_brightness(s, 0);
     s->set_contrast(s, 1);
     s->set_saturation(s, 0);
@@ -130,134 +564,1508 @@ void initCamera() {
     s->set_lenc(s, 1);
     s->set_dcw(s, 1);
     s->set_colorbar(s, 0);
-    Serial.println("[Camera] ✅ OV2640 configured successfully");
+#if ROI_MODE
+    // Buffers stay sized for VGA (the crop size); stream the preview meanwhile
+    s->set_framesize(s, ROI_PREVIEW_FRAMESIZE);
+#endif
+    LOG_I("[Camera] ✅ OV2640 configured successfully\n");
   } else {
-    Serial.println("[Camera] ❌ Failed to get sensor");
+    LOG_E("[Camera] ❌ Failed to get sensor\n");
   }
 }
 
 // ===========================
-// WiFi Management
+// Configuration
 // ===========================
-void initWiFi() {
-  Serial.println("\n[WiFi] Initializing WiFi...");
-  Serial.printf("[WiFi] SSID: %s\n", WIFI_SSID);
-  
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  WiFi.setSleep(false);
-  
-  int retryCount = 0;
-  while (WiFi.status() != WL_CONNECTED && retryCount < 30) {
-    delay(500);
-    Serial.print(".");
-    retryCount++;
-    if (retryCount % 10 == 0) {
-      Serial.printf(" %d/30\n", retryCount);
-    }
+void loadConfig() {
+  configStore.load(config);
+  serverTarget.port = config.serverPort;
+  snprintf(serverUrl, sizeof(serverUrl), "http://%s:%d%s", config.serverHost, config.serverPort, SERVER_PATH);
+
+  LOG_I("=== Configuration Loaded ===\n");
+  if (LOG_LEVEL >= LOG_LEVEL_INFO) {
+    configStore.print(config);
   }
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println();
-    Serial.println("[WiFi] ✅ Connected!");
-    Serial.printf("[WiFi] IP: %s\n", WiFi.localIP().toString().c_str());
-    Serial.printf("[WiFi] RSSI: %d dBm\n", WiFi.RSSI());
-  } else {
-    Serial.println();
-    Serial.println("[WiFi] ❌ Connection failed. Restarting...");
-    delay(3000);
-    ESP.restart();
+  LOG_I("============================\n");
+}
+
+// Puts TARGET_FPS and JPEG_QUALITY into effect, whether they came from
+// Preferences, the console or a backend patch. Runs after initCamera() and
+// on the upload side, the same side the adaptive controller works from;
+// the capture task picks the new interval up on its next frame.
+void applyTuning() {
+#if BENCHMARK_MODE
+  LOG_I("[Config] Benchmark run: TARGET_FPS and JPEG_QUALITY settings ignored\n");
+#else
+  config.targetFps = constrain(config.targetFps, 1, 30);
+  baseFrameIntervalMs = 1000 / config.targetFps;
+  frameIntervalMs = baseFrameIntervalMs; // The adaptive controller backs off from here again
+
+  if (config.jpegQuality != 0) {
+    config.jpegQuality = constrain(config.jpegQuality, 4, 63);
+  }
+  bestJpegQuality = config.jpegQuality ? config.jpegQuality : cameraJpegQuality;
+  currentJpegQuality = bestJpegQuality;
+  sensor_t* s = esp_camera_sensor_get();
+  if (s) {
+    s->set_quality(s, currentJpegQuality);
   }
+  LOG_I("[Config] %d FPS, JPEG quality %d\n", config.targetFps, currentJpegQuality);
+#endif
+}
+
+// =========================================================
+// Time Sync
+// =========================================================
+// Starts SNTP once WiFi is up. Frames carry their capture time in epoch ms
+// so the server can split latency into device, network and server stages.
+void serviceTimeSync() {
+  if (!timeSyncStarted && wifi.up()) {
+    configTime(0, 0, NTP_SERVER);
+    timeSyncStarted = true;
+  }
+  if (timeSyncStarted && !timeSynced && time(NULL) >= TIME_SYNC_MIN_EPOCH) {
+    timeSynced = true;
+    LOG_I("[Time] ✅ SNTP synced, epoch %ld\n", (long)time(NULL));
+  }
+}
+
+// Wall clock in ms, or 0 while it is not synced
+uint64_t epochMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  if (tv.tv_sec < TIME_SYNC_MIN_EPOCH) {
+    return 0;
+  }
+  return (uint64_t)tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
 }
 
 // =========================================================
 // Frame Capture and Upload (SIMPLIFIED AND CORRECTED)
 // =========================================================
-bool sendFrameToServer(camera_fb_t* fb) {
-  if (!fb || fb->len < 1000) {
-    Serial.println("[HTTP] Invalid frame buffer");
+// Frame-Faces header value: "x,y,w,h,score" per face, separated by ';'
+int formatFaceBoxes(const CapturedFrame& frame, char* out, size_t size) {
+  int len = 0;
+  out[0] = '\0';
+  for (uint8_t i = 0; i < frame.faceCount && len < (int)size; i++) {
+    const FaceBox& f = frame.faces[i];
+    len += snprintf(out + len, size - len, "%s%u,%u,%u,%u,%u",
+                    i ? ";" : "", f.x, f.y, f.w, f.h, f.score);
+  }
+  return len;
+}
+
+bool sendFrameToServer(CapturedFrame& frame) {
+  if (!frame.buf || frame.len < 1000) {
+    LOG_W("[HTTP] Invalid frame buffer\n");
     return false;
   }
 
   if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("[HTTP] WiFi not connected");
+    LOG_W("[HTTP] WiFi not connected\n");
     return false;
   }
 
+#if KEEP_ALIVE_MODE
+  HTTPClient& http = streamHttp;
+  if (!streamHttpReady) {
+    http.setReuse(true);
+    streamHttpReady = true;
+  }
+#else
   HTTPClient http;
-  if (!http.begin(client, SERVER_URL)) {
-    Serial.println("[HTTP] Failed to begin connection");
+#endif
+
+  // With reuse enabled, begin() keeps an already open connection to the same host
+  if (!http.begin(client, serverUrl)) {
+    LOG_W("[HTTP] Failed to begin connection\n");
     return false;
   }
 
   // Add headers
   http.addHeader("Content-Type", "image/jpeg");
-  http.addHeader("Device-ID", DEVICE_ID);
-  http.addHeader("X-API-Key", API_KEY);
-  http.addHeader("Device-Name", "ESP32-CAM OV2640");
-  http.addHeader("Device-Type", "ESP32-CAM");
-  http.addHeader("Device-IP", WiFi.localIP().toString());
-  http.addHeader("Device-Status", "online");
-  http.addHeader("Device-Uptime", String(millis() - deviceStartTime));
-  http.addHeader("Device-FreeHeap", String(ESP.getFreeHeap()));
-  http.addHeader("Device-WifiRssi", String(WiFi.RSSI()));
+  http.addHeader("Device-ID", config.deviceId);
+  http.addHeader("X-API-Key", config.apiKey);
+  http.addHeader("Frame-Flags", String(frame.flags));
+  http.addHeader("Frame-Age-Ms", String(millis() - frame.capturedAt));
+  http.addHeader("Frame-Seq", String(frame.seq));
+  if (frame.capturedAtEpochMs) {
+    char capturedAt[24];
+    snprintf(capturedAt, sizeof(capturedAt), "%llu", (unsigned long long)frame.capturedAtEpochMs);
+    http.addHeader("Frame-Captured-At", capturedAt);
+  }
+  if (frame.flags & FRAME_FLAG_ROI) {
+    char roi[32];
+    snprintf(roi, sizeof(roi), "%u,%u,%u,%u", frame.roi.x, frame.roi.y, frame.roi.w, frame.roi.h);
+    http.addHeader("Frame-Roi", roi);
+  }
+  if (frame.faceCount > 0) {
+    char faces[FACE_MAX_BOXES * 28];
+    formatFaceBoxes(frame, faces, sizeof(faces));
+    http.addHeader("Frame-Faces", faces);
+  }
+
+  // Device metadata only changes slowly, so it rides along every N frames
+  bool sendMetadata = framesSinceMetadata >= METADATA_INTERVAL_FRAMES;
+  if (sendMetadata) {
+    http.addHeader("Device-Name", "ESP32-CAM OV2640");
+    http.addHeader("Device-Type", "ESP32-CAM");
+    http.addHeader("Device-IP", WiFi.localIP().toString());
+    http.addHeader("Device-Status", "online");
+    http.addHeader("Device-Uptime", String(millis() - deviceStartTime));
+    http.addHeader("Device-FreeHeap", String(ESP.getFreeHeap()));
+    http.addHeader("Device-WifiRssi", String(WiFi.RSSI()));
+    http.addHeader("Device-Face-Detect", String(FACE_DETECT_MODE));
+  }
   http.setTimeout(HTTP_TIMEOUT_MS);
+  const char* responseHeaders[] = { "Roi-Request", "Config-Pending" };
+  http.collectHeaders(responseHeaders, 2);
 
-  Serial.printf("[HTTP] Sending %d bytes to server...\n", fb->len);
-  int httpCode = http.POST(fb->buf, fb->len);
+  LOG_D("[HTTP] Sending %d bytes to server...\n", frame.len);
+  uint32_t started = metrics.start();
+  int httpCode = http.POST((uint8_t*)frame.buf, frame.len); // Connect, send and response in one
+  metrics.end(METRIC_SEND, started);
+  if (http.header("Roi-Request").length() > 0) {
+    roiRequested = true;
+  }
+  if (http.header("Config-Pending").length() > 0) {
+    remoteConfig.notice(strtoul(http.header("Config-Pending").c_str(), NULL, 10));
+  }
   
   bool success = (httpCode == 200);
   if (success) {
-    Serial.printf("[HTTP] ✅ Success (200)\n");
+    LOG_D("[HTTP] ✅ Success (200)\n");
+    framesSinceMetadata = sendMetadata ? 1 : framesSinceMetadata + 1;
   } else {
-    Serial.printf("[HTTP] ❌ Failed: %d\n", httpCode);
-    if (httpCode > 0) {
-      String response = http.getString();
-      Serial.printf("[HTTP] Response: %s\n", response.c_str());
+    LOG_W("[HTTP] ❌ Failed: %d\n", httpCode);
+    // Resend metadata once the server is reachable again
+    framesSinceMetadata = METADATA_INTERVAL_FRAMES;
+  }
+
+  // Drain the body so the next request on this socket starts clean
+  if (httpCode > 0) {
+    String response = http.getString();
+    if (!success) {
+      LOG_W("[HTTP] Response: %s\n", response.c_str());
     }
   }
   
-  http.end();
+#if KEEP_ALIVE_MODE
+  if (httpCode < 0) {
+    // Connection is broken - drop it so the next frame reconnects
+    client.stop();
+  }
+#endif
+  http.end(); // Keeps the socket open when reuse is enabled
   return success;
 }
 
-void captureAndSendFrame() {
-  camera_fb_t* fb = esp_camera_fb_get();
-  if (!fb) {
-    Serial.println("[Capture] Failed to get frame buffer");
-    dropCount++;
+// Returns a frame buffer to the camera driver once; safe to call again afterwards.
+void releaseFrame(CapturedFrame& frame) {
+  if (frame.fb) {
+    esp_camera_fb_return(frame.fb);
+    frame.fb = NULL;
+  }
+  frame.buf = NULL;
+}
+
+void putUint32BE(uint8_t* out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+// Writes the whole buffer in MSS-sized slices straight from the caller's memory
+// (camera-owned PSRAM for frames), so no intermediate heap copy is made.
+// WiFiClient::write may return short; a zero-length write means the socket died.
+bool writeSliced(WiFiClient& c, const uint8_t* data, size_t len) {
+  while (len > 0) {
+    size_t slice = len < TCP_SLICE_BYTES ? len : TCP_SLICE_BYTES;
+    size_t written = c.write(data, slice);
+    if (written == 0) {
+      return false;
+    }
+    data += written;
+    len -= written;
+  }
+  return true;
+}
+
+// =========================================================
+// Direct POST Transport
+// =========================================================
+#if TRANSPORT_MODE == TRANSPORT_DIRECT_POST
+// Posts a frame without HTTPClient: headers are formatted into a static buffer
+// and the JPEG goes from the frame buffer to the socket. The buffer is handed back
+// to the driver as soon as the last byte is queued, before waiting for the
+// response, so the camera can refill it during the round trip.
+bool sendFrameDirect(CapturedFrame& frame) {
+  if (!frame.buf || frame.len < 1000) {
+    LOG_W("[HTTP] Invalid frame buffer\n");
+    return false;
+  }
+
+  if (WiFi.status() != WL_CONNECTED) {
+    LOG_W("[HTTP] WiFi not connected\n");
+    return false;
+  }
+
+  if (!client.connected()) {
+    client.stop();
+    uint32_t connectStarted = metrics.start();
+    bool connected = client.connect(config.serverHost, config.serverPort);
+    metrics.end(METRIC_CONNECT, connectStarted);
+    if (!connected) {
+      LOG_W("[HTTP] Failed to begin connection\n");
+      return false;
+    }
+    client.setNoDelay(true);
+    framesSinceMetadata = METADATA_INTERVAL_FRAMES;
+  }
+
+  size_t frameLen = frame.len;
+  int headerLen = snprintf(requestHeaders, sizeof(requestHeaders),
+      "POST %s HTTP/1.1\r\n"
+      "Host: %s:%d\r\n"
+      "Connection: %s\r\n"
+      "Content-Type: image/jpeg\r\n"
+      "Content-Length: %u\r\n"
+      "Device-ID: %s\r\n"
+      "X-API-Key: %s\r\n"
+      "Frame-Flags: %u\r\n"
+      "Frame-Age-Ms: %lu\r\n"
+      "Frame-Seq: %lu\r\n",
+      SERVER_PATH, config.serverHost, config.serverPort, KEEP_ALIVE_MODE ? "keep-alive" : "close",
+      (unsigned)frameLen, config.deviceId, config.apiKey, frame.flags, millis() - frame.capturedAt,
+      (unsigned long)frame.seq);
+  if (frame.capturedAtEpochMs && headerLen < (int)sizeof(requestHeaders)) {
+    headerLen += snprintf(requestHeaders + headerLen, sizeof(requestHeaders) - headerLen,
+        "Frame-Captured-At: %llu\r\n", (unsigned long long)frame.capturedAtEpochMs);
+  }
+  if ((frame.flags & FRAME_FLAG_ROI) && headerLen < (int)sizeof(requestHeaders)) {
+    headerLen += snprintf(requestHeaders + headerLen, sizeof(requestHeaders) - headerLen,
+        "Frame-Roi: %u,%u,%u,%u\r\n", frame.roi.x, frame.roi.y, frame.roi.w, frame.roi.h);
+  }
+  if (frame.faceCount > 0 && headerLen < (int)sizeof(requestHeaders)) {
+    char faces[FACE_MAX_BOXES * 28];
+    formatFaceBoxes(frame, faces, sizeof(faces));
+    headerLen += snprintf(requestHeaders + headerLen, sizeof(requestHeaders) - headerLen,
+        "Frame-Faces: %s\r\n", faces);
+  }
+
+  // Device metadata only changes slowly, so it rides along every N frames
+  bool sendMetadata = framesSinceMetadata >= METADATA_INTERVAL_FRAMES;
+  if (sendMetadata && headerLen < (int)sizeof(requestHeaders)) {
+    headerLen += snprintf(requestHeaders + headerLen, sizeof(requestHeaders) - headerLen,
+        "Device-Name: ESP32-CAM OV2640\r\n"
+        "Device-Type: ESP32-CAM\r\n"
+        "Device-IP: %s\r\n"
+        "Device-Status: online\r\n"
+        "Device-Uptime: %lu\r\n"
+        "Device-FreeHeap: %u\r\n"
+        "Device-WifiRssi: %d\r\n"
+        "Device-Face-Detect: %d\r\n",
+        WiFi.localIP().toString().c_str(), millis() - deviceStartTime,
+        ESP.getFreeHeap(), WiFi.RSSI(), FACE_DETECT_MODE);
+  }
+  if (headerLen < (int)sizeof(requestHeaders)) {
+    headerLen += snprintf(requestHeaders + headerLen, sizeof(requestHeaders) - headerLen, "\r\n");
+  }
+  if (headerLen >= (int)sizeof(requestHeaders)) {
+    LOG_E("[HTTP] ❌ Request headers need %d bytes, REQUEST_HEADER_BUFFER is %d\n",
+          headerLen + 1, REQUEST_HEADER_BUFFER);
+    return false; // Truncated head; never send a malformed request
+  }
+
+  LOG_D("[HTTP] Sending %d bytes to server...\n", frameLen);
+  uint32_t sendStarted = metrics.start();
+  bool written = writeSliced(client, (const uint8_t*)requestHeaders, headerLen) &&
+                 writeSliced(client, frame.buf, frameLen);
+  metrics.end(METRIC_SEND, sendStarted);
+  releaseFrame(frame);
+
+  if (!written) {
+    LOG_W("[HTTP] ❌ Write failed\n");
+    client.stop();
+    framesSinceMetadata = METADATA_INTERVAL_FRAMES;
+    return false;
+  }
+
+  // Status line, then headers until the blank line
+  uint32_t responseStarted = metrics.start();
+  char line[128];
+  unsigned long deadline = millis() + HTTP_TIMEOUT_MS;
+  int httpCode = -1;
+  if (iot::readLine(client, line, sizeof(line), deadline) && strncmp(line, "HTTP/1.", 7) == 0) {
+    httpCode = atoi(line + 9);
+  }
+
+  long contentLength = -1;
+  bool serverClosing = !KEEP_ALIVE_MODE;
+  while (httpCode > 0) {
+    if (!iot::readLine(client, line, sizeof(line), deadline)) {
+      httpCode = -1;
+      break;
+    }
+    if (line[0] == '\0') {
+      break;
+    }
+    if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      contentLength = atol(line + 15);
+    } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close")) {
+      serverClosing = true;
+    } else if (strncasecmp(line, "Roi-Request:", 12) == 0) {
+      roiRequested = true; // Server wants a full-res crop; picked up by capture
+    } else if (strncasecmp(line, "Config-Pending:", 15) == 0) {
+      remoteConfig.notice(strtoul(line + 15, NULL, 10));
+    }
+  }
+
+  // Drain the body so the next request on this socket starts clean
+  while (httpCode > 0 && contentLength > 0 && (long)(millis() - deadline) < 0) {
+    if (client.available()) {
+      client.read();
+      contentLength--;
+    } else if (!client.connected()) {
+      break;
+    } else {
+      delay(1);
+    }
+  }
+
+  metrics.end(METRIC_RESPONSE, responseStarted);
+
+  bool success = (httpCode == 200);
+  if (success) {
+    LOG_D("[HTTP] ✅ Success (200)\n");
+    framesSinceMetadata = sendMetadata ? 1 : framesSinceMetadata + 1;
+  } else {
+    LOG_W("[HTTP] ❌ Failed: %d\n", httpCode);
+    framesSinceMetadata = METADATA_INTERVAL_FRAMES;
+  }
+
+  // Without a length we cannot find the end of the body - start fresh next frame
+  if (httpCode <= 0 || contentLength != 0 || serverClosing) {
+    client.stop();
+  }
+  return success;
+}
+#endif
+
+// =========================================================
+// Push Stream Transport
+// =========================================================
+#if TRANSPORT_MODE == TRANSPORT_PUSH_STREAM
+
+bool openPushStream() {
+  pushClient.stop();
+  uint32_t connectStarted = metrics.start();
+  bool connected = pushClient.connect(config.serverHost, config.serverPort);
+  metrics.end(METRIC_CONNECT, connectStarted);
+  if (!connected) {
+    LOG_W("[Push] Failed to connect to server\n");
+    return false;
+  }
+  pushClient.setNoDelay(true);
+
+  // Metadata is sent once per stream; the stream is reopened every PUSH_STREAM_ROTATE_MS
+  pushClient.printf("POST %s HTTP/1.1\r\n", SERVER_PUSH_PATH);
+  pushClient.printf("Host: %s:%d\r\n", config.serverHost, config.serverPort);
+  pushClient.print("Content-Type: application/x-jpeg-frame-stream\r\n");
+  pushClient.print("Transfer-Encoding: chunked\r\n");
+  pushClient.printf("Device-ID: %s\r\n", config.deviceId);
+  pushClient.printf("X-API-Key: %s\r\n", config.apiKey);
+  pushClient.print("Device-Name: ESP32-CAM OV2640\r\n");
+  pushClient.print("Device-Type: ESP32-CAM\r\n");
+  pushClient.printf("Device-IP: %s\r\n", WiFi.localIP().toString().c_str());
+  pushClient.print("Device-Status: online\r\n");
+  pushClient.printf("Device-Uptime: %lu\r\n", millis() - deviceStartTime);
+  pushClient.printf("Device-FreeHeap: %u\r\n", ESP.getFreeHeap());
+  pushClient.printf("Device-WifiRssi: %d\r\n", WiFi.RSSI());
+  pushClient.printf("Device-Face-Detect: %d\r\n", FACE_DETECT_MODE);
+  pushClient.print("\r\n");
+
+  pushStreamOpen = true;
+  pushStreamOpenedAt = millis();
+  LOG_I("[Push] ✅ Stream opened\n");
+  return true;
+}
+
+// Sends the terminating chunk so the server can answer, then drops the socket.
+void closePushStream() {
+  if (pushStreamOpen && pushClient.connected()) {
+    pushClient.print("0\r\n\r\n");
+    unsigned long start = millis();
+    while (pushClient.connected() && !pushClient.available() && millis() - start < HTTP_TIMEOUT_MS) {
+      delay(1);
+    }
+    if (pushClient.available()) {
+      String status = pushClient.readStringUntil('\n');
+      LOG_I("[Push] Stream closed: %s\n", status.c_str());
+    }
+  }
+  pushClient.stop();
+  pushStreamOpen = false;
+}
+
+bool pushFrameToStream(CapturedFrame& frame) {
+  if (!frame.buf || frame.len < 1000) {
+    LOG_W("[Push] Invalid frame buffer\n");
+    return false;
+  }
+
+  if (WiFi.status() != WL_CONNECTED) {
+    LOG_W("[Push] WiFi not connected\n");
+    return false;
+  }
+
+  if (pushStreamOpen) {
+    // The server only talks on this socket when it rejects the stream
+    if (!pushClient.connected() || pushClient.available()) {
+      LOG_W("[Push] Stream closed by server\n");
+      closePushStream();
+    } else if (millis() - pushStreamOpenedAt >= PUSH_STREAM_ROTATE_MS) {
+      closePushStream();
+    }
+  }
+
+  if (!pushStreamOpen && !openPushStream()) {
+    return false;
+  }
+
+  uint8_t header[PUSH_FRAME_HEADER_SIZE] = { 'J', 'F', PUSH_FRAME_VERSION, frame.flags };
+  putUint32BE(header + 4, frame.len);
+  putUint32BE(header + 8, millis() - frame.capturedAt);
+  putUint32BE(header + 12, frame.seq);
+  putUint32BE(header + 16, (uint32_t)(frame.capturedAtEpochMs >> 32));
+  putUint32BE(header + 20, (uint32_t)frame.capturedAtEpochMs);
+  char chunkSize[12];
+  int chunkSizeLen = snprintf(chunkSize, sizeof(chunkSize), "%X\r\n",
+                              (unsigned)(frame.len + PUSH_FRAME_HEADER_SIZE));
+
+  uint32_t sendStarted = metrics.start();
+  bool success = writeSliced(pushClient, (const uint8_t*)chunkSize, chunkSizeLen) &&
+                 writeSliced(pushClient, header, sizeof(header)) &&
+                 writeSliced(pushClient, frame.buf, frame.len) &&
+                 writeSliced(pushClient, (const uint8_t*)"\r\n", 2);
+  metrics.end(METRIC_SEND, sendStarted);
+  releaseFrame(frame);
+
+  if (!success) {
+    LOG_W("[Push] ❌ Write failed, reconnecting on next frame\n");
+    pushClient.stop();
+    pushStreamOpen = false;
+  }
+  return success;
+}
+#endif
+
+// =========================================================
+// UDP Datagram Transport
+// =========================================================
+#if TRANSPORT_MODE == TRANSPORT_UDP
+// A socket with no connection to lose: it is only recreated after a send
+// error, and the server address is resolved once per socket.
+bool openUdpSocket() {
+  IPAddress ip;
+  if (!WiFi.hostByName(config.serverHost, ip)) {
+    LOG_W("[UDP] Cannot resolve %s\n", config.serverHost);
+    return false;
+  }
+  udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (udpSocket < 0) {
+    LOG_E("[UDP] ❌ Failed to create socket (errno %d)\n", errno);
+    return false;
+  }
+  memset(&udpServerAddr, 0, sizeof(udpServerAddr));
+  udpServerAddr.sin_family = AF_INET;
+  udpServerAddr.sin_port = htons(config.udpPort);
+  udpServerAddr.sin_addr.s_addr = (uint32_t)ip;
+  LOG_I("[UDP] ✅ Sending frames to %s:%d\n", ip.toString().c_str(), config.udpPort);
+  return true;
+}
+
+// Header and fragment go out as one datagram straight from their own
+// buffers. A full lwIP/WiFi queue gets one short backoff; after that the
+// frame is abandoned rather than delaying the next one.
+bool sendDatagram(const uint8_t* header, size_t headerLen, const uint8_t* data, size_t len) {
+  struct iovec iov[2];
+  iov[0].iov_base = (void*)header;
+  iov[0].iov_len = headerLen;
+  iov[1].iov_base = (void*)data;
+  iov[1].iov_len = len;
+  struct msghdr msg = {};
+  msg.msg_name = &udpServerAddr;
+  msg.msg_namelen = sizeof(udpServerAddr);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (sendmsg(udpSocket, &msg, 0) >= 0) {
+      return true;
+    }
+    if (errno != ENOMEM && errno != ENOBUFS && errno != EAGAIN) {
+      break;
+    }
+    delay(UDP_SEND_BACKOFF_MS);
+  }
+  return false;
+}
+
+// Fragments the frame into sequence-numbered datagrams. There is no response:
+// success means every fragment was handed to the stack, and the server drops
+// frames that do not arrive whole.
+bool sendFrameUdp(CapturedFrame& frame) {
+  if (!frame.buf || frame.len < 1000) {
+    LOG_W("[UDP] Invalid frame buffer\n");
+    return false;
+  }
+
+  if (WiFi.status() != WL_CONNECTED) {
+    LOG_W("[UDP] WiFi not connected\n");
+    return false;
+  }
+
+  if (udpSocket < 0 && !openUdpSocket()) {
+    return false;
+  }
+
+  // The fragment index is the only field that changes between datagrams
+  size_t idLen = strlen(config.deviceId);
+  uint16_t fragmentCount = (frame.len + UDP_FRAGMENT_BYTES - 1) / UDP_FRAGMENT_BYTES;
+  uint8_t header[UDP_FRAME_HEADER_SIZE + sizeof(config.deviceId)] = { 'J', 'D', UDP_FRAME_VERSION, frame.flags };
+  putUint32BE(header + 4, frame.seq);
+  header[10] = fragmentCount >> 8;
+  header[11] = fragmentCount;
+  putUint32BE(header + 12, frame.len);
+  putUint32BE(header + 16, millis() - frame.capturedAt);
+  putUint32BE(header + 20, (uint32_t)(frame.capturedAtEpochMs >> 32));
+  putUint32BE(header + 24, (uint32_t)frame.capturedAtEpochMs);
+  header[28] = idLen;
+  memcpy(header + UDP_FRAME_HEADER_SIZE, config.deviceId, idLen);
+
+  uint32_t sendStarted = metrics.start();
+  bool success = true;
+  for (uint16_t i = 0; i < fragmentCount && success; i++) {
+    size_t offset = (size_t)i * UDP_FRAGMENT_BYTES;
+    size_t len = frame.len - offset < UDP_FRAGMENT_BYTES ? frame.len - offset : UDP_FRAGMENT_BYTES;
+    header[8] = i >> 8;
+    header[9] = i;
+    success = sendDatagram(header, UDP_FRAME_HEADER_SIZE + idLen, frame.buf + offset, len);
+  }
+  metrics.end(METRIC_SEND, sendStarted);
+  releaseFrame(frame);
+
+  if (!success) {
+    LOG_W("[UDP] ❌ Send failed (errno %d), frame dropped\n", errno);
+    close(udpSocket);
+    udpSocket = -1;
+  }
+  return success;
+}
+#endif
+
+void countDroppedFrame() {
+  portENTER_CRITICAL(&statsMux);
+  dropCount++;
+  portEXIT_CRITICAL(&statsMux);
+}
+
+// =========================================================
+// Benchmark Run
+// =========================================================
+#if BENCHMARK_MODE
+// Upload side, once per transmitted frame
+void benchRecordSend(unsigned long sendMs, size_t len, bool success) {
+  if (benchState != BENCH_RUNNING) {
     return;
   }
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t maxAlloc = ESP.getMaxAllocHeap();
+  portENTER_CRITICAL(&statsMux);
+  if (success) {
+    benchBytes += len;
+    if (benchSamples < BENCHMARK_MAX_SAMPLES) {
+      benchSendMs[benchSamples++] = sendMs < UINT16_MAX ? sendMs : UINT16_MAX;
+    }
+  }
+  if (freeHeap < benchMinFreeHeap) benchMinFreeHeap = freeHeap;
+  if (maxAlloc < benchMinMaxAlloc) benchMinMaxAlloc = maxAlloc;
+  portEXIT_CRITICAL(&statsMux);
+}
 
-  Serial.printf("[Capture] Frame size: %d bytes\n", fb->len);
-  
-  // Validate frame size
-  if (fb->len < 5000 || fb->len > 800000) {
-    Serial.printf("[Capture] Invalid frame size: %d bytes\n", fb->len);
-    esp_camera_fb_return(fb);
-    dropCount++;
+void benchSnapshot(uint32_t* counters) {
+  portENTER_CRITICAL(&statsMux);
+  counters[0] = frameCount;
+  counters[1] = successCount;
+  counters[2] = dropCount;
+  counters[3] = skippedCount;
+  portEXIT_CRITICAL(&statsMux);
+}
+
+// Capture and upload stop once the run is over
+bool benchFinished() {
+  return benchState == BENCH_DONE;
+}
+
+int compareSendMs(const void* a, const void* b) {
+  return (int)*(const uint16_t*)a - (int)*(const uint16_t*)b;
+}
+
+// Nearest-rank percentile of the sorted samples
+uint16_t benchPercentile(uint8_t pct) {
+  if (benchSamples == 0) {
+    return 0;
+  }
+  uint32_t rank = (benchSamples * pct + 99) / 100;
+  return benchSendMs[(rank > 0 ? rank : 1) - 1];
+}
+
+// endedAt is when the measured window closed; the sink lines its own
+// arrival window up with it through endedMsAgo
+void reportBenchmark(unsigned long durationMs, unsigned long endedAt) {
+  uint32_t frames = benchEnd[0] - benchStart[0];
+  uint32_t sent = benchEnd[1] - benchStart[1];
+  uint32_t dropped = benchEnd[2] - benchStart[2];
+  uint32_t skipped = benchEnd[3] - benchStart[3];
+  qsort(benchSendMs, benchSamples, sizeof(benchSendMs[0]), compareSendMs);
+
+  static char body[768];
+  int len = snprintf(body, sizeof(body),
+      "{\"deviceId\":\"%s\",\"transport\":%d,\"pipeline\":%d,\"framesize\":%d,\"jpegQuality\":%d,"
+      "\"fbCount\":%d,\"targetFps\":%d,\"durationMs\":%lu,\"endedMsAgo\":%lu,\"frames\":%u,\"sent\":%u,\"dropped\":%u,"
+      "\"skipped\":%u,\"fps\":%.2f,\"bytesPerSec\":%.0f,\"avgFrameBytes\":%u,"
+      "\"sendMs\":{\"samples\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u},"
+      "\"heap\":{\"minFree\":%u,\"minMaxAlloc\":%u,\"minFreeSinceBoot\":%u},"
+      "\"psram\":{\"minFree\":%u},\"stack\":{\"upload\":%u,\"capture\":%u},"
+      "\"wifiRssi\":%d,\"wifiDisconnects\":%u}",
+      config.deviceId, TRANSPORT_MODE, PIPELINE_MODE, (int)BENCHMARK_FRAMESIZE, BENCHMARK_JPEG_QUALITY,
+      benchFbCount, TARGET_FPS, durationMs, millis() - endedAt,
+      (unsigned)frames, (unsigned)sent, (unsigned)dropped, (unsigned)skipped,
+      sent * 1000.0f / durationMs, benchBytes * 1000.0 / durationMs, sent ? (unsigned)(benchBytes / sent) : 0,
+      (unsigned)benchSamples, (unsigned)benchPercentile(50), (unsigned)benchPercentile(90),
+      (unsigned)benchPercentile(99), benchSamples ? (unsigned)benchSendMs[benchSamples - 1] : 0,
+      benchMinFreeHeap == UINT32_MAX ? 0 : (unsigned)benchMinFreeHeap,
+      benchMinMaxAlloc == UINT32_MAX ? 0 : (unsigned)benchMinMaxAlloc, (unsigned)ESP.getMinFreeHeap(),
+      (unsigned)ESP.getMinFreePsram(),
+      uploadTaskHandle ? (unsigned)uxTaskGetStackHighWaterMark(uploadTaskHandle) : 0,
+      captureTaskHandle ? (unsigned)uxTaskGetStackHighWaterMark(captureTaskHandle) : 0,
+      WiFi.RSSI(), (unsigned)wifi.disconnects());
+  if (len >= (int)sizeof(body)) {
+    LOG_E("[Bench] Report does not fit %u bytes\n", (unsigned)sizeof(body));
     return;
   }
+  // Printed whatever LOG_LEVEL says; this line is the benchmark's output
+  Serial.printf("[Bench] %s\n", body);
 
-  bool success = sendFrameToServer(fb);
-  esp_camera_fb_return(fb);
-  
+  static iot::HttpClient<HEARTBEAT_HEAD_BUFFER, 64> benchHttp;
+  int httpCode = benchHttp.request(serverTarget, "POST", BENCHMARK_REPORT_PATH, "application/json",
+                                   (const uint8_t*)body, len, "", HTTP_TIMEOUT_MS, HTTP_TIMEOUT_MS);
+  benchHttp.stop();
+  if (httpCode != 200) {
+    LOG_W("[Bench] Report POST failed. Code: %d\n", httpCode);
+  }
+}
+
+// Runs from loop(): waits for WiFi, warms up, measures, then reports once.
+void serviceBenchmark() {
+  unsigned long now = millis();
+  switch (benchState) {
+    case BENCH_WAITING:
+      if (wifi.up()) {
+        benchState = BENCH_WARMUP;
+        benchPhaseStartedAt = now;
+        LOG_I("[Bench] WiFi up, warming up for %d ms\n", BENCHMARK_WARMUP_MS);
+      }
+      break;
+    case BENCH_WARMUP:
+      if (now - benchPhaseStartedAt >= BENCHMARK_WARMUP_MS) {
+        benchSnapshot(benchStart);
+        benchPhaseStartedAt = now;
+        benchState = BENCH_RUNNING;
+        LOG_I("[Bench] Measuring for %d ms\n", BENCHMARK_DURATION_MS);
+      }
+      break;
+    case BENCH_RUNNING:
+      if (now - benchPhaseStartedAt >= BENCHMARK_DURATION_MS) {
+        benchState = BENCH_DONE;
+        benchSnapshot(benchEnd);
+        // Let the upload in flight finish before the report takes the network
+        delay(HTTP_TIMEOUT_MS);
+        reportBenchmark(now - benchPhaseStartedAt, now);
+#if TRANSPORT_MODE == TRANSPORT_PUSH_STREAM
+        closePushStream();
+#endif
+      }
+      break;
+    case BENCH_DONE:
+      break;
+  }
+}
+#else
+bool benchFinished() {
+  return false;
+}
+#endif
+
+// =========================================================
+// Adaptive Quality / Frame Rate Controller
+// =========================================================
+#if ADAPTIVE_MODE
+// One step towards cheaper frames. Returns false when already at the floor.
+bool degradeStream(sensor_t* s) {
+  if (currentJpegQuality < ADAPT_WORST_QUALITY) {
+    currentJpegQuality = min(currentJpegQuality + ADAPT_QUALITY_STEP, ADAPT_WORST_QUALITY);
+    s->set_quality(s, currentJpegQuality);
+  } else if (!ROI_MODE && currentFramesizeIndex > 0) {
+    // ROI_MODE fixes the frame sizes (preview and crop); it only adapts quality and rate
+    currentFramesizeIndex--;
+    s->set_framesize(s, ADAPT_FRAMESIZES[currentFramesizeIndex]);
+  } else if (frameIntervalMs < ADAPT_MAX_FRAME_INTERVAL_MS) {
+    frameIntervalMs = min((uint32_t)(frameIntervalMs * 5 / 4 + 1), (uint32_t)ADAPT_MAX_FRAME_INTERVAL_MS);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// One step back towards the configured frame rate, resolution and quality.
+bool upgradeStream(sensor_t* s) {
+  if (frameIntervalMs > baseFrameIntervalMs) {
+    frameIntervalMs = max((uint32_t)(frameIntervalMs * 4 / 5), baseFrameIntervalMs);
+  } else if (!ROI_MODE && currentFramesizeIndex < ADAPT_FRAMESIZE_COUNT - 1) {
+    currentFramesizeIndex++;
+    s->set_framesize(s, ADAPT_FRAMESIZES[currentFramesizeIndex]);
+  } else if (currentJpegQuality > bestJpegQuality) {
+    currentJpegQuality = max(currentJpegQuality - ADAPT_QUALITY_STEP, bestJpegQuality);
+    s->set_quality(s, currentJpegQuality);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Feeds one upload result into the controller and acts once per window.
+void adaptStream(unsigned long rttMs, bool success) {
+  uploadRttAvgMs = uploadRttAvgMs == 0 ? rttMs : uploadRttAvgMs * 0.8f + rttMs * 0.2f;
+  adaptWindowFrames++;
+  if (!success) {
+    adaptWindowFailures++;
+  }
+  if (adaptWindowFrames < ADAPT_WINDOW_FRAMES) {
+    return;
+  }
+
+  sensor_t* s = esp_camera_sensor_get();
+  int failurePct = adaptWindowFailures * 100 / adaptWindowFrames;
+  int8_t rssi = WiFi.RSSI();
+  adaptWindowFrames = 0;
+  adaptWindowFailures = 0;
+  if (!s) {
+    return;
+  }
+
+  bool overloaded = uploadRttAvgMs > LATENCY_BUDGET_MS || failurePct > ADAPT_MAX_FAILURE_PCT ||
+                    rssi < ADAPT_WEAK_RSSI_DBM;
+  // Only climb back with clear headroom so the controller does not oscillate
+  bool headroom = uploadRttAvgMs < LATENCY_BUDGET_MS / 2 && failurePct == 0 &&
+                  rssi >= ADAPT_WEAK_RSSI_DBM;
+
+  bool changed = false;
+  if (overloaded) {
+    changed = degradeStream(s);
+  } else if (headroom) {
+    changed = upgradeStream(s);
+  }
+
+  if (changed) {
+    LOG_I("[Adapt] RTT %.0f ms, fail %d%%, RSSI %d -> quality %d, framesize %d, interval %u ms\n",
+          uploadRttAvgMs, failurePct, rssi, currentJpegQuality,
+          (int)ADAPT_FRAMESIZES[currentFramesizeIndex], (unsigned)frameIntervalMs);
+  }
+}
+#endif
+
+// Sends a frame over the configured transport and releases its buffer.
+bool transmitFrame(CapturedFrame& frame) {
+#if ADAPTIVE_MODE || BENCHMARK_MODE
+  unsigned long sendStart = millis();
+#endif
+#if BENCHMARK_MODE
+  size_t frameLen = frame.len;
+#endif
+#if TRANSPORT_MODE == TRANSPORT_PUSH_STREAM
+  bool success = pushFrameToStream(frame);
+#elif TRANSPORT_MODE == TRANSPORT_DIRECT_POST
+  bool success = sendFrameDirect(frame);
+#elif TRANSPORT_MODE == TRANSPORT_UDP
+  bool success = sendFrameUdp(frame);
+#else
+  bool success = sendFrameToServer(frame);
+#endif
+  releaseFrame(frame); // No-op when the transport already returned it
+#if ADAPTIVE_MODE
+  adaptStream(millis() - sendStart, success);
+#endif
+#if BENCHMARK_MODE
+  benchRecordSend(millis() - sendStart, frameLen, success);
+#endif
+  return success;
+}
+
+void recordUploadResult(bool success) {
+  portENTER_CRITICAL(&statsMux);
   frameCount++;
   if (success) {
     successCount++;
-    Serial.println("[Capture] ✅ Frame sent successfully");
   } else {
     dropCount++;
-    Serial.println("[Capture] ❌ Frame send failed");
+  }
+  uint32_t frames = frameCount;
+  uint32_t successes = successCount;
+  portEXIT_CRITICAL(&statsMux);
+
+  if (success) {
+    LOG_D("[Capture] ✅ Frame sent successfully\n");
+  } else {
+    LOG_W("[Capture] ❌ Frame send failed\n");
   }
   
   // Status logging
-  if (frameCount % 10 == 0) {
-    Serial.printf("[Stats] Frames: %d, Success: %d, Rate: %.1f%%, Heap: %d\n", 
-                 frameCount, successCount, (float)successCount/frameCount*100, ESP.getFreeHeap());
+  if (frames % 10 == 0) {
+    LOG_D("[Stats] Frames: %d, Success: %d, Rate: %.1f%%, Skipped: %d, ROI: %d, Faces: %d, Buffered: %d, Evicted: %d, Heap: %d, MinHeap: %d, MaxBlock: %d\n", 
+                 frames, successes, (float)successes/frames*100, skippedCount, roiFrameCount, faceFrameCount, outageCount, outageEvicted,
+                 ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+  }
+}
+
+// Uploads a live frame, returns it to the driver and updates the stats.
+void uploadFrame(CapturedFrame& frame) {
+  recordUploadResult(transmitFrame(frame));
+}
+
+// =========================================================
+// Telemetry Heartbeat
+// =========================================================
+// Posts the metrics window since the last report to the heartbeat endpoint
+// on its own short-lived connection, so the frame socket is left alone. The
+// histograms are reset even when the POST fails.
+void sendHeartbeat() {
+  decltype(metrics)::Window window;
+  unsigned long windowMs = metrics.takeWindow(window);
+  unsigned long now = millis();
+
+  static char body[1280];
+  int len = snprintf(body, sizeof(body),
+      "{\"deviceId\":\"%s\",\"uptime\":%lu,\"freeHeap\":%u,\"wifiRssi\":%d,\"status\":\"online\","
+      "\"metrics\":{\"windowMs\":%lu,"
+      "\"heap\":{\"free\":%u,\"min\":%u,\"maxAlloc\":%u},"
+      "\"psram\":{\"free\":%u,\"min\":%u},"
+      "\"stack\":{\"upload\":%u,\"capture\":%u},"
+      "\"wifi\":{\"joins\":%u,\"disconnects\":%u},"
+      "\"frames\":{\"sent\":%u,\"failed\":%u,\"skipped\":%u,\"buffered\":%u,\"evicted\":%u},"
+      "\"phases\":{",
+      config.deviceId, now - deviceStartTime, ESP.getFreeHeap(), WiFi.RSSI(), windowMs,
+      ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap(),
+      ESP.getFreePsram(), ESP.getMinFreePsram(),
+      (unsigned)uxTaskGetStackHighWaterMark(NULL),
+      captureTaskHandle ? (unsigned)uxTaskGetStackHighWaterMark(captureTaskHandle) : 0,
+      wifi.joins(), wifi.disconnects(),
+      successCount, dropCount, skippedCount, outageCount, outageEvicted);
+  if (len < (int)sizeof(body)) {
+    len += metrics.formatPhases(body + len, sizeof(body) - len, METRIC_NAMES, window);
+  }
+  if (len < (int)sizeof(body)) {
+    len += snprintf(body + len, sizeof(body) - len, "}}}");
+  }
+  if (len >= (int)sizeof(body)) {
+    LOG_E("[Metrics] Heartbeat does not fit %u bytes\n", (unsigned)sizeof(body));
+    return;
+  }
+
+  static iot::HttpClient<HEARTBEAT_HEAD_BUFFER, 64> heartbeatHttp;
+  int httpCode = heartbeatHttp.request(serverTarget, "POST", HEARTBEAT_PATH, "application/json",
+                                       (const uint8_t*)body, len, "", HTTP_TIMEOUT_MS, HTTP_TIMEOUT_MS);
+  heartbeatHttp.stop(); // One report a minute; don't hold an idle socket
+  if (httpCode == 200) {
+    LOG_D("[Metrics] Heartbeat sent, %d bytes\n", len);
+    remoteConfig.noticeBody(heartbeatHttp.response()); // Leads the body, so 64 bytes keep it
+  } else {
+    LOG_W("[Metrics] Heartbeat failed. Code: %d\n", httpCode);
+  }
+}
+
+// Called from the upload side between frames
+void serviceMetricsReport() {
+#if METRICS_ENABLED
+  if (WiFi.status() == WL_CONNECTED && millis() - lastMetricsReport >= METRICS_REPORT_INTERVAL_MS) {
+    lastMetricsReport = millis();
+    sendHeartbeat();
+  }
+#endif
+}
+
+// Called from the upload side between frames, like serviceMetricsReport()
+void serviceRemoteConfig() {
+#if !BENCHMARK_MODE
+  // Holds a whole patch; the backend keeps them under 240 bytes
+  static iot::HttpClient<HEARTBEAT_HEAD_BUFFER, 256> configHttp;
+  if (WiFi.status() == WL_CONNECTED && remoteConfig.due()) {
+    if (remoteConfig.service(configHttp, serverTarget, HTTP_TIMEOUT_MS)) {
+      applyTuning();
+    }
+    configHttp.stop(); // Rare; don't hold an idle socket
+  }
+#endif
+}
+
+// Called from the upload side between frames. A download moves one
+// kOtaSliceMs slice per call; the swap is a restart once nothing is left
+// to replay.
+void serviceOta() {
+#if OTA_ENABLED
+  if (ota.onProbation() && successCount > 0) {
+    ota.confirm(); // The new image reached the backend
+  }
+  if (ota.service(serverTarget, HTTP_TIMEOUT_MS) && outageCount == 0) {
+    ota.restart();
+  }
+#endif
+}
+
+// =========================================================
+// Outage Ring Buffer
+// =========================================================
+// Frames are packed back to back into one PSRAM arena; a slot table keeps
+// their offsets in capture order. When space runs out the oldest frames are
+// overwritten, except the one the uploader is currently sending.
+void initOutageBuffer() {
+#if OUTAGE_BUFFER_ENABLED
+  if (!psramFound()) {
+    LOG_W("[Outage] No PSRAM - frames captured offline will be dropped\n");
+    return;
+  }
+  outageArena = (uint8_t*)ps_malloc(OUTAGE_BUFFER_BYTES);
+  outageMutex = xSemaphoreCreateMutex();
+  if (!outageArena || !outageMutex) {
+    LOG_E("[Outage] ❌ Failed to allocate outage buffer\n");
+    outageArena = NULL;
+    return;
+  }
+  LOG_I("[Outage] ✅ %d KB / %d frames reserved for offline capture\n",
+        OUTAGE_BUFFER_BYTES / 1024, OUTAGE_BUFFER_FRAMES);
+#endif
+}
+
+bool outageOverlaps(uint32_t start, uint32_t len) {
+  for (uint16_t i = 0; i < outageCount; i++) {
+    const OutageSlot& slot = outageSlots[(outageHead + i) % OUTAGE_BUFFER_FRAMES];
+    if (slot.offset < start + len && start < slot.offset + slot.len) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Copies a live frame into the ring. Returns false if it could not be kept.
+bool bufferFrameForLater(const CapturedFrame& frame) {
+  if (!outageArena || frame.len > OUTAGE_BUFFER_BYTES) {
+    return false;
+  }
+
+  xSemaphoreTake(outageMutex, portMAX_DELAY);
+  uint32_t start = outageWriteOffset;
+  if (start + frame.len > OUTAGE_BUFFER_BYTES) {
+    start = 0;
+  }
+
+  while (outageCount > 0 && (outageCount == OUTAGE_BUFFER_FRAMES || outageOverlaps(start, frame.len))) {
+    if (outageInFlight) {
+      // Never overwrite the frame that is on the wire; lose the new one instead
+      xSemaphoreGive(outageMutex);
+      return false;
+    }
+    outageHead = (outageHead + 1) % OUTAGE_BUFFER_FRAMES;
+    outageCount--;
+    outageEvicted++;
+  }
+
+  memcpy(outageArena + start, frame.buf, frame.len);
+  OutageSlot& slot = outageSlots[(outageHead + outageCount) % OUTAGE_BUFFER_FRAMES];
+  slot.offset = start;
+  slot.len = frame.len;
+  slot.flags = frame.flags | FRAME_FLAG_REPLAYED;
+  slot.capturedAt = frame.capturedAt;
+  slot.capturedAtEpochMs = frame.capturedAtEpochMs;
+  slot.seq = frame.seq;
+  slot.roi = frame.roi;
+  slot.faceCount = frame.faceCount;
+  memcpy(slot.faces, frame.faces, sizeof(slot.faces));
+  outageCount++;
+  outageWriteOffset = start + frame.len;
+  xSemaphoreGive(outageMutex);
+  return true;
+}
+
+// Keeps a frame captured while offline, or drops it if the ring cannot.
+void stashFrame(CapturedFrame& frame) {
+  if (!bufferFrameForLater(frame)) {
+    countDroppedFrame();
+  }
+  releaseFrame(frame);
+}
+
+// Uploads the oldest buffered frame directly from PSRAM. Returns false when
+// nothing was sent, so callers can stop draining.
+bool replayBufferedFrame() {
+  if (!outageArena) {
+    return false;
+  }
+
+  CapturedFrame frame;
+  xSemaphoreTake(outageMutex, portMAX_DELAY);
+  if (outageCount == 0) {
+    xSemaphoreGive(outageMutex);
+    return false;
+  }
+  const OutageSlot& slot = outageSlots[outageHead];
+  frame.fb = NULL;
+  frame.buf = outageArena + slot.offset;
+  frame.len = slot.len;
+  frame.flags = slot.flags;
+  frame.capturedAt = slot.capturedAt;
+  frame.capturedAtEpochMs = slot.capturedAtEpochMs;
+  frame.seq = slot.seq;
+  frame.roi = slot.roi;
+  frame.faceCount = slot.faceCount;
+  memcpy(frame.faces, slot.faces, sizeof(frame.faces));
+  outageInFlight = true;
+  xSemaphoreGive(outageMutex);
+
+  bool success = transmitFrame(frame);
+  // Keep the frame for the next attempt only if the link went down again
+  bool keep = !success && WiFi.status() != WL_CONNECTED;
+
+  xSemaphoreTake(outageMutex, portMAX_DELAY);
+  outageInFlight = false;
+  if (!keep) {
+    outageHead = (outageHead + 1) % OUTAGE_BUFFER_FRAMES;
+    outageCount--;
+    if (outageCount == 0) {
+      outageWriteOffset = 0;
+    }
+  }
+  xSemaphoreGive(outageMutex);
+
+  if (!keep) {
+    recordUploadResult(success);
+  }
+  return success;
+}
+
+void drainOutageBuffer() {
+  for (int i = 0; i < OUTAGE_DRAIN_BURST && WiFi.status() == WL_CONNECTED; i++) {
+    if (!replayBufferedFrame()) {
+      break;
+    }
   }
 }
 
+// =========================================================
+// Motion Gating
+// =========================================================
+#if MOTION_MODE == MOTION_THUMBNAIL_SAD
+// Decodes a 1/8 scale thumbnail and compares its luma against the previous one.
+bool thumbnailChanged(camera_fb_t* fb) {
+  size_t pixels = (fb->width / 8) * (fb->height / 8);
+  if (pixels == 0 || pixels > MOTION_THUMB_MAX_PIXELS) {
+    return true;
+  }
+
+  static bool thumbMemoryFailed = false;
+  if (thumbMemoryFailed) return true;
+  if (!motionThumbRgb) {
+    motionThumbRgb = (uint8_t*)ps_malloc(MOTION_THUMB_MAX_PIXELS * 2);
+    motionThumbLuma = (uint8_t*)ps_malloc(MOTION_THUMB_MAX_PIXELS);
+    if (!motionThumbRgb || !motionThumbLuma) {
+      // Both or neither, so the check above keeps meaning "ready"
+      free(motionThumbRgb);
+      free(motionThumbLuma);
+      motionThumbRgb = NULL;
+      motionThumbLuma = NULL;
+      thumbMemoryFailed = true;
+      LOG_E("[Motion] ❌ No memory for thumbnails, gating disabled\n");
+      return true;
+    }
+  }
+
+  if (!jpg2rgb565(fb->buf, fb->len, motionThumbRgb, JPG_SCALE_8X)) {
+    return true;
+  }
+
+  // A new resolution (adaptive controller) has no comparable baseline
+  bool baseline = pixels != motionThumbPixels;
+  motionThumbPixels = pixels;
+
+  size_t thumbWidth = fb->width / 8;
+  size_t changed = 0;
+  uint32_t sumX = 0;
+  uint32_t sumY = 0;
+  for (size_t i = 0; i < pixels; i++) {
+    uint16_t px = (motionThumbRgb[i * 2] << 8) | motionThumbRgb[i * 2 + 1];
+    // BT.601 luma from the 5/6/5 channels in fixed point
+    uint8_t luma = ((((px >> 11) & 0x1F) << 3) * 77 + (((px >> 5) & 0x3F) << 2) * 150 +
+                    ((px & 0x1F) << 3) * 29) >> 8;
+    if (!baseline && abs((int)luma - (int)motionThumbLuma[i]) > MOTION_PIXEL_DELTA) {
+      changed++;
+      sumX += i % thumbWidth;
+      sumY += i / thumbWidth;
+    }
+    motionThumbLuma[i] = luma;
+  }
+
+  // Centroid of the changed pixels aims the next ROI crop
+  if (changed > 0) {
+    size_t thumbHeight = pixels / thumbWidth;
+    roiCenterX = (sumX * 2 + changed) * ROI_SENSOR_WIDTH / (2 * changed * thumbWidth);
+    roiCenterY = (sumY * 2 + changed) * ROI_SENSOR_HEIGHT / (2 * changed * thumbHeight);
+  }
+
+  return baseline || changed * 100 > pixels * MOTION_CHANGED_PCT;
+}
+#endif
+
+// Decides whether a frame goes out and tags it with FRAME_FLAG_* bits.
+bool shouldUploadFrame(camera_fb_t* fb, uint8_t& flags) {
+#if MOTION_MODE == MOTION_OFF
+  flags = FRAME_FLAG_MOTION;
+  return true;
+#else
+  unsigned long now = millis();
+  bool motion;
+
+#if MOTION_MODE == MOTION_THUMBNAIL_SAD
+  motion = thumbnailChanged(fb);
+#else
+  size_t prevSize = lastJpegSize;
+  size_t delta = fb->len > prevSize ? fb->len - prevSize : prevSize - fb->len;
+  motion = prevSize == 0 || delta * 100 > prevSize * MOTION_SIZE_DELTA_PCT;
+#endif
+  lastJpegSize = fb->len;
+
+  flags = 0;
+  if (motion) {
+    lastMotionAt = now;
+    flags |= FRAME_FLAG_MOTION;
+  }
+
+  bool active = lastMotionAt != 0 && now - lastMotionAt < MOTION_HOLD_MS;
+  bool keyframeDue = lastKeyframeAt == 0 || now - lastKeyframeAt >= MOTION_KEYFRAME_INTERVAL_MS;
+  if (!active && !keyframeDue) {
+    return false;
+  }
+
+  if (keyframeDue) {
+    flags |= FRAME_FLAG_KEYFRAME;
+    lastKeyframeAt = now;
+  }
+  return true;
+#endif
+}
+
+// =========================================================
+// Face Detection
+// =========================================================
+#if FACE_DETECT_MODE
+// Decodes the frame (scaled down to FACE_DETECT_MAX_PIXELS), runs the
+// detector and fills frame.faces with the largest boxes in frame pixels.
+// Returns the number of faces kept.
+uint8_t detectFaces(camera_fb_t* fb, CapturedFrame& frame) {
+  int shift = 0;
+  while (shift < JPG_SCALE_8X && (fb->width >> shift) * (fb->height >> shift) > FACE_DETECT_MAX_PIXELS) {
+    shift++;
+  }
+  int width = fb->width >> shift;
+  int height = fb->height >> shift;
+  if (width * height > FACE_DETECT_MAX_PIXELS) {
+    return 0;
+  }
+
+  if (!faceRgb) {
+    faceRgb = (uint8_t*)ps_malloc(FACE_DETECT_MAX_PIXELS * 2);
+    if (!faceRgb) {
+      LOG_E("[Face] ❌ No memory for the detector input\n");
+      return 0;
+    }
+  }
+  if (!jpg2rgb565(fb->buf, fb->len, faceRgb, (jpg_scale_t)shift)) {
+    return 0;
+  }
+
+  unsigned long started = millis();
+  std::list<dl::detect::result_t>& candidates = faceStage1.infer((uint16_t*)faceRgb, {height, width, 3});
+  std::list<dl::detect::result_t>& results = faceStage2.infer((uint16_t*)faceRgb, {height, width, 3}, candidates);
+
+  // Keep the largest boxes; the first one aims the ROI crop
+  uint8_t count = 0;
+  for (const dl::detect::result_t& r : results) {
+    int x1 = constrain(r.box[0], 0, width - 1);
+    int y1 = constrain(r.box[1], 0, height - 1);
+    int x2 = constrain(r.box[2], x1, width - 1);
+    int y2 = constrain(r.box[3], y1, height - 1);
+    FaceBox box = { (uint16_t)(x1 << shift), (uint16_t)(y1 << shift),
+                    (uint16_t)((x2 - x1) << shift), (uint16_t)((y2 - y1) << shift),
+                    (uint8_t)constrain((int)(r.score * 100), 0, 100) };
+
+    uint8_t pos = count < FACE_MAX_BOXES ? count++ : FACE_MAX_BOXES;
+    while (pos > 0 && (uint32_t)frame.faces[pos - 1].w * frame.faces[pos - 1].h < (uint32_t)box.w * box.h) {
+      if (pos < FACE_MAX_BOXES) {
+        frame.faces[pos] = frame.faces[pos - 1];
+      }
+      pos--;
+    }
+    if (pos < FACE_MAX_BOXES) {
+      frame.faces[pos] = box;
+    }
+  }
+
+  if (count > 0) {
+    const FaceBox& face = frame.faces[0];
+    roiCenterX = (uint32_t)(face.x + face.w / 2) * ROI_SENSOR_WIDTH / fb->width;
+    roiCenterY = (uint32_t)(face.y + face.h / 2) * ROI_SENSOR_HEIGHT / fb->height;
+    faceFrameCount++;
+    LOG_D("[Face] %u face(s) in %lu ms\n", results.size(), millis() - started);
+  }
+  return count;
+}
+#endif
+
+// =========================================================
+// ROI Crops
+// =========================================================
+#if ROI_MODE
+// Moves the OV2640 window to a ROI_WINDOW_WIDTH x ROI_WINDOW_HEIGHT crop of
+// the UXGA array around (cx, cy), output 1:1. For the OV2640, set_res_raw()
+// takes the sensor mode in startX (0 = UXGA), the window in offset/total
+// and the DSP output size in output; the other arguments are unused.
+void applyRoiWindow(sensor_t* s, uint16_t cx, uint16_t cy) {
+  int x = constrain((int)cx - ROI_WINDOW_WIDTH / 2, 0, ROI_SENSOR_WIDTH - ROI_WINDOW_WIDTH) & ~3;
+  int y = constrain((int)cy - ROI_WINDOW_HEIGHT / 2, 0, ROI_SENSOR_HEIGHT - ROI_WINDOW_HEIGHT) & ~3;
+  s->set_res_raw(s, 0, 0, 0, 0, x, y, ROI_WINDOW_WIDTH, ROI_WINDOW_HEIGHT,
+                 ROI_WINDOW_WIDTH, ROI_WINDOW_HEIGHT, false, false);
+  currentRoi = { (uint16_t)x, (uint16_t)y, ROI_WINDOW_WIDTH, ROI_WINDOW_HEIGHT };
+}
+
+// Starts a crop burst on a server request, or on motion (a detected face in
+// FACE_DETECT_MODE) when the last burst is old enough.
+void maybeTriggerRoi(uint8_t flags) {
+  if (roiShotsLeft > 0) {
+    return;
+  }
+  unsigned long now = millis();
+  uint8_t trigger = FACE_DETECT_MODE ? FRAME_FLAG_FACE : FRAME_FLAG_MOTION;
+  bool motion = (flags & trigger) && now - lastRoiAt >= ROI_MIN_INTERVAL_MS;
+  if (roiRequested || motion) {
+    roiRequested = false;
+    roiShotsLeft = ROI_BURST_FRAMES;
+    lastRoiAt = now;
+  }
+}
+
+// Puts the sensor in the mode the next frame needs. Returns true when the
+// next frame is a ROI crop. The frames exposed during a switch are dropped.
+bool prepareRoiCapture() {
+  bool wantRoi = roiShotsLeft > 0;
+  if (wantRoi == sensorInRoi) {
+    return wantRoi;
+  }
+
+  sensor_t* s = esp_camera_sensor_get();
+  if (!s) {
+    return false;
+  }
+  if (wantRoi) {
+    applyRoiWindow(s, roiCenterX, roiCenterY);
+  } else {
+    s->set_framesize(s, ROI_PREVIEW_FRAMESIZE);
+  }
+  sensorInRoi = wantRoi;
+
+  for (int i = 0; i < ROI_SETTLE_FRAMES; i++) {
+    camera_fb_t* stale = esp_camera_fb_get();
+    if (stale) {
+      esp_camera_fb_return(stale);
+    }
+  }
+  return wantRoi;
+}
+#endif
+
+// Grabs a frame, validates it and applies motion gating. Returns false when
+// there is nothing to upload (failed capture counts as a drop, a static frame
+// as skipped).
+bool captureFrame(CapturedFrame& frame) {
+#if ROI_MODE
+  bool roiFrame = prepareRoiCapture();
+  size_t minJpegBytes = roiFrame ? 5000 : PREVIEW_MIN_JPEG_BYTES;
+#else
+  bool roiFrame = false;
+  size_t minJpegBytes = 5000;
+#endif
+
+  uint32_t captureStarted = metrics.start();
+  camera_fb_t* fb = esp_camera_fb_get();
+  metrics.end(METRIC_CAPTURE, captureStarted);
+  if (!fb) {
+    LOG_W("[Capture] Failed to get frame buffer\n");
+    countDroppedFrame();
+    return false;
+  }
+
+  LOG_D("[Capture] Frame size: %d bytes\n", fb->len);
+  
+  // Validate frame size
+  if (fb->len < minJpegBytes || fb->len > 800000) {
+    LOG_W("[Capture] Invalid frame size: %d bytes\n", fb->len);
+    esp_camera_fb_return(fb);
+    countDroppedFrame();
+    return false;
+  }
+
+  uint8_t flags = 0;
+  frame.roi = {0, 0, 0, 0};
+  frame.faceCount = 0;
+  if (roiFrame) {
+    // Crops skip motion gating; they must not become the motion baseline
+    flags = FRAME_FLAG_ROI;
+    frame.roi = currentRoi;
+    roiShotsLeft--;
+    roiFrameCount++;
+  } else {
+    uint32_t processStarted = metrics.start();
+    bool upload = shouldUploadFrame(fb, flags);
+#if FACE_DETECT_MODE
+    // The detector is expensive, so it only sees frames the motion gate passed
+    frame.faceCount = upload ? detectFaces(fb, frame) : 0;
+    if (frame.faceCount > 0) {
+      flags |= FRAME_FLAG_FACE;
+    } else if (FACE_UPLOAD_FILTER && !(flags & FRAME_FLAG_KEYFRAME)) {
+      upload = false;
+    }
+#endif
+#if ROI_MODE
+    flags |= FRAME_FLAG_PREVIEW;
+    maybeTriggerRoi(flags);
+#endif
+    metrics.end(METRIC_PROCESS, processStarted);
+    if (!upload) {
+      esp_camera_fb_return(fb);
+      skippedCount++;
+      return false;
+    }
+  }
+
+  frame.fb = fb;
+  frame.buf = fb->buf;
+  frame.len = fb->len;
+  frame.flags = flags;
+  frame.seq = ++frameSeq;
+
+  // fb->timestamp is the esp_timer time the driver started the frame; with
+  // CAMERA_GRAB_LATEST it can be a frame interval or more old already
+  int64_t captureUs = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+  int64_t waitedMs = (esp_timer_get_time() - captureUs) / 1000;
+  if (waitedMs < 0 || waitedMs > 10000) {
+    waitedMs = 0;   // Driver without esp_timer stamps
+  }
+  frame.capturedAt = millis() - (unsigned long)waitedMs;
+  uint64_t wallMs = epochMs();
+  frame.capturedAtEpochMs = wallMs ? wallMs - waitedMs : 0;
+  return true;
+}
+
+void captureAndSendFrame() {
+  CapturedFrame frame;
+  if (!captureFrame(frame)) {
+    return;
+  }
+  if (WiFi.status() == WL_CONNECTED) {
+    uploadFrame(frame);
+  } else {
+    stashFrame(frame);
+  }
+}
+
+// =========================================================
+// Dual-core Capture/Upload Pipeline
+// =========================================================
+// The capture task paces itself to TARGET_FPS and hands frame buffers to the
+// upload task through a bounded queue, so the sensor keeps exposing the next
+// frame while the previous one is still on the wire.
+void captureTask(void* param) {
+  TickType_t lastWake = xTaskGetTickCount();
+
+  for (;;) {
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(frameIntervalMs));
+    if (benchFinished()) {
+      continue;
+    }
+    metricCaptureSlot();
+
+    CapturedFrame frame;
+    if (!captureFrame(frame)) {
+      continue;
+    }
+
+    // Offline: keep capturing into the outage ring
+    if (WiFi.status() != WL_CONNECTED) {
+      stashFrame(frame);
+      continue;
+    }
+
+    // Uploader is still busy with older frames - drop this one instead of stalling
+    if (xQueueSend(frameQueue, &frame, 0) != pdTRUE) {
+      LOG_W("[Pipeline] Upload queue full, dropping frame\n");
+      releaseFrame(frame);
+      countDroppedFrame();
+    }
+  }
+}
+
+void uploadTask(void* param) {
+  CapturedFrame frame;
+
+  for (;;) {
+    drainOutageBuffer();
+
+    // Poll while a backlog is waiting so replay continues between live frames
+    TickType_t wait = (outageCount > 0 && WiFi.status() == WL_CONNECTED) ? 0 : pdMS_TO_TICKS(100);
+    if (xQueueReceive(frameQueue, &frame, wait) == pdTRUE) {
+      uploadFrame(frame);
+    }
+    serviceMetricsReport();
+    serviceRemoteConfig();
+    serviceOta();
+  }
+}
+
+void startPipeline() {
+  frameQueue = xQueueCreate(FRAME_QUEUE_DEPTH, sizeof(CapturedFrame));
+  if (!frameQueue) {
+    LOG_E("[Pipeline] ❌ Failed to create frame queue, falling back to sequential mode\n");
+    return;
+  }
+
+  xTaskCreatePinnedToCore(uploadTask, "frameUpload", UPLOAD_TASK_STACK, NULL, 2,
+                          &uploadTaskHandle, UPLOAD_TASK_CORE);
+  xTaskCreatePinnedToCore(captureTask, "frameCapture",
+                          CAPTURE_TASK_STACK + (FACE_DETECT_MODE ? FACE_DETECT_STACK : 0), NULL, 3,
+                          &captureTaskHandle, CAPTURE_TASK_CORE);
+  LOG_I("[Pipeline] ✅ Capture on core %d, upload on core %d, queue depth %d\n",
+        CAPTURE_TASK_CORE, UPLOAD_TASK_CORE, FRAME_QUEUE_DEPTH);
+}
+
 // ===========================
 // Main Program
 // ===========================
@@ -266,34 +2074,69 @@ void setup() {
   delay(1000); // Give serial time to initialize
   deviceStartTime = millis();
   
-  Serial.println();
-  Serial.println("=== ESP32-CAM OV2640 Initialization ===");
-  Serial.printf("Device ID: %s\n", DEVICE_ID);
-  Serial.printf("Server URL: %s\n", SERVER_URL);
-  Serial.printf("Target FPS: %d\n", TARGET_FPS);
-  Serial.printf("Free Heap: %d bytes\n", ESP.getFreeHeap());
+  loadConfig();
+#if OTA_ENABLED
+  ota.begin();
+#endif
+
+  LOG_I("\n");
+  LOG_I("=== ESP32-CAM OV2640 Initialization ===\n");
+  LOG_I("Device ID: %s\n", config.deviceId);
+  LOG_I("Server URL: %s\n", serverUrl);
+  LOG_I("Target FPS: %d\n", config.targetFps);
+  LOG_I("Free Heap: %d bytes\n", ESP.getFreeHeap());
   
-  initWiFi();
+  // The join runs in the background while the camera comes up; frames
+  // captured before it completes go to the outage ring
+  wifi.begin(wifiSettings);
   initCamera();
+  applyTuning();
+  initOutageBuffer();
+
+#if PIPELINE_MODE
+  startPipeline();
+#endif
   
-  Serial.println("Setup complete. Starting image capture loop...");
-  Serial.println("Device will register automatically with server on first frame");
+  LOG_I("Setup complete. Starting image capture loop...\n");
+  LOG_I("Device will register automatically with server on first frame\n");
 }
 
 void loop() {
   unsigned long currentTime = millis();
   
-  // Check WiFi connection
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("[Loop] WiFi disconnected, reconnecting...");
-    initWiFi();
+  configStore.serviceConsole(config);
+
+  // Reconnect in the background; capture never waits for WiFi
+  if (wifi.service() && outageCount > 0) {
+    LOG_I("[WiFi] %d frames buffered, replaying\n", outageCount);
+  }
+  serviceTimeSync();
+#if BENCHMARK_MODE
+  serviceBenchmark();
+  if (benchFinished()) {
+    delay(100);
     return;
   }
-  
+#endif
+
+#if PIPELINE_MODE
+  // Capture and upload run in their own tasks once the pipeline is up
+  if (frameQueue) {
+    delay(100);
+    return;
+  }
+#endif
+
+  drainOutageBuffer();
+  serviceMetricsReport();
+  serviceRemoteConfig();
+  serviceOta();
+
   // Frame capture timing
-  if (currentTime - lastFrameTime >= FRAME_INTERVAL_MS) {
+  if (currentTime - lastFrameTime >= frameIntervalMs) {
     lastFrameTime = currentTime;
-    Serial.printf("\n[Loop] === Frame %d at %lu ms ===\n", frameCount + 1, currentTime);
+    metricCaptureSlot();
+    LOG_D("\n[Loop] === Frame %d at %lu ms ===\n", frameCount + 1, currentTime);
     captureAndSendFrame();
   }
   
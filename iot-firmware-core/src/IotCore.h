@@ -0,0 +1,34 @@
+#pragma once
+
+// Shared firmware core for the ESP32 sketches (header-only).
+//
+// Install by linking or copying iot-firmware-core/ into the Arduino
+// libraries folder, or pass it to arduino-cli with
+// --library path/to/iot-firmware-core. Define LOG_LEVEL before the include,
+// then build everything from one device profile:
+//
+//   #define LOG_LEVEL LOG_LEVEL_INFO
+//   #include <IotCore.h>
+//
+//   struct Device : iot::CameraProfile {};
+//   RTC_DATA_ATTR iot::WifiCache wifiCache = {};
+//   iot::WifiManager<Device> wifi(wifiCache);
+//   iot::MetricsFor<Device, METRIC_COUNT> metrics;
+//
+// Components a profile switches off fail to compile (static_assert) or,
+// for metrics, collapse to empty no-ops, so nothing unused reaches flash.
+// A sketch without a network defines IOT_CORE_OFFLINE before the include,
+// which also keeps the WiFi and Preferences libraries out of its build.
+
+#include "iot_core/Profile.h"
+#include "iot_core/Log.h"
+#include "iot_core/Metrics.h"
+#ifndef IOT_CORE_OFFLINE
+#include "iot_core/HttpClient.h"
+#include "iot_core/Config.h"
+#include "iot_core/RemoteConfig.h"
+#include "iot_core/OtaUpdater.h"
+#include "iot_core/WifiManager.h"
+#include "iot_core/MqttClient.h"
+#endif
+#include "iot_core/BuzzerEngine.h"
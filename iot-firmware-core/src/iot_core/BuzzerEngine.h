@@ -0,0 +1,172 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+namespace iot {
+
+// One step of a buzzer pattern: a tone, a steady on, or a rest
+const uint16_t BUZZER_DC = 1;  // Step "frequency" for a steady on (active buzzer)
+
+struct BuzzerStep {
+  uint16_t frequency;   // Hz; 0 = silent, BUZZER_DC = steady on
+  uint16_t durationMs;
+};
+
+struct BuzzerPattern {
+  const BuzzerStep* steps;
+  uint8_t count;
+  uint8_t repeats;      // Passes through the table; 0 = until stopped
+};
+
+#define IOT_BUZZER_PATTERN(steps, repeats) { steps, sizeof(steps) / sizeof(steps[0]), repeats }
+
+const BuzzerPattern BUZZER_SILENCE = { NULL, 0, 1 };
+
+// Pattern engine: the buzzer pin is driven by LEDC PWM and an esp_timer
+// one-shot steps through the pattern table, so playing never blocks. The
+// pending pattern is handed over by play(); everything else belongs to the
+// timer callback, the only code that touches the pins once begin() is done.
+template <typename Profile>
+class BuzzerEngine {
+  static_assert(Profile::kBuzzer && Profile::kBuzzerPin >= 0, "This device profile has no buzzer");
+
+ public:
+  void begin() {
+    if (Profile::kBuzzerVccPin >= 0) {
+      pinMode(Profile::kBuzzerVccPin, OUTPUT);
+      digitalWrite(Profile::kBuzzerVccPin, LOW);
+    }
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    ledcAttach(Profile::kBuzzerPin, LEDC_BASE_FREQ, LEDC_RESOLUTION);
+#else
+    ledcSetup(Profile::kBuzzerLedcChannel, LEDC_BASE_FREQ, LEDC_RESOLUTION);
+    ledcAttachPin(Profile::kBuzzerPin, Profile::kBuzzerLedcChannel);
+#endif
+    ledcWrite(ledcTarget(), 0);
+
+    esp_timer_create_args_t args = {};
+    args.callback = &BuzzerEngine::onTimer;
+    args.arg = this;
+    args.name = "buzzer";
+    esp_timer_create(&args, &timer);
+  }
+
+  // Stops the engine and hands the pin back from LEDC, silent
+  void end() {
+    esp_timer_stop(timer);
+    output(0);
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    ledcDetach(Profile::kBuzzerPin);
+#else
+    ledcDetachPin(Profile::kBuzzerPin);
+#endif
+  }
+
+  // Starts a pattern from its first step, replacing whatever is playing.
+  // repeats = 0 uses the pattern's own repeat count. Safe from any task.
+  void play(const BuzzerPattern& pattern, uint8_t repeats = 0) {
+    portENTER_CRITICAL(&mux);
+    pending = &pattern;
+    pendingRepeats = repeats ? repeats : pattern.repeats;
+    portEXIT_CRITICAL(&mux);
+
+    // Fire the callback now; it may re-arm itself between stop and start,
+    // so try twice
+    for (int i = 0; i < 2; i++) {
+      esp_timer_stop(timer);
+      if (esp_timer_start_once(timer, 0) == ESP_OK) break;
+    }
+  }
+
+  void stop() { play(BUZZER_SILENCE); }
+
+  // One-off tone (for buzzers that follow the PWM frequency)
+  void playTone(uint16_t frequency, uint16_t durationMs) {
+    portENTER_CRITICAL(&mux);
+    toneStep.frequency = frequency;
+    toneStep.durationMs = durationMs;
+    portEXIT_CRITICAL(&mux);
+    play(tonePattern);
+  }
+
+  // A pattern is queued or still running
+  bool playing() const { return pending != NULL || current != NULL; }
+
+  // The buzzer is making sound right now
+  bool sounding() const { return soundingNow; }
+
+ private:
+  static const uint8_t LEDC_RESOLUTION = 10;
+  static const uint32_t LEDC_BASE_FREQ = 2000;
+
+  static uint8_t ledcTarget() {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    return Profile::kBuzzerPin;
+#else
+    return Profile::kBuzzerLedcChannel;
+#endif
+  }
+
+  void output(uint16_t frequency) {
+    if (Profile::kBuzzerVccPin >= 0) {
+      digitalWrite(Profile::kBuzzerVccPin, frequency ? HIGH : LOW);
+    }
+    if (frequency == BUZZER_DC) {
+      ledcWrite(ledcTarget(), 1 << LEDC_RESOLUTION); // 100 % duty
+    } else if (frequency) {
+      ledcWriteTone(ledcTarget(), frequency);
+    } else {
+      ledcWrite(ledcTarget(), 0);
+    }
+    soundingNow = frequency != 0;
+  }
+
+  // Runs on the esp_timer task: apply the next step and re-arm for its length
+  static void onTimer(void* arg) {
+    static_cast<BuzzerEngine*>(arg)->step();
+  }
+
+  void step() {
+    portENTER_CRITICAL(&mux);
+    if (pending) {
+      current = pending;
+      passesLeft = pendingRepeats;
+      pending = NULL;
+      stepIndex = 0;
+    } else if (current && ++stepIndex >= current->count) {
+      stepIndex = 0;
+      if (passesLeft == 1) {
+        current = NULL; // Last pass done
+      } else if (passesLeft > 1) {
+        passesLeft--;
+      }
+    }
+    const BuzzerPattern* pattern = current;
+    BuzzerStep next = {0, 0};
+    if (pattern && pattern->count > 0) {
+      next = pattern->steps[stepIndex];
+    } else {
+      current = NULL;
+    }
+    portEXIT_CRITICAL(&mux);
+
+    output(next.frequency);
+    if (next.durationMs > 0) {
+      esp_timer_start_once(timer, (uint64_t)next.durationMs * 1000ULL);
+    }
+  }
+
+  esp_timer_handle_t timer = NULL;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  const BuzzerPattern* volatile pending = NULL;
+  uint8_t pendingRepeats = 0;
+  const BuzzerPattern* volatile current = NULL;
+  uint8_t stepIndex = 0;
+  uint8_t passesLeft = 0;
+  volatile bool soundingNow = false;
+  BuzzerStep toneStep = {0, 0};        // Backs playTone()'s one-off pattern
+  BuzzerPattern tonePattern = { &toneStep, 1, 1 };
+};
+
+}  // namespace iot
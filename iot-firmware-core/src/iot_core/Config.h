@@ -0,0 +1,210 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <stddef.h>
+
+namespace iot {
+
+// Persistent settings (.env style KEY=VALUE) described by a field table, so
+// loading, saving, printing and the serial SET command are written once for
+// every sketch's Config struct instead of once per field:
+//
+//   const iot::ConfigField CONFIG_FIELDS[] = {
+//     IOT_CONFIG_STRING(Config, wifiSsid, "WIFI_SSID"),
+//     IOT_CONFIG_INT(Config, serverPort, "SERVER_PORT"),
+//   };
+//   iot::ConfigStore<Device, Config> configStore(CONFIG_FIELDS, defaultConfig);
+//
+// Fields declared with the IOT_CONFIG_REMOTE_* macros can also be changed by
+// a patch from the backend (applyPatch(), see RemoteConfig.h); connection
+// settings stay serial-only so a bad patch cannot take a device off the air.
+enum ConfigType : uint8_t { CONFIG_STRING, CONFIG_INT, CONFIG_UINT, CONFIG_FLOAT };
+enum ConfigFlags : uint8_t { CONFIG_LOCAL = 0, CONFIG_REMOTE = 1 };
+
+struct ConfigField {
+  const char* key;      // Preferences key and the name used on the console
+  ConfigType type;
+  uint16_t offset;
+  uint16_t size;        // Buffer size for strings
+  uint8_t flags;
+};
+
+#define IOT_CONFIG_FIELD(Struct, member, key, type, flags) \
+  { key, type, (uint16_t)offsetof(Struct, member), (uint16_t)sizeof(((Struct*)0)->member), flags }
+#define IOT_CONFIG_STRING(Struct, member, key) IOT_CONFIG_FIELD(Struct, member, key, iot::CONFIG_STRING, iot::CONFIG_LOCAL)
+#define IOT_CONFIG_INT(Struct, member, key) IOT_CONFIG_FIELD(Struct, member, key, iot::CONFIG_INT, iot::CONFIG_LOCAL)
+#define IOT_CONFIG_UINT(Struct, member, key) IOT_CONFIG_FIELD(Struct, member, key, iot::CONFIG_UINT, iot::CONFIG_LOCAL)
+#define IOT_CONFIG_FLOAT(Struct, member, key) IOT_CONFIG_FIELD(Struct, member, key, iot::CONFIG_FLOAT, iot::CONFIG_LOCAL)
+#define IOT_CONFIG_REMOTE_INT(Struct, member, key) IOT_CONFIG_FIELD(Struct, member, key, iot::CONFIG_INT, iot::CONFIG_REMOTE)
+#define IOT_CONFIG_REMOTE_UINT(Struct, member, key) IOT_CONFIG_FIELD(Struct, member, key, iot::CONFIG_UINT, iot::CONFIG_REMOTE)
+#define IOT_CONFIG_REMOTE_FLOAT(Struct, member, key) IOT_CONFIG_FIELD(Struct, member, key, iot::CONFIG_FLOAT, iot::CONFIG_REMOTE)
+
+template <typename Profile, typename T>
+class ConfigStore {
+  static_assert(Profile::kConfigStore, "This device profile has no persistent config");
+
+ public:
+  template <size_t N>
+  ConfigStore(const ConfigField (&fields)[N], const T& defaults, const char* ns = "config")
+      : fields(fields), count(N), defaults(defaults), ns(ns) {}
+
+  // Stored values, or the defaults for keys never written
+  void load(T& cfg) {
+    Preferences prefs;
+    prefs.begin(ns, true);
+    for (size_t i = 0; i < count; i++) {
+      const ConfigField& f = fields[i];
+      uint8_t* dst = (uint8_t*)&cfg + f.offset;
+      const uint8_t* def = (const uint8_t*)&defaults + f.offset;
+      switch (f.type) {
+        case CONFIG_STRING:
+          strlcpy((char*)dst, prefs.getString(f.key, (const char*)def).c_str(), f.size);
+          break;
+        case CONFIG_INT:
+          *(int*)dst = prefs.getInt(f.key, *(const int*)def);
+          break;
+        case CONFIG_UINT:
+          *(uint32_t*)dst = prefs.getUInt(f.key, *(const uint32_t*)def);
+          break;
+        case CONFIG_FLOAT:
+          *(float*)dst = prefs.getFloat(f.key, *(const float*)def);
+          break;
+      }
+    }
+    prefs.end();
+  }
+
+  void save(const T& cfg) {
+    Preferences prefs;
+    prefs.begin(ns, false);
+    for (size_t i = 0; i < count; i++) {
+      const ConfigField& f = fields[i];
+      const uint8_t* src = (const uint8_t*)&cfg + f.offset;
+      switch (f.type) {
+        case CONFIG_STRING: prefs.putString(f.key, (const char*)src); break;
+        case CONFIG_INT: prefs.putInt(f.key, *(const int*)src); break;
+        case CONFIG_UINT: prefs.putUInt(f.key, *(const uint32_t*)src); break;
+        case CONFIG_FLOAT: prefs.putFloat(f.key, *(const float*)src); break;
+      }
+    }
+    prefs.end();
+    Serial.println("Configuration saved to flash memory!");
+  }
+
+  void print(const T& cfg) const {
+    for (size_t i = 0; i < count; i++) {
+      const ConfigField& f = fields[i];
+      const uint8_t* src = (const uint8_t*)&cfg + f.offset;
+      switch (f.type) {
+        case CONFIG_STRING: Serial.printf("%s=%s\n", f.key, (const char*)src); break;
+        case CONFIG_INT: Serial.printf("%s=%d\n", f.key, *(const int*)src); break;
+        case CONFIG_UINT: Serial.printf("%s=%u\n", f.key, *(const uint32_t*)src); break;
+        case CONFIG_FLOAT: Serial.printf("%s=%.2f\n", f.key, *(const float*)src); break;
+      }
+    }
+  }
+
+  // Parses value into the field named key; false for an unknown key, or
+  // with remoteOnly for a field not declared IOT_CONFIG_REMOTE_*
+  bool set(T& cfg, const char* key, const char* value, bool remoteOnly = false) const {
+    for (size_t i = 0; i < count; i++) {
+      const ConfigField& f = fields[i];
+      if (strcmp(f.key, key) != 0) continue;
+      if (remoteOnly && !(f.flags & CONFIG_REMOTE)) return false;
+      uint8_t* dst = (uint8_t*)&cfg + f.offset;
+      switch (f.type) {
+        case CONFIG_STRING: strlcpy((char*)dst, value, f.size); break;
+        case CONFIG_INT: *(int*)dst = atoi(value); break;
+        case CONFIG_UINT: *(uint32_t*)dst = strtoul(value, NULL, 10); break;
+        case CONFIG_FLOAT: *(float*)dst = atof(value); break;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // Applies KEY=VALUE lines from the backend to the remote fields, in place
+  // (the buffer is split up). Keys that are unknown or local-only are
+  // listed comma-separated in rejected. Returns the number applied; the
+  // caller saves.
+  int applyPatch(T& cfg, char* patch, char* rejected, size_t rejectedSize) const {
+    int applied = 0;
+    size_t rejectedLen = 0;
+    rejected[0] = '\0';
+    char* save = NULL;
+    for (char* line = strtok_r(patch, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+      char* equals = strchr(line, '=');
+      if (!equals) continue;
+      *equals = '\0';
+      if (set(cfg, line, equals + 1, true)) {
+        applied++;
+      } else if (rejectedLen < rejectedSize) {
+        rejectedLen += snprintf(rejected + rejectedLen, rejectedSize - rejectedLen, "%s%s",
+                                rejectedLen ? "," : "", line);
+      }
+    }
+    return applied;
+  }
+
+  void reset(T& cfg) const {
+    memcpy(&cfg, &defaults, sizeof(T));
+  }
+
+  // Serial config console: CONFIG, SET KEY=VALUE, RESET, HEAP, RESTART.
+  // Reads one line per call when one is waiting. This is the device's user
+  // interface, not logging, so it prints at every LOG_LEVEL.
+  void serviceConsole(T& cfg) {
+    if (!Serial.available()) return;
+    String input = Serial.readStringUntil('\n');
+    input.trim();
+
+    if (input == "CONFIG") {
+      Serial.println("\n=== Current Configuration ===");
+      print(cfg);
+      Serial.println("============================\n");
+
+    } else if (input == "RESET") {
+      reset(cfg);
+      save(cfg);
+      Serial.println("Configuration reset to defaults. Restarting...");
+      delay(1000);
+      ESP.restart();
+
+    } else if (input.startsWith("SET ")) {
+      // SET WIFI_SSID=MyWiFi
+      String command = input.substring(4);
+      int equals = command.indexOf('=');
+      if (equals != -1) {
+        String key = command.substring(0, equals);
+        String value = command.substring(equals + 1);
+        if (set(cfg, key.c_str(), value.c_str())) {
+          save(cfg);
+          Serial.printf("Updated %s=%s\n", key.c_str(), value.c_str());
+          Serial.println("Send 'RESTART' to apply WiFi changes or they will apply on next boot.");
+        } else {
+          Serial.printf("Unknown configuration key: %s\n", key.c_str());
+        }
+      }
+
+    } else if (input == "HEAP") {
+      // Min free is the heap high-water mark since boot; a shrinking
+      // largest block means fragmentation
+      Serial.printf("[Heap] free=%u min_free=%u max_alloc=%u\n",
+                    ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+
+    } else if (input == "RESTART") {
+      Serial.println("Restarting ESP32...");
+      delay(1000);
+      ESP.restart();
+    }
+  }
+
+ private:
+  const ConfigField* fields;
+  size_t count;
+  const T& defaults;
+  const char* ns;
+};
+
+}  // namespace iot
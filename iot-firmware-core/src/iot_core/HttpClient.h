@@ -0,0 +1,169 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+namespace iot {
+
+// Reads one CRLF-terminated line into buf without allocating; a longer line
+// is cut at size - 1. Returns false on timeout or when the peer closes.
+inline bool readLine(WiFiClient& c, char* buf, size_t size, unsigned long deadline) {
+  size_t len = 0;
+  while ((long)(millis() - deadline) < 0) {
+    if (!c.available()) {
+      if (!c.connected()) {
+        return false;
+      }
+      delay(1);
+      continue;
+    }
+    char ch = (char)c.read();
+    if (ch == '\n') {
+      if (len > 0 && buf[len - 1] == '\r') {
+        len--;
+      }
+      buf[len] = '\0';
+      return true;
+    }
+    if (len < size - 1) {
+      buf[len++] = ch;
+    }
+  }
+  return false;
+}
+
+// Where requests go and who is asking. The strings must outlive the client.
+struct HttpTarget {
+  const char* host;
+  uint16_t port;
+  const char* deviceId;   // Sent as Device-Id
+  const char* apiKey;     // Sent as X-API-Key; NULL or empty = none
+};
+
+// Minimal HTTP/1.1 over a kept-alive WiFiClient. The request head is
+// formatted into a fixed buffer and the response body lands in another, so
+// a request in steady state makes no heap allocations (HTTPClient builds
+// Strings for the URL, every header and the body). One client per task:
+// requests never share a socket.
+template <size_t HeadSize, size_t ResponseSize>
+class HttpClient {
+ public:
+  // Returns the HTTP status code, or -1 on a connection, write or read
+  // failure (the socket is then dropped and the next request reconnects).
+  int request(const HttpTarget& target, const char* method, const char* path,
+              const char* contentType, const uint8_t* body, size_t bodyLen,
+              const char* extraHeaders, unsigned long timeoutMs, unsigned long connectTimeoutMs) {
+    body_[0] = '\0';
+    connectCycles = 0;
+
+    if (!socket.connected()) {
+      socket.stop();
+      uint32_t started = ESP.getCycleCount();
+      bool connected = socket.connect(target.host, target.port, connectTimeoutMs);
+      connectCycles = ESP.getCycleCount() - started;
+      if (!connected) {
+        return -1;
+      }
+      socket.setNoDelay(true);
+    }
+
+    int headLen = snprintf(head, sizeof(head),
+        "%s %s HTTP/1.1\r\n"
+        "Host: %s:%u\r\n"
+        "Connection: keep-alive\r\n"
+        "Device-Id: %s\r\n"
+        "%s",
+        method, path, target.host, (unsigned)target.port, target.deviceId, extraHeaders);
+    if (target.apiKey && target.apiKey[0] && headLen < (int)sizeof(head)) {
+      headLen += snprintf(head + headLen, sizeof(head) - headLen, "X-API-Key: %s\r\n", target.apiKey);
+    }
+    if (contentType && headLen < (int)sizeof(head)) {
+      headLen += snprintf(head + headLen, sizeof(head) - headLen,
+          "Content-Type: %s\r\nContent-Length: %u\r\n", contentType, (unsigned)bodyLen);
+    }
+    if (headLen < (int)sizeof(head)) {
+      headLen += snprintf(head + headLen, sizeof(head) - headLen, "\r\n");
+    }
+    if (headLen >= (int)sizeof(head)) {
+      return -1; // Truncated head; never send a malformed request
+    }
+
+    if (socket.write((const uint8_t*)head, headLen) != (size_t)headLen ||
+        (bodyLen > 0 && socket.write(body, bodyLen) != bodyLen)) {
+      socket.stop();
+      return -1;
+    }
+
+    // Status line, then headers until the blank line (head is reused as the
+    // line buffer now that the request is out)
+    unsigned long deadline = millis() + timeoutMs;
+    int httpCode = -1;
+    if (readLine(socket, head, sizeof(head), deadline) && strncmp(head, "HTTP/1.", 7) == 0) {
+      httpCode = atoi(head + 9);
+    }
+
+    long contentLength = -1;
+    bool serverClosing = false;
+    while (httpCode > 0) {
+      if (!readLine(socket, head, sizeof(head), deadline)) {
+        httpCode = -1;
+        break;
+      }
+      if (head[0] == '\0') {
+        break;
+      }
+      if (strncasecmp(head, "Content-Length:", 15) == 0) {
+        contentLength = atol(head + 15);
+      } else if (strncasecmp(head, "Connection:", 11) == 0 && strstr(head + 11, "close")) {
+        serverClosing = true;
+      } else if (strncasecmp(head, "Transfer-Encoding:", 18) == 0) {
+        serverClosing = true; // Chunked bodies are not parsed; read to close instead
+      }
+    }
+
+    // These carry no body and Node sends no Content-Length with them;
+    // reading to close would hold the socket until the deadline
+    if ((httpCode >= 100 && httpCode < 200) || httpCode == 204 || httpCode == 304) {
+      contentLength = 0;
+    }
+
+    // Body: keep what fits, drain the rest so the next request on this
+    // socket starts clean
+    size_t kept = 0;
+    while (httpCode > 0 && contentLength != 0 && (long)(millis() - deadline) < 0) {
+      if (socket.available()) {
+        char ch = (char)socket.read();
+        if (kept < sizeof(body_) - 1) {
+          body_[kept++] = ch;
+        }
+        if (contentLength > 0) contentLength--;
+      } else if (!socket.connected()) {
+        break;
+      } else {
+        delay(1);
+      }
+    }
+    body_[kept] = '\0';
+
+    if (httpCode <= 0 || serverClosing || contentLength > 0) {
+      socket.stop();
+    }
+    return httpCode;
+  }
+
+  // Body of the last response, truncated to ResponseSize - 1
+  const char* response() const { return body_; }
+
+  // Cycles the last request spent connecting; 0 when it reused the socket
+  uint32_t lastConnectCycles() const { return connectCycles; }
+
+  void stop() { socket.stop(); }
+
+ private:
+  WiFiClient socket;
+  char head[HeadSize];
+  char body_[ResponseSize];
+  uint32_t connectCycles = 0;
+};
+
+}  // namespace iot
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Log lines above LOG_LEVEL compile to nothing, arguments included, so a
+// production build set to LOG_LEVEL_WARN pays nothing for per-frame or
+// per-cycle logging. Define LOG_LEVEL before including IotCore.h.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, ...) do { if (LOG_LEVEL >= (level)) Serial.printf(__VA_ARGS__); } while (0)
+#define LOG_E(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_W(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_I(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_D(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
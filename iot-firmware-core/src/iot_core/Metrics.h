@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace iot {
+
+// One log2 histogram per phase, filled from the CPU cycle counter and reset
+// each time it is reported. Bucket i holds [2^i, 2^(i+1)) µs, bucket 0 also
+// holds 0, and the last bucket is open-ended.
+template <uint8_t Buckets>
+struct Histogram {
+  uint32_t count;
+  uint32_t maxUs;
+  uint64_t totalUs;
+  uint32_t buckets[Buckets];
+};
+
+// Phase ids are the sketch's own enum, 0..Count-1. Spans are timed with the
+// core's cycle counter: start and end must run on the same core (pin the
+// tasks), and a span must stay under 2^32 cycles (~17 s at 240 MHz).
+template <uint8_t Count, uint8_t Buckets, bool Enabled>
+class PhaseMetrics {
+ public:
+  typedef Histogram<Buckets> Window[Count];
+
+  void record(uint8_t id, uint32_t us) {
+    uint8_t bucket = us > 1 ? 31 - __builtin_clz(us) : 0;
+    if (bucket > Buckets - 1) bucket = Buckets - 1;
+    portENTER_CRITICAL(&mux);
+    Histogram<Buckets>& h = phases[id];
+    h.count++;
+    h.totalUs += us;
+    if (us > h.maxUs) h.maxUs = us;
+    h.buckets[bucket]++;
+    portEXIT_CRITICAL(&mux);
+  }
+
+  uint32_t start() const {
+    return ESP.getCycleCount();
+  }
+
+  static uint32_t elapsedUs(uint32_t startCycles, uint32_t endCycles) {
+    return (endCycles - startCycles) / ESP.getCpuFreqMHz();
+  }
+
+  void end(uint8_t id, uint32_t startCycles) {
+    record(id, elapsedUs(startCycles, ESP.getCycleCount()));
+  }
+
+  void recordCycles(uint8_t id, uint32_t cycles) {
+    record(id, cycles / ESP.getCpuFreqMHz());
+  }
+
+  // Copies the window out and starts the next one; returns its length in ms
+  unsigned long takeWindow(Window& out) {
+    portENTER_CRITICAL(&mux);
+    memcpy(out, phases, sizeof(out));
+    memset(phases, 0, sizeof(phases));
+    portEXIT_CRITICAL(&mux);
+    unsigned long now = millis();
+    unsigned long windowMs = now - windowStart;
+    windowStart = now;
+    return windowMs;
+  }
+
+  // Appends {"count":..,"meanUs":..,"p50Us":..,...}. Percentiles are the
+  // upper edge of the bucket they fall in, capped at the maximum.
+  static int formatHistogram(char* out, size_t size, const Histogram<Buckets>& h) {
+    uint32_t pct[3] = {0, 0, 0};
+    const uint8_t wanted[3] = {50, 95, 99};
+    uint32_t seen = 0;
+    uint8_t next = 0;
+    for (uint8_t b = 0; b < Buckets && next < 3; b++) {
+      seen += h.buckets[b];
+      while (next < 3 && h.count > 0 && (uint64_t)seen * 100 >= (uint64_t)h.count * wanted[next]) {
+        uint32_t edge = b + 1 < 32 ? (uint32_t)1 << (b + 1) : h.maxUs;
+        pct[next++] = edge < h.maxUs ? edge : h.maxUs;
+      }
+    }
+    return snprintf(out, size, "{\"count\":%u,\"meanUs\":%u,\"p50Us\":%u,\"p95Us\":%u,\"p99Us\":%u,\"maxUs\":%u}",
+                    h.count, h.count ? (uint32_t)(h.totalUs / h.count) : 0, pct[0], pct[1], pct[2], h.maxUs);
+  }
+
+  // Appends "name":{...} for every phase, comma separated. Returns the
+  // length it wanted, like snprintf, so callers can detect truncation.
+  static int formatPhases(char* out, size_t size, const char* const (&names)[Count], const Window& window) {
+    int len = 0;
+    for (uint8_t i = 0; i < Count && len < (int)size; i++) {
+      len += snprintf(out + len, size - len, "%s\"%s\":", i ? "," : "", names[i]);
+      if (len < (int)size) {
+        len += formatHistogram(out + len, size - len, window[i]);
+      }
+    }
+    return len;
+  }
+
+ private:
+  Window phases = {};
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  unsigned long windowStart = 0;
+};
+
+// Metrics compiled out: same interface, no storage, every call a no-op
+template <uint8_t Count, uint8_t Buckets>
+class PhaseMetrics<Count, Buckets, false> {
+ public:
+  typedef Histogram<Buckets> Window[Count];
+
+  void record(uint8_t, uint32_t) {}
+  uint32_t start() const { return 0; }
+  static uint32_t elapsedUs(uint32_t, uint32_t) { return 0; }
+  void end(uint8_t, uint32_t) {}
+  void recordCycles(uint8_t, uint32_t) {}
+  unsigned long takeWindow(Window& out) {
+    memset(out, 0, sizeof(out));
+    return 0;
+  }
+  static int formatPhases(char* out, size_t size, const char* const (&)[Count], const Window&) {
+    if (size > 0) out[0] = '\0';
+    return 0;
+  }
+};
+
+template <typename Profile, uint8_t Count>
+using MetricsFor = PhaseMetrics<Count, Profile::kMetricBuckets, Profile::kMetrics>;
+
+}  // namespace iot
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <Arduino.h>
+#include <mqtt_client.h>
+#include "Log.h"
+
+namespace iot {
+
+// One persistent MQTT session on ESP-IDF's esp-mqtt client, which ships with
+// the ESP32 Arduino core and runs its own task: it connects once WiFi is up,
+// reconnects by itself, and retransmits QoS1 publishes until they are acked.
+// Sessions are clean, so subscriptions are re-sent on every connect.
+template <typename Profile>
+class MqttClient {
+  static_assert(Profile::kWifi, "This device profile has no WiFi");
+
+ public:
+  // Runs on the MQTT task; copy what you need and return quickly
+  typedef void (*MessageHandler)(const char* topic, size_t topicLen, const char* data, size_t len);
+
+  static const uint8_t MAX_SUBSCRIPTIONS = 4;
+
+  // host, clientId and every subscribed topic must outlive the client
+  bool begin(const char* host, uint16_t port, const char* clientId, MessageHandler handler,
+             uint16_t keepAliveS = 30) {
+    onMessage = handler;
+
+    esp_mqtt_client_config_t cfg = {};
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    cfg.broker.address.hostname = host;
+    cfg.broker.address.port = port;
+    cfg.broker.address.transport = MQTT_TRANSPORT_OVER_TCP;
+    cfg.credentials.client_id = clientId;
+    cfg.session.keepalive = keepAliveS;
+#else
+    cfg.host = host;
+    cfg.port = port;
+    cfg.transport = MQTT_TRANSPORT_OVER_TCP;
+    cfg.client_id = clientId;
+    cfg.keepalive = keepAliveS;
+#endif
+
+    client = esp_mqtt_client_init(&cfg);
+    if (!client) {
+      LOG_E("[MQTT] ❌ Failed to create client\n");
+      return false;
+    }
+    esp_mqtt_client_register_event(client, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, &MqttClient::onEvent, this);
+    return esp_mqtt_client_start(client) == ESP_OK;
+  }
+
+  // Call before begin(); the topics are subscribed on every connect
+  bool subscribe(const char* topic, int qos) {
+    if (client || subscriptionCount >= MAX_SUBSCRIPTIONS) return false;
+    subscriptions[subscriptionCount].topic = topic;
+    subscriptions[subscriptionCount].qos = qos;
+    subscriptionCount++;
+    return true;
+  }
+
+  // Returns the message id (0 for QoS0), or -1 when offline or the write
+  // failed. QoS0 is fire-and-forget: written to the socket, never resent.
+  int publish(const char* topic, const void* data, size_t len, int qos) {
+    if (!linkUp) return -1;
+    return esp_mqtt_client_publish(client, topic, (const char*)data, (int)len, qos, 0);
+  }
+
+  bool connected() const { return linkUp; }
+  uint32_t connects() const { return connectCount; }
+
+ private:
+  struct Subscription {
+    const char* topic;
+    int qos;
+  };
+
+  void sendSubscribe(const Subscription& s) {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    esp_mqtt_client_subscribe_single(client, s.topic, s.qos);
+#else
+    esp_mqtt_client_subscribe(client, s.topic, s.qos);
+#endif
+  }
+
+  // Runs on the MQTT task
+  static void onEvent(void* arg, esp_event_base_t base, int32_t eventId, void* eventData) {
+    MqttClient* self = static_cast<MqttClient*>(arg);
+    esp_mqtt_event_handle_t event = static_cast<esp_mqtt_event_handle_t>(eventData);
+    switch ((esp_mqtt_event_id_t)eventId) {
+      case MQTT_EVENT_CONNECTED:
+        self->linkUp = true;
+        self->connectCount++;
+        for (uint8_t i = 0; i < self->subscriptionCount; i++) {
+          self->sendSubscribe(self->subscriptions[i]);
+        }
+        LOG_I("[MQTT] ✅ Connected\n");
+        break;
+      case MQTT_EVENT_DISCONNECTED:
+        if (self->linkUp) LOG_W("[MQTT] Disconnected, reconnecting\n");
+        self->linkUp = false;
+        break;
+      case MQTT_EVENT_DATA:
+        // Messages bigger than the client buffer arrive in pieces; ours never are
+        if (self->onMessage && event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+          self->onMessage(event->topic, event->topic_len, event->data, event->data_len);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  esp_mqtt_client_handle_t client = NULL;
+  MessageHandler onMessage = NULL;
+  Subscription subscriptions[MAX_SUBSCRIPTIONS];
+  uint8_t subscriptionCount = 0;
+  volatile bool linkUp = false;
+  volatile uint32_t connectCount = 0;
+};
+
+}  // namespace iot
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include "HttpClient.h"
+#include "Log.h"
+
+namespace iot {
+
+// Firmware updates over HTTP, written straight into the inactive app
+// partition (the sketch needs a partition scheme with two OTA slots, e.g.
+// "Minimal SPIFFS (1.9MB APP with OTA)"; "Huge APP" has none). The device
+// asks now and then with
+//   GET /api/v1/firmware/<channel>
+//       Firmware-MD5: <running image>       ESP.getSketchMD5()
+//       Firmware-Rejected: <md5>            an image that was rolled back
+// and gets 204 when it is current, or 200 with the image as the body:
+//   Firmware-Format: full | delta          delta: patched against the running image
+//   Firmware-MD5, Firmware-Size            the new image
+//   Firmware-Base-MD5                      delta only; must be the running image
+// A delta body is "IOTD", u32 base size, u32 image size, then ops
+// (little-endian): 'C' u32 offset u32 length copies from the running
+// partition, 'I' u32 length is followed by that many literal bytes.
+//
+// Nothing is buffered beyond one 1 KB chunk: service() moves the stream into
+// flash for at most kOtaSliceMs per call, so a camera keeps sending frames
+// in between. Update.end() checks the MD5 and the image before the boot
+// partition is switched; ready() then says the next restart (restart(),
+// whenever the sketch has nothing in flight) boots the new image.
+//
+// The new image boots on probation. It has kOtaProbationMs to call
+// confirm() after its first real exchange with the backend, or it is
+// marked invalid and the bootloader goes back to the previous image; a
+// reset before confirm() does the same. A rolled-back image is sent as
+// Firmware-Rejected so the backend does not offer it again. For probation
+// to apply, the sketch keeps Arduino from confirming every boot itself:
+//
+//   extern "C" bool verifyRollbackLater() { return true; }
+//   iot::OtaUpdater<Device> ota("camera");
+//   ota.begin();                                    // setup()
+//   if (ota.service(serverTarget, HTTP_TIMEOUT_MS)) ota.restart();
+//   if (ota.onProbation() && successCount > 0) ota.confirm();
+enum OtaState : uint8_t { OTA_IDLE, OTA_DOWNLOADING, OTA_READY };
+
+template <typename Profile>
+class OtaUpdater {
+  static_assert(Profile::kOta, "This device profile has no OTA updates");
+
+ public:
+  static constexpr uint32_t kDeltaMagic = 0x44544f49;  // "IOTD"
+  static constexpr size_t kChunkSize = 1024;
+
+  explicit OtaUpdater(const char* channel) : channel(channel) {}
+
+  // In setup(): starts probation for a freshly booted image and notes an
+  // image that did not stick
+  void begin() {
+    esp_ota_img_states_t imgState;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &imgState) == ESP_OK &&
+        imgState == ESP_OTA_IMG_PENDING_VERIFY) {
+      probationUntil = millis() + Profile::kOtaProbationMs;
+      if (probationUntil == 0) probationUntil = 1;
+      LOG_W("[OTA] New image on probation for %u s\n", (unsigned)(Profile::kOtaProbationMs / 1000));
+    }
+
+    Preferences prefs;
+    prefs.begin("ota", false);
+    prefs.getString("rejected", rejected, sizeof(rejected));
+    char staged[33] = "";
+    prefs.getString("staged", staged, sizeof(staged));
+    if (staged[0] && strcmp(staged, runningMd5()) != 0) {
+      // Staged and restarted into, but the previous image is running again
+      LOG_W("[OTA] Image %s was rolled back\n", staged);
+      strlcpy(rejected, staged, sizeof(rejected));
+      prefs.putString("rejected", rejected);
+      prefs.remove("staged");
+    }
+    prefs.end();
+  }
+
+  bool onProbation() const { return probationUntil != 0; }
+
+  // The new image works: keep it
+  void confirm() {
+    if (!onProbation()) return;
+    esp_ota_mark_app_valid_cancel_rollback();
+    probationUntil = 0;
+    Preferences prefs;
+    prefs.begin("ota", false);
+    prefs.remove("staged");
+    prefs.end();
+    LOG_I("[OTA] ✅ Image %s confirmed\n", runningMd5());
+  }
+
+  bool downloading() const { return state == OTA_DOWNLOADING; }
+  bool ready() const { return state == OTA_READY; }
+
+  // Call often from the task that owns the network: rolls back an image
+  // that overran its probation, checks every kOtaCheckIntervalMs and moves
+  // one slice of a running download. Returns true once an image is staged.
+  bool service(const HttpTarget& target, unsigned long timeoutMs) {
+    if (onProbation() && (long)(millis() - probationUntil) >= 0) {
+      LOG_E("[OTA] ❌ Image not confirmed within %u s, rolling back\n",
+            (unsigned)(Profile::kOtaProbationMs / 1000));
+      esp_ota_mark_app_invalid_rollback_and_reboot(); // Returns only when there is nothing to go back to
+      probationUntil = 0;
+    }
+    if (state == OTA_READY) return true;
+
+    if (WiFi.status() != WL_CONNECTED) {
+      if (state == OTA_DOWNLOADING) fail("WiFi lost");
+      return false;
+    }
+    if (state == OTA_IDLE) {
+      // A new image proves itself before it looks for the next one
+      if (onProbation() || (lastCheck != 0 && millis() - lastCheck < Profile::kOtaCheckIntervalMs)) {
+        return false;
+      }
+      lastCheck = millis();
+      if (lastCheck == 0) lastCheck = 1;
+      startDownload(target, timeoutMs);
+      return false;
+    }
+    pump(timeoutMs);
+    return state == OTA_READY;
+  }
+
+  // Checks now and downloads to the end, for a duty-cycle wake that has
+  // no next loop to continue in
+  bool updateNow(const HttpTarget& target, unsigned long timeoutMs) {
+    lastCheck = 0;
+    while (!service(target, timeoutMs) && state == OTA_DOWNLOADING) {
+      delay(1);
+    }
+    return ready();
+  }
+
+  void restart() {
+    LOG_I("[OTA] Restarting into the new image\n");
+    Serial.flush();
+    ESP.restart();
+  }
+
+ private:
+  const char* runningMd5() {
+    if (!md5[0]) {
+      // Hashes the whole running image once (a few hundred ms); cached after
+      strlcpy(md5, ESP.getSketchMD5().c_str(), sizeof(md5));
+    }
+    return md5;
+  }
+
+  void startDownload(const HttpTarget& target, unsigned long timeoutMs) {
+    const char* running = runningMd5();
+    if (!socket.connect(target.host, target.port, timeoutMs)) {
+      LOG_W("[OTA] Check failed: cannot reach %s:%u\n", target.host, (unsigned)target.port);
+      return;
+    }
+
+    char head[384];
+    int headLen = snprintf(head, sizeof(head),
+        "GET /api/v1/firmware/%s HTTP/1.1\r\n"
+        "Host: %s:%u\r\n"
+        "Connection: close\r\n"
+        "Device-Id: %s\r\n"
+        "Firmware-MD5: %s\r\n",
+        channel, target.host, (unsigned)target.port, target.deviceId, running);
+    if (rejected[0] && headLen < (int)sizeof(head)) {
+      headLen += snprintf(head + headLen, sizeof(head) - headLen, "Firmware-Rejected: %s\r\n", rejected);
+    }
+    if (target.apiKey && target.apiKey[0] && headLen < (int)sizeof(head)) {
+      headLen += snprintf(head + headLen, sizeof(head) - headLen, "X-API-Key: %s\r\n", target.apiKey);
+    }
+    if (headLen < (int)sizeof(head)) {
+      headLen += snprintf(head + headLen, sizeof(head) - headLen, "\r\n");
+    }
+    if (headLen >= (int)sizeof(head) || socket.write((const uint8_t*)head, headLen) != (size_t)headLen) {
+      socket.stop();
+      return;
+    }
+
+    // Response head; head is reused as the line buffer
+    unsigned long deadline = millis() + timeoutMs;
+    int httpCode = -1;
+    if (readLine(socket, head, sizeof(head), deadline) && strncmp(head, "HTTP/1.", 7) == 0) {
+      httpCode = atoi(head + 9);
+    }
+    long contentLength = -1;
+    uint32_t imageSize = 0;
+    bool delta = false;
+    char imageMd5[33] = "";
+    char baseMd5[33] = "";
+    char version[24] = "";
+    while (httpCode > 0) {
+      if (!readLine(socket, head, sizeof(head), deadline)) {
+        httpCode = -1;
+        break;
+      }
+      if (head[0] == '\0') break;
+      if (strncasecmp(head, "Content-Length:", 15) == 0) {
+        contentLength = atol(head + 15);
+      } else if (strncasecmp(head, "Firmware-Format:", 16) == 0) {
+        delta = strstr(head + 16, "delta") != NULL;
+      } else if (strncasecmp(head, "Firmware-Size:", 14) == 0) {
+        imageSize = strtoul(head + 14, NULL, 10);
+      } else if (strncasecmp(head, "Firmware-MD5:", 13) == 0) {
+        copyHeaderValue(imageMd5, sizeof(imageMd5), head + 13);
+      } else if (strncasecmp(head, "Firmware-Base-MD5:", 18) == 0) {
+        copyHeaderValue(baseMd5, sizeof(baseMd5), head + 18);
+      } else if (strncasecmp(head, "Firmware-Version:", 17) == 0) {
+        copyHeaderValue(version, sizeof(version), head + 17);
+      }
+    }
+
+    if (httpCode == 204) {
+      LOG_D("[OTA] Firmware is current\n");
+      socket.stop();
+      return;
+    }
+    if (httpCode != 200) {
+      LOG_W("[OTA] Check failed. Code: %d\n", httpCode);
+      socket.stop();
+      return;
+    }
+    if (contentLength <= 0 || imageSize == 0 || strlen(imageMd5) != 32 ||
+        (delta && strcmp(baseMd5, running) != 0)) {
+      LOG_W("[OTA] Offer is incomplete or not for this image, ignored\n");
+      socket.stop();
+      return;
+    }
+    if (!Update.begin(imageSize) || !Update.setMD5(imageMd5)) {
+      LOG_E("[OTA] ❌ Cannot stage %u bytes: %s\n", (unsigned)imageSize, Update.errorString());
+      Update.abort();
+      socket.stop();
+      return;
+    }
+
+    LOG_I("[OTA] Downloading %s: %s, %ld bytes for a %u byte image\n", version[0] ? version : imageMd5,
+          delta ? "delta" : "full image", contentLength, (unsigned)imageSize);
+    state = OTA_DOWNLOADING;
+    this->delta = delta;
+    this->imageSize = imageSize;
+    remaining = contentLength;
+    received = 0;
+    headerSeen = !delta;
+    opHave = 0;
+    copyRemaining = 0;
+    insertRemaining = 0;
+    startedAt = millis();
+    lastByteAt = startedAt;
+  }
+
+  static void copyHeaderValue(char* dst, size_t size, const char* value) {
+    while (*value == ' ') value++;
+    strlcpy(dst, value, size);
+  }
+
+  // Size of the delta header or op being read; an op's size is known once
+  // its first byte is in
+  size_t opLength() const {
+    if (!headerSeen) return 12;
+    if (opHave == 0) return 1;
+    return opBuf[0] == 'C' ? 9 : opBuf[0] == 'I' ? 5 : 1;
+  }
+
+  // Bytes the stream owes the current step
+  size_t wanted() const {
+    if (!delta) return remaining;
+    if (insertRemaining > 0) return insertRemaining;
+    return opLength() - opHave;
+  }
+
+  void pump(unsigned long timeoutMs) {
+    unsigned long sliceStart = millis();
+    while (state == OTA_DOWNLOADING && millis() - sliceStart < Profile::kOtaSliceMs) {
+      if (copyRemaining > 0) {
+        size_t n = copyRemaining < kChunkSize ? copyRemaining : kChunkSize;
+        if (esp_partition_read(esp_ota_get_running_partition(), copyOffset, chunk, n) != ESP_OK) {
+          fail("cannot read the running image");
+          return;
+        }
+        if (!write(chunk, n)) return;
+        copyOffset += n;
+        copyRemaining -= n;
+        continue;
+      }
+      if (remaining == 0) {
+        finish();
+        return;
+      }
+
+      int available = socket.available();
+      if (available <= 0) {
+        if (!socket.connected()) {
+          fail("connection closed");
+        } else if (millis() - lastByteAt > timeoutMs) {
+          fail("download stalled");
+        }
+        return; // Wait for more on the next call rather than hold the task
+      }
+      size_t want = wanted();
+      size_t n = (size_t)available < want ? (size_t)available : want;
+      if (n > kChunkSize) n = kChunkSize;
+      if ((long)n > remaining) n = remaining;
+      int got = socket.read(delta && insertRemaining == 0 ? opBuf + opHave : chunk, n);
+      if (got <= 0) continue;
+      remaining -= got;
+      received += got;
+      lastByteAt = millis();
+
+      if (!delta) {
+        if (!write(chunk, got)) return;
+      } else if (insertRemaining > 0) {
+        insertRemaining -= got;
+        if (!write(chunk, got)) return;
+      } else {
+        opHave += got;
+        if (opHave == opLength()) decodeOp();
+      }
+    }
+  }
+
+  // Acts on opBuf once a header or op is complete
+  void decodeOp() {
+    uint32_t a, b;
+    if (!headerSeen) {
+      uint32_t magic;
+      memcpy(&magic, opBuf, 4);
+      memcpy(&a, opBuf + 4, 4);
+      memcpy(&b, opBuf + 8, 4);
+      if (magic != kDeltaMagic || a > ESP.getSketchSize() || b != imageSize) {
+        fail("not a delta for this image");
+        return;
+      }
+      baseSize = a;
+      headerSeen = true;
+    } else if (opBuf[0] == 'C') {
+      memcpy(&a, opBuf + 1, 4);
+      memcpy(&b, opBuf + 5, 4);
+      if (a > baseSize || b > baseSize - a) {
+        fail("delta copies past the base image");
+        return;
+      }
+      copyOffset = a;
+      copyRemaining = b;
+    } else if (opBuf[0] == 'I') {
+      memcpy(&a, opBuf + 1, 4);
+      insertRemaining = a;
+    } else {
+      fail("corrupt delta");
+      return;
+    }
+    opHave = 0;
+  }
+
+  bool write(uint8_t* data, size_t len) {
+    if (Update.write(data, len) != len) {
+      fail(Update.errorString());
+      return false;
+    }
+    return true;
+  }
+
+  void finish() {
+    socket.stop();
+    if ((delta && (!headerSeen || opHave > 0 || insertRemaining > 0)) || !Update.end()) {
+      fail(Update.hasError() ? Update.errorString() : "image ends early");
+      return;
+    }
+    // Checked in begin() after the restart: running anything else means
+    // the new image was rolled back
+    Preferences prefs;
+    prefs.begin("ota", false);
+    prefs.putString("staged", Update.md5String());
+    prefs.end();
+    state = OTA_READY;
+    LOG_I("[OTA] ✅ Image verified and staged: %u bytes received in %lu ms\n",
+          (unsigned)received, millis() - startedAt);
+  }
+
+  void fail(const char* reason) {
+    LOG_W("[OTA] Update failed after %u bytes: %s\n", (unsigned)received, reason);
+    Update.abort();
+    socket.stop();
+    state = OTA_IDLE;
+  }
+
+  const char* channel;
+  WiFiClient socket;
+  OtaState state = OTA_IDLE;
+  uint32_t probationUntil = 0;
+  unsigned long lastCheck = 0;
+  unsigned long startedAt = 0;
+  unsigned long lastByteAt = 0;
+  char md5[33] = "";
+  char rejected[33] = "";
+
+  // Download in progress
+  bool delta = false;
+  bool headerSeen = false;
+  long remaining = 0;
+  uint32_t received = 0;
+  uint32_t imageSize = 0;
+  uint32_t baseSize = 0;
+  uint32_t copyOffset = 0;
+  uint32_t copyRemaining = 0;
+  uint32_t insertRemaining = 0;
+  uint8_t opBuf[12];
+  size_t opHave = 0;
+  uint8_t chunk[kChunkSize];
+};
+
+}  // namespace iot
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace iot {
+
+// Device profiles: what each board uses, fixed at compile time. Components
+// take the profile as a template argument and static_assert on the features
+// they need, and a feature the profile turns off is never instantiated, so it
+// costs neither flash nor RAM. A sketch tunes its profile by deriving from
+// one and shadowing members:
+//
+//   struct Device : iot::CameraProfile {
+//     static constexpr bool kMetrics = METRICS_ENABLED;
+//   };
+//
+// Members are only ever read by value, so they need no out-of-line
+// definitions under C++11 (ESP32 core 2.x).
+struct BaseProfile {
+  // Connection manager
+  static constexpr bool kWifi = true;
+  static constexpr bool kWifiSleep = true;              // Modem sleep between beacons
+  static constexpr uint32_t kWifiFastConnectMs = 1000;  // Budget for a join from the cached AP
+  static constexpr uint32_t kWifiJoinTimeoutMs = 15000; // Budget for a full scan + DHCP join
+  static constexpr uint32_t kWifiRetryIntervalMs = 5000;
+
+  // Persistent settings and the serial config console
+  static constexpr bool kConfigStore = true;
+  static constexpr bool kRemoteConfig = true;           // Patches from the backend (RemoteConfig.h)
+
+  // Firmware updates (see OtaUpdater.h)
+  static constexpr bool kOta = true;
+  static constexpr uint32_t kOtaCheckIntervalMs = 3600000; // Ask the backend for a new image
+  static constexpr uint32_t kOtaProbationMs = 300000;   // A new image must confirm() within this
+  static constexpr uint32_t kOtaSliceMs = 50;           // Longest a service() call downloads for
+
+  // Phase histograms (see Metrics.h)
+  static constexpr bool kMetrics = true;
+  static constexpr uint8_t kMetricBuckets = 24;         // Last bucket is open-ended (>= 8 s)
+
+  // Buzzer pattern engine (see BuzzerEngine.h)
+  static constexpr bool kBuzzer = false;
+  static constexpr int kBuzzerPin = -1;
+  static constexpr int kBuzzerVccPin = -1;              // Driven high while sounding; -1 = none
+  static constexpr uint8_t kBuzzerLedcChannel = 0;      // Core 2.x only; 3.x assigns a channel per pin
+};
+
+// ESP32-CAM: frames over WiFi, no buzzer. Modem sleep adds up to a beacon
+// interval to every frame, so the radio stays awake.
+struct CameraProfile : BaseProfile {
+  static constexpr bool kWifiSleep = false;
+  static constexpr uint32_t kOtaSliceMs = 15;           // Between frames, well under a frame interval
+};
+
+// DHT11/LDR/HC-SR04 node with its buzzer
+struct MultiSensorProfile : BaseProfile {
+  static constexpr uint8_t kMetricBuckets = 26;         // Long-polls run past 8 s (>= 33 s)
+  static constexpr bool kBuzzer = true;
+  static constexpr int kBuzzerPin = 25;
+};
+
+// Stand-alone buzzer driven from the serial port; no network at all
+struct BuzzerProfile : BaseProfile {
+  static constexpr bool kWifi = false;
+  static constexpr bool kConfigStore = false;
+  static constexpr bool kRemoteConfig = false;
+  static constexpr bool kOta = false;
+  static constexpr bool kMetrics = false;
+  static constexpr bool kBuzzer = true;
+  static constexpr int kBuzzerPin = 25;
+  static constexpr int kBuzzerVccPin = 23;
+};
+
+}  // namespace iot
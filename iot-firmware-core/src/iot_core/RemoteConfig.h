@@ -0,0 +1,126 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Config.h"
+#include "HttpClient.h"
+#include "Log.h"
+
+namespace iot {
+
+// Config patches pushed from the backend (POST /api/v1/devices/:id/command
+// with a "config" command). The backend never opens a connection to a
+// device; it advertises the pending patch's version on responses the device
+// already gets instead: "configPending":<version> in a JSON body, or the
+// Config-Pending header on a camera's frame response. The device then
+//   GET  /api/v1/devices/<id>/config          KEY=VALUE lines, CONFIG_VERSION last
+//   POST /api/v1/devices/<id>/config/applied  {"version":..,"applied":..,"rejected":".."}
+// Only IOT_CONFIG_REMOTE_* fields are written. The patch is saved to
+// Preferences before the ack, so it survives a restart; the config's
+// version field (CONFIG_VERSION, remote) keeps an old patch from being
+// applied twice. The server stops advertising a version once it is acked;
+// while it still does, the ack is resent.
+//
+//   iot::RemoteConfig<Device, Config> remoteConfig(configStore, config, &Config::configVersion);
+//   remoteConfig.notice(version);                 // from any task
+//   if (remoteConfig.service(http, target, HTTP_TIMEOUT_MS)) applyTuning();
+template <typename Profile, typename T>
+class RemoteConfig {
+  static_assert(Profile::kRemoteConfig, "This device profile has no remote config");
+
+ public:
+  static constexpr size_t kPatchSize = 320;
+  static constexpr unsigned long kRetryMs = 10000;
+
+  RemoteConfig(ConfigStore<Profile, T>& store, T& cfg, uint32_t T::*version)
+      : store(store), cfg(cfg), version(version) {}
+
+  // A response advertised this version. Safe from any task.
+  void notice(uint32_t pendingVersion) {
+    if (pendingVersion > pending) pending = pendingVersion;
+  }
+
+  // Picks "configPending":<version> out of a (possibly truncated) JSON body
+  void noticeBody(const char* body) {
+    const char* found = strstr(body, "\"configPending\":");
+    if (found) notice(strtoul(found + 16, NULL, 10));
+  }
+
+  // Work to do: a newer patch to fetch, or an ack the server has not seen
+  bool due() const {
+    bool work = pending > cfg.*version || (pending != 0 && acked < cfg.*version);
+    return work && (lastAttempt == 0 || millis() - lastAttempt >= kRetryMs);
+  }
+
+  // Fetches, applies, saves and acknowledges the pending patch on the task
+  // that owns client. Returns true when settings changed, so the caller can
+  // put them into effect.
+  template <typename Client>
+  bool service(Client& client, const HttpTarget& target, unsigned long timeoutMs) {
+    if (!due()) return false;
+    lastAttempt = millis();
+    if (lastAttempt == 0) lastAttempt = 1;
+
+    char path[96];
+    snprintf(path, sizeof(path), "/api/v1/devices/%s/config", target.deviceId);
+    int applied = 0;
+    if (pending > cfg.*version) {
+      uint32_t wanted = pending;
+      int httpCode = client.request(target, "GET", path, NULL, NULL, 0, "", timeoutMs, timeoutMs);
+      if (httpCode == 204) {
+        // Nothing pending after all (the backend restarted, or the patch was
+        // replaced and acked): stop asking until the next advertisement
+        LOG_W("[Config] Patch %u is gone from the server, dropped\n", (unsigned)wanted);
+        if (pending == wanted) pending = cfg.*version;
+        return false;
+      }
+      if (httpCode != 200) {
+        LOG_W("[Config] Fetching patch %u failed. Code: %d\n", (unsigned)pending, httpCode);
+        return false;
+      }
+      // Every line ends in a newline and CONFIG_VERSION comes last, so a body
+      // cut short by the response buffer is caught before a value is
+      size_t len = strlcpy(patch, client.response(), sizeof(patch));
+      if (len == 0 || len >= sizeof(patch) || patch[len - 1] != '\n' || !strstr(patch, "CONFIG_VERSION=")) {
+        LOG_W("[Config] Patch %u is truncated or malformed, not applied\n", (unsigned)pending);
+        return false;
+      }
+
+      uint32_t before = cfg.*version;
+      applied = store.applyPatch(cfg, patch, rejected, sizeof(rejected));
+      // A patch without CONFIG_VERSION would otherwise be fetched forever
+      if (cfg.*version <= before) cfg.*version = pending;
+      store.save(cfg);
+      lastApplied = applied;
+      LOG_I("[Config] Applied %d settings, now at version %u%s%s\n", applied, (unsigned)(cfg.*version),
+            rejected[0] ? ", rejected " : "", rejected);
+    }
+
+    // Until this lands the server keeps advertising the version, and the
+    // ack is retried
+    char body[160];
+    int len = snprintf(body, sizeof(body), "{\"version\":%u,\"applied\":%d,\"rejected\":\"%s\"}",
+                       (unsigned)(cfg.*version), lastApplied, rejected);
+    strlcat(path, "/applied", sizeof(path));
+    int httpCode = client.request(target, "POST", path, "application/json", (const uint8_t*)body,
+                                  len < (int)sizeof(body) ? len : sizeof(body) - 1, "", timeoutMs, timeoutMs);
+    if (httpCode == 200) {
+      acked = cfg.*version;
+    } else {
+      LOG_W("[Config] Ack for version %u failed. Code: %d\n", (unsigned)(cfg.*version), httpCode);
+    }
+    return applied > 0;
+  }
+
+ private:
+  ConfigStore<Profile, T>& store;
+  T& cfg;
+  uint32_t T::*version;
+  volatile uint32_t pending = 0;
+  uint32_t acked = 0;
+  unsigned long lastAttempt = 0;
+  int lastApplied = 0;
+  char patch[kPatchSize];
+  char rejected[96] = "";
+};
+
+}  // namespace iot
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include "Log.h"
+
+namespace iot {
+
+// Last good association, reused to skip the scan on the next join. The
+// sketch keeps it in RTC memory (RTC_DATA_ATTR) so it survives deep sleep
+// and soft resets; the manager mirrors it to Preferences for power cycles.
+// No lease is kept: an expired or reassigned lease still associates, so
+// reusing one would cause a silent address conflict.
+#define IOT_WIFI_CACHE_MAGIC 0x57494632  // 'WIF2'
+struct WifiCache {
+  uint32_t magic;
+  uint8_t bssid[6];
+  int32_t channel;
+};
+
+// What to join. The strings are read again on every join, so they must
+// outlive the manager (point them into the sketch's config).
+struct WifiSettings {
+  const char* ssid;
+  const char* password;
+  const char* staticIp;   // Fixed address (no DHCP); empty runs DHCP
+  const char* gateway;
+  const char* subnet;
+};
+
+// Connection manager: joins without blocking and rejoins from WiFi events,
+// so neither boot nor an outage stalls the caller. A join first tries the
+// cached BSSID/channel (no scan), then falls back to a full scan. DHCP is
+// skipped only when settings.staticIp is set.
+template <typename Profile>
+class WifiManager {
+  static_assert(Profile::kWifi, "This device profile has no WiFi");
+
+ public:
+  explicit WifiManager(WifiCache& cache) : cache(cache) {}
+
+  void begin(const WifiSettings& wanted) {
+    settings = wanted;
+    WiFi.persistent(false);        // The cache replaces the SDK's flash copy
+    WiFi.setAutoReconnect(false);  // service() owns reconnects
+    WiFi.mode(WIFI_STA);
+    WiFi.setSleep(Profile::kWifiSleep);
+    WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) { onEvent(event, info); });
+
+    if (cache.magic != IOT_WIFI_CACHE_MAGIC) {
+      Preferences prefs;
+      prefs.begin("wifi", true);
+      prefs.getBytes("cache", &cache, sizeof(cache));
+      prefs.end();
+    }
+
+    LOG_I("[WiFi] Joining %s%s\n", settings.ssid,
+          cache.magic == IOT_WIFI_CACHE_MAGIC ? " (cached AP)" : "");
+    beginJoin();
+  }
+
+  // Call often. Logs and caches a new link, and starts the next join when
+  // the current one has failed or run out of time. Returns true once per
+  // new link.
+  bool service() {
+    unsigned long now = millis();
+    bool connected = false;
+
+    if (gotIp) {
+      gotIp = false;
+      skipCache = false;
+      connected = true;
+      LOG_I("[WiFi] ✅ Connected in %lu ms (%s), IP %s, RSSI %d dBm\n",
+            now - joinStartedAt, joinFromCache ? "cached AP" : "full scan",
+            WiFi.localIP().toString().c_str(), WiFi.RSSI());
+      saveCache();
+    }
+    if (linkUp) return connected;
+
+    // Casts keep the profile constants rvalues (no out-of-line definitions under C++11)
+    unsigned long budget = joinFromCache ? (unsigned long)Profile::kWifiFastConnectMs
+                                         : (unsigned long)Profile::kWifiJoinTimeoutMs;
+    if (!joinFailed && now - joinStartedAt < budget) return connected;
+
+    if (joinFromCache) {
+      // AP moved or changed channel: scan right away
+      LOG_I("[WiFi] Cached AP failed, scanning\n");
+      skipCache = true;
+      WiFi.disconnect();
+      beginJoin();
+      return connected;
+    }
+
+    if (nextJoinAt == 0) {
+      nextJoinAt = now + Profile::kWifiRetryIntervalMs;
+      LOG_W("[WiFi] Join failed, retrying in %u ms\n", (unsigned)Profile::kWifiRetryIntervalMs);
+      WiFi.disconnect();
+    }
+    if ((long)(now - nextJoinAt) >= 0) {
+      nextJoinAt = 0;
+      skipCache = false;
+      beginJoin();
+    }
+    return connected;
+  }
+
+  // Blocking join, for callers with nothing else to do meanwhile
+  bool waitFor(const WifiSettings& wanted, unsigned long timeoutMs) {
+    begin(wanted);
+    unsigned long startedAt = millis();
+    while (!linkUp && millis() - startedAt < timeoutMs) {
+      service();
+      delay(5);
+    }
+    service(); // Log and cache the new link
+    return linkUp;
+  }
+
+  bool up() const { return linkUp; }
+  uint32_t joins() const { return joinCount; }
+  uint32_t disconnects() const { return disconnectCount; }
+
+ private:
+  // Runs on the WiFi event task
+  void onEvent(arduino_event_id_t event, arduino_event_info_t info) {
+    switch (event) {
+      case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+        linkUp = true;
+        gotIp = true;
+        break;
+      case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+        if (linkUp) disconnectCount++;
+        linkUp = false;
+        // Our own disconnect() can land after the next join has started
+        if (info.wifi_sta_disconnected.reason != WIFI_REASON_ASSOC_LEAVE) {
+          joinFailed = true;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  void beginJoin() {
+    IPAddress ip, gateway, subnet, dns;
+    joinFromCache = cache.magic == IOT_WIFI_CACHE_MAGIC && !skipCache;
+
+    if (settings.staticIp[0] && ip.fromString(settings.staticIp)) {
+      gateway.fromString(settings.gateway);
+      subnet.fromString(settings.subnet);
+      dns = gateway;
+    }
+    WiFi.config(ip, gateway, subnet, dns); // 0.0.0.0 = DHCP
+
+    joinFailed = false;
+    joinStartedAt = millis();
+    joinCount++;
+    if (joinFromCache) {
+      WiFi.begin(settings.ssid, settings.password, cache.channel, cache.bssid);
+    } else {
+      WiFi.begin(settings.ssid, settings.password);
+    }
+  }
+
+  void saveCache() {
+    WifiCache fresh = {};
+    fresh.magic = IOT_WIFI_CACHE_MAGIC;
+    memcpy(fresh.bssid, WiFi.BSSID(), sizeof(fresh.bssid));
+    fresh.channel = WiFi.channel();
+    if (memcmp(&fresh, &cache, sizeof(fresh)) != 0) {
+      // Only write flash when the AP actually changed
+      cache = fresh;
+      Preferences prefs;
+      prefs.begin("wifi", false);
+      prefs.putBytes("cache", &cache, sizeof(cache));
+      prefs.end();
+    }
+  }
+
+  WifiCache& cache;
+  WifiSettings settings = {"", "", "", "", ""};
+  // The event handler runs on the WiFi event task
+  volatile bool linkUp = false;
+  volatile bool joinFailed = false;
+  volatile bool gotIp = false;
+  volatile uint32_t disconnectCount = 0;
+  bool joinFromCache = false;
+  bool skipCache = false;       // The cached join just failed; do a full one
+  unsigned long joinStartedAt = 0;
+  unsigned long nextJoinAt = 0;
+  uint32_t joinCount = 0;
+};
+
+}  // namespace iot